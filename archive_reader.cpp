@@ -0,0 +1,837 @@
+//  Reading the members of archives for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "archive_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+//  Compressed input is read in pieces this big
+constexpr size_t input_size = 256 * 1024;
+
+constexpr size_t tar_block = 512;
+
+//  A member name longer than this can't be right
+constexpr uint64_t max_name_size = 64 * 1024;
+
+//  Zip signatures
+constexpr uint32_t zip_local_header = 0x04034b50;
+constexpr uint32_t zip_central_header = 0x02014b50;
+constexpr uint32_t zip_end = 0x06054b50;
+constexpr uint32_t zip64_end = 0x06064b50;
+constexpr uint32_t zip64_locator = 0x07064b50;
+
+//  Zip is little endian all the way
+uint16_t get16(const unsigned char* data)
+{
+    return uint16_t(data[0] | (data[1] << 8));
+}
+
+uint32_t get32(const unsigned char* data)
+{
+    return uint32_t(get16(data)) | (uint32_t(get16(data + 2)) << 16);
+}
+
+uint64_t get64(const unsigned char* data)
+{
+    return uint64_t(get32(data)) | (uint64_t(get32(data + 4)) << 32);
+}
+
+ssize_t read_fully(int fd, void* buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t count = ::read(fd, static_cast<char*>(buffer) + done, size - done);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        done += size_t(count);
+    }
+
+    return ssize_t(done);
+}
+
+//  A tar number is octal digits, or base-256 for the big ones
+bool tar_number(const char* field, size_t size, uint64_t& value)
+{
+    value = 0;
+    if (static_cast<unsigned char>(field[0]) & 0x80)
+    {
+        for (size_t ix = 1; ix < size; ++ix)
+        {
+            value = (value << 8) | static_cast<unsigned char>(field[ix]);
+        }
+
+        return true;
+    }
+
+    size_t ix = 0;
+    while (ix < size && field[ix] == ' ')
+    {
+        ++ix;
+    }
+
+    bool any = false;
+    for (; ix < size && field[ix] >= '0' && field[ix] <= '7'; ++ix)
+    {
+        value = value * 8 + uint64_t(field[ix] - '0');
+        any = true;
+    }
+
+    return any || ix == size || field[ix] == '\0';
+}
+
+//  A text field, which has a NUL at the end unless it's full
+std::string tar_string(const char* field, size_t size)
+{
+    return std::string(field, strnlen(field, size));
+}
+
+bool is_zero_block(const char* block)
+{
+    for (size_t ix = 0; ix < tar_block; ++ix)
+    {
+        if (block[ix] != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool tar_checksum_ok(const char* block)
+{
+    uint64_t stored;
+    if (!tar_number(block + 148, 8, stored))
+    {
+        return false;
+    }
+
+    //  The checksum field itself counts as spaces
+    uint64_t sum = 0;
+    for (size_t ix = 0; ix < tar_block; ++ix)
+    {
+        sum += (ix >= 148 && ix < 156) ? ' ' : static_cast<unsigned char>(block[ix]);
+    }
+
+    return sum == stored;
+}
+
+//  The records of a pax extended header are "length key=value\n"
+void parse_pax(const std::string& text, std::string& path, uint64_t& size, bool& has_size)
+{
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t space = text.find(' ', pos);
+        if (space == std::string::npos)
+        {
+            return;
+        }
+
+        size_t length = std::strtoul(text.c_str() + pos, nullptr, 10);
+        if (length == 0 || pos + length > text.size() || length < space - pos + 2)
+        {
+            return;
+        }
+
+        std::string record = text.substr(space + 1, pos + length - space - 2);
+        size_t equals = record.find('=');
+        if (equals != std::string::npos)
+        {
+            std::string key = record.substr(0, equals);
+            if (key == "path")
+            {
+                path = record.substr(equals + 1);
+            }
+            else if (key == "size")
+            {
+                size = std::strtoull(record.c_str() + equals + 1, nullptr, 10);
+                has_size = true;
+            }
+        }
+
+        pos += length;
+    }
+}
+
+}  // namespace
+
+
+ArchiveReader::~ArchiveReader()
+{
+    if (m_inflating)
+    {
+        inflateEnd(&m_zip_stream);
+    }
+
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+}
+
+
+bool ArchiveReader::is_archive(const char* path)
+{
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    char head[tar_block];
+    ssize_t size = read_fully(fd, head, sizeof(head));
+    ::close(fd);
+
+    auto bytes = reinterpret_cast<const unsigned char*>(head);
+    return (size >= 4 && get32(bytes) == zip_local_header) ||
+           (size >= 4 && get32(bytes) == zip_end) ||
+           (size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b) ||
+           (size == ssize_t(tar_block) && std::memcmp(head + 257, "ustar", 5) == 0);
+}
+
+
+bool ArchiveReader::open(const char* path)
+{
+    m_path = path;
+    m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+    {
+        return fail(std::string("Could not open ") + path + ": " + std::strerror(errno));
+    }
+
+    unsigned char head[4] = {};
+    ssize_t size = ::pread(m_fd, head, sizeof(head), 0);
+    if (size >= 4 && (get32(head) == zip_local_header || get32(head) == zip_end))
+    {
+        m_format = eZIP;
+        return open_zip();
+    }
+
+    std::memset(&m_zip_stream, 0, sizeof(m_zip_stream));
+    if (size >= 2 && head[0] == 0x1f && head[1] == 0x8b)
+    {
+        //  The extra 16 asks zlib for the gzip header and trailer
+        m_format = eTAR_GZIP;
+        if (inflateInit2(&m_zip_stream, 16 + MAX_WBITS) != Z_OK)
+        {
+            return fail("Could not start decompressing " + m_path);
+        }
+
+        m_inflating = true;
+        m_input.resize(input_size);
+    }
+
+    return true;
+}
+
+
+bool ArchiveReader::next(Member& member)
+{
+    member = Member();
+    if (!m_error.empty())
+    {
+        return false;
+    }
+
+    return m_format == eZIP ? next_zip(member) : next_tar(member);
+}
+
+
+long ArchiveReader::read(char* buffer, size_t size)
+{
+    if (!m_error.empty())
+    {
+        return -1;
+    }
+
+    if (m_format == eZIP)
+    {
+        return read_zip(buffer, size);
+    }
+
+    size = size_t(std::min<uint64_t>(size, m_remaining));
+    long count = read_stream(buffer, size);
+    if (count >= 0 && size_t(count) < size)
+    {
+        fail(m_path + ": The archive ends in the middle of a member");
+        return -1;
+    }
+
+    m_remaining -= uint64_t(count > 0 ? count : 0);
+    return count;
+}
+
+
+bool ArchiveReader::read_all(std::vector<char>& buffer)
+{
+    buffer.clear();
+    size_t size = 0;
+    for (;;)
+    {
+        //  The size is usually known exactly, but just in case it isn't
+        if (buffer.size() - size < 64 * 1024)
+        {
+            buffer.resize(std::max<size_t>(size + 64 * 1024, 2 * buffer.size()));
+        }
+
+        long count = read(buffer.data() + size, buffer.size() - size);
+        if (count < 0)
+        {
+            return false;
+        }
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        size += size_t(count);
+    }
+
+    buffer.resize(size);
+    return true;
+}
+
+
+bool ArchiveReader::fail(const std::string& what)
+{
+    if (m_error.empty())
+    {
+        m_error = what;
+    }
+
+    return false;
+}
+
+
+long ArchiveReader::read_stream(char* buffer, size_t size)
+{
+    if (!m_inflating)
+    {
+        ssize_t count = read_fully(m_fd, buffer, size);
+        if (count < 0)
+        {
+            fail("Could not read " + m_path + ": " + std::strerror(errno));
+        }
+
+        return long(count);
+    }
+
+    m_zip_stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    m_zip_stream.avail_out = uInt(size);
+    while (m_zip_stream.avail_out > 0 && !m_stream_end)
+    {
+        if (m_zip_stream.avail_in == 0)
+        {
+            ssize_t count = read_fully(m_fd, m_input.data(), m_input.size());
+            if (count < 0)
+            {
+                fail("Could not read " + m_path + ": " + std::strerror(errno));
+                return -1;
+            }
+
+            if (count == 0)
+            {
+                fail(m_path + ": The compressed data ends too soon");
+                return -1;
+            }
+
+            m_zip_stream.next_in = m_input.data();
+            m_zip_stream.avail_in = uInt(count);
+        }
+
+        int result = inflate(&m_zip_stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END)
+        {
+            //  Another gzip member may follow, like "cat a.gz b.gz" makes
+            if (m_zip_stream.avail_in == 0)
+            {
+                ssize_t count = read_fully(m_fd, m_input.data(), m_input.size());
+                m_zip_stream.next_in = m_input.data();
+                m_zip_stream.avail_in = uInt(count > 0 ? count : 0);
+            }
+
+            if (m_zip_stream.avail_in == 0)
+            {
+                m_stream_end = true;
+            }
+            else
+            {
+                inflateReset(&m_zip_stream);
+            }
+        }
+        else if (result != Z_OK && result != Z_BUF_ERROR)
+        {
+            fail(m_path + ": Could not decompress: " +
+                 (m_zip_stream.msg ? m_zip_stream.msg : "corrupted data"));
+            return -1;
+        }
+    }
+
+    return long(size - m_zip_stream.avail_out);
+}
+
+
+bool ArchiveReader::skip_stream(uint64_t size)
+{
+    if (!m_inflating)
+    {
+        struct stat info;
+        if (::fstat(m_fd, &info) == 0 && S_ISREG(info.st_mode))
+        {
+            if (::lseek(m_fd, off_t(size), SEEK_CUR) < 0)
+            {
+                return fail("Could not read " + m_path + ": " + std::strerror(errno));
+            }
+
+            return true;
+        }
+    }
+
+    char scratch[16 * 1024];
+    while (size > 0)
+    {
+        size_t piece = size_t(std::min<uint64_t>(size, sizeof(scratch)));
+        long count = read_stream(scratch, piece);
+        if (count < 0)
+        {
+            return false;
+        }
+
+        if (size_t(count) < piece)
+        {
+            return fail(m_path + ": The archive ends in the middle of a member");
+        }
+
+        size -= piece;
+    }
+
+    return true;
+}
+
+
+bool ArchiveReader::next_tar(Member& member)
+{
+    if (!skip_stream(m_remaining + m_padding))
+    {
+        return false;
+    }
+
+    m_remaining = 0;
+    m_padding = 0;
+
+    //  The names and sizes from the headers that come before the member
+    std::string long_name;
+    std::string pax_path;
+    uint64_t pax_size = 0;
+    bool has_pax_size = false;
+    char block[tar_block];
+    for (;;)
+    {
+        long count = read_stream(block, tar_block);
+        if (count < 0)
+        {
+            return false;
+        }
+
+        //  Two zero blocks mark the end, but the end of the data will do
+        if (count == 0 || is_zero_block(block))
+        {
+            return false;
+        }
+
+        if (size_t(count) < tar_block || !tar_checksum_ok(block))
+        {
+            return fail(m_path + ": Not a tar archive, or a corrupted one");
+        }
+
+        uint64_t size;
+        if (!tar_number(block + 124, 12, size))
+        {
+            return fail(m_path + ": Not a tar archive, or a corrupted one");
+        }
+
+        uint64_t padding = (tar_block - size % tar_block) % tar_block;
+        char type = block[156];
+        if (type == 'L' || type == 'x')
+        {
+            //  The GNU long name, or the pax records, are the contents
+            if (size > max_name_size)
+            {
+                return fail(m_path + ": Not a tar archive, or a corrupted one");
+            }
+
+            std::string text(size_t(size), '\0');
+            if (read_stream(&text[0], text.size()) != long(text.size()) || !skip_stream(padding))
+            {
+                return fail(m_path + ": The archive ends in the middle of a member");
+            }
+
+            if (type == 'L')
+            {
+                long_name = tar_string(text.data(), text.size());
+            }
+            else
+            {
+                parse_pax(text, pax_path, pax_size, has_pax_size);
+            }
+
+            continue;
+        }
+
+        if (type == 'g' || type == 'K')
+        {
+            //  Global pax records and long link names don't matter here
+            if (!skip_stream(size + padding))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        //  The ustar prefix is the directory part of a long name
+        std::string name = tar_string(block, 100);
+        if (std::memcmp(block + 257, "ustar", 5) == 0 && block[345] != '\0')
+        {
+            name = tar_string(block + 345, 155) + '/' + name;
+        }
+
+        if (!long_name.empty())
+        {
+            name = long_name;
+        }
+
+        if (!pax_path.empty())
+        {
+            name = pax_path;
+        }
+
+        if (has_pax_size)
+        {
+            size = pax_size;
+            padding = (tar_block - size % tar_block) % tar_block;
+        }
+
+        member.name = std::move(name);
+        member.regular = type == '0' || type == '\0' || type == '7';
+        member.size = member.regular ? size : 0;
+
+        //  Only the regular files have contents worth reading
+        m_remaining = member.regular ? size : 0;
+        m_padding = member.regular ? padding : size + padding;
+        return true;
+    }
+}
+
+
+bool ArchiveReader::open_zip()
+{
+    struct stat info;
+    if (::fstat(m_fd, &info) != 0)
+    {
+        return fail("Could not read " + m_path + ": " + std::strerror(errno));
+    }
+
+    //  The end record is at the end, before a comment of up to 64K
+    uint64_t file_size = uint64_t(info.st_size);
+    size_t tail_size = size_t(std::min<uint64_t>(file_size, 22 + 65535));
+    std::vector<unsigned char> tail(tail_size);
+    if (!read_at(file_size - tail_size, tail.data(), tail_size))
+    {
+        return false;
+    }
+
+    size_t end = tail_size;
+    for (size_t ix = tail_size >= 22 ? tail_size - 22 + 1 : 0; ix-- > 0;)
+    {
+        if (get32(&tail[ix]) == zip_end)
+        {
+            end = ix;
+            break;
+        }
+    }
+
+    if (end == tail_size)
+    {
+        return fail(m_path + ": Not a zip archive, or a corrupted one");
+    }
+
+    uint64_t entries = get16(&tail[end + 10]);
+    uint64_t directory_size = get32(&tail[end + 12]);
+    uint64_t directory_offset = get32(&tail[end + 16]);
+
+    //  The big ones have the real numbers in the zip64 end record
+    uint64_t end_offset = file_size - tail_size + end;
+    if ((entries == 0xffff || directory_size == 0xffffffff || directory_offset == 0xffffffff) &&
+        end_offset >= 20)
+    {
+        unsigned char locator[20];
+        unsigned char record[56];
+        if (read_at(end_offset - 20, locator, sizeof(locator)) &&
+            get32(locator) == zip64_locator &&
+            read_at(get64(locator + 8), record, sizeof(record)) && get32(record) == zip64_end)
+        {
+            entries = get64(record + 32);
+            directory_size = get64(record + 40);
+            directory_offset = get64(record + 48);
+        }
+    }
+
+    //  Checked without adding, the numbers may be anything
+    if (directory_offset > file_size || directory_size > file_size - directory_offset)
+    {
+        return fail(m_path + ": Not a zip archive, or a corrupted one");
+    }
+
+    m_directory.resize(size_t(directory_size));
+    if (!read_at(directory_offset, m_directory.data(), m_directory.size()))
+    {
+        return false;
+    }
+
+    m_entry = 0;
+    m_entries_left = entries;
+    std::memset(&m_zip_stream, 0, sizeof(m_zip_stream));
+    if (inflateInit2(&m_zip_stream, -MAX_WBITS) != Z_OK)
+    {
+        return fail("Could not start decompressing " + m_path);
+    }
+
+    m_inflating = true;
+    m_input.resize(input_size);
+    return true;
+}
+
+
+bool ArchiveReader::next_zip(Member& member)
+{
+    if (m_entries_left == 0)
+    {
+        return false;
+    }
+
+    --m_entries_left;
+    const unsigned char* entry = m_directory.data() + m_entry;
+    if (m_entry + 46 > m_directory.size() || get32(entry) != zip_central_header)
+    {
+        return fail(m_path + ": Not a zip archive, or a corrupted one");
+    }
+
+    size_t name_size = get16(entry + 28);
+    size_t extra_size = get16(entry + 30);
+    size_t comment_size = get16(entry + 32);
+    if (m_entry + 46 + name_size + extra_size + comment_size > m_directory.size())
+    {
+        return fail(m_path + ": Not a zip archive, or a corrupted one");
+    }
+
+    unsigned flags = get16(entry + 8);
+    m_method = get16(entry + 10);
+    m_compressed = get32(entry + 20);
+    uint64_t size = get32(entry + 24);
+    m_offset = get32(entry + 42);
+
+    //  The zip64 extra field has the numbers that didn't fit, in order
+    const unsigned char* extra = entry + 46 + name_size;
+    const unsigned char* extra_end = extra + extra_size;
+    while (extra + 4 <= extra_end)
+    {
+        unsigned id = get16(extra);
+        size_t field_size = get16(extra + 2);
+        const unsigned char* field = extra + 4;
+        const unsigned char* field_end = std::min(field + field_size, extra_end);
+        if (id == 0x0001)
+        {
+            for (uint64_t* value : {&size, &m_compressed, &m_offset})
+            {
+                if (*value == 0xffffffff && field + 8 <= field_end)
+                {
+                    *value = get64(field);
+                    field += 8;
+                }
+            }
+        }
+
+        extra += 4 + field_size;
+    }
+
+    member.name.assign(reinterpret_cast<const char*>(entry + 46), name_size);
+    m_entry += 46 + name_size + extra_size + comment_size;
+
+    //  Symbolic links made on Unix have contents too, the link target
+    unsigned made_on = get16(entry + 4) >> 8;
+    unsigned mode = get32(entry + 38) >> 16;
+    bool is_link = made_on == 3 && (mode & S_IFMT) == S_IFLNK;
+    member.regular = !member.name.empty() && member.name.back() != '/' && !is_link;
+    member.size = member.regular ? size : 0;
+    m_remaining = member.size;
+    m_started = false;
+
+    if (member.regular && (flags & 1))
+    {
+        member.problem = "Can't read the encrypted " + m_path + '/' + member.name;
+    }
+    else if (member.regular && m_method != 0 && m_method != 8)
+    {
+        member.problem = "Can't decompress " + m_path + '/' + member.name +
+                         ", compression method " + std::to_string(m_method);
+    }
+
+    return true;
+}
+
+
+bool ArchiveReader::start_zip_member()
+{
+    //  The data is after the local header, which has a name and an
+    //  extra field of its own
+    unsigned char header[30];
+    if (!read_at(m_offset, header, sizeof(header)))
+    {
+        return false;
+    }
+
+    if (get32(header) != zip_local_header)
+    {
+        return fail(m_path + ": Not a zip archive, or a corrupted one");
+    }
+
+    m_offset += sizeof(header) + get16(header + 26) + get16(header + 28);
+    m_started = true;
+    m_stream_end = false;
+    m_zip_stream.avail_in = 0;
+    inflateReset(&m_zip_stream);
+    return true;
+}
+
+
+long ArchiveReader::read_zip(char* buffer, size_t size)
+{
+    if (m_remaining == 0 || size == 0)
+    {
+        return 0;
+    }
+
+    if (!m_started && !start_zip_member())
+    {
+        return -1;
+    }
+
+    size = size_t(std::min<uint64_t>(size, m_remaining));
+    if (m_method == 0)
+    {
+        if (!read_at(m_offset, buffer, size))
+        {
+            return -1;
+        }
+
+        m_offset += size;
+        m_remaining -= size;
+        return long(size);
+    }
+
+    m_zip_stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    m_zip_stream.avail_out = uInt(size);
+    while (m_zip_stream.avail_out > 0 && !m_stream_end)
+    {
+        if (m_zip_stream.avail_in == 0)
+        {
+            size_t piece = size_t(std::min<uint64_t>(m_input.size(), m_compressed));
+            if (piece == 0 || !read_at(m_offset, m_input.data(), piece))
+            {
+                fail(m_path + ": The compressed data ends too soon");
+                return -1;
+            }
+
+            m_offset += piece;
+            m_compressed -= piece;
+            m_zip_stream.next_in = m_input.data();
+            m_zip_stream.avail_in = uInt(piece);
+        }
+
+        int result = inflate(&m_zip_stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END)
+        {
+            m_stream_end = true;
+        }
+        else if (result != Z_OK && result != Z_BUF_ERROR)
+        {
+            fail(m_path + ": Could not decompress: " +
+                 (m_zip_stream.msg ? m_zip_stream.msg : "corrupted data"));
+            return -1;
+        }
+    }
+
+    size_t count = size - m_zip_stream.avail_out;
+    if (count < size)
+    {
+        fail(m_path + ": A member is shorter than the archive says");
+        return -1;
+    }
+
+    m_remaining -= count;
+    return long(count);
+}
+
+
+bool ArchiveReader::read_at(uint64_t offset, void* buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t count = ::pread(m_fd, static_cast<char*>(buffer) + done, size - done,
+                                off_t(offset + done));
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return fail("Could not read " + m_path + ": " + std::strerror(errno));
+        }
+
+        if (count == 0)
+        {
+            return fail(m_path + ": Not a zip archive, or a corrupted one");
+        }
+
+        done += size_t(count);
+    }
+
+    return true;
+}
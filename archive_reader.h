@@ -0,0 +1,125 @@
+/*
+    Reading the members of archives for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+//  Goes through the members of a tar, gzipped tar, or zip archive, one
+//  at a time, without extracting anything to the disk.
+//
+//  A tar archive is read straight through, decompressed on the way if
+//  it's gzipped, so it may as well come from a pipe. A zip archive is
+//  read from its central directory, which has the names and the sizes,
+//  and each member is then read from where it is. The contents are
+//  decompressed straight into the buffer given by the caller.
+//
+class ArchiveReader
+{
+public:
+    enum Format {
+        eTAR,
+        eTAR_GZIP,
+        eZIP,
+    };
+
+    //  What the archive says about a member
+    struct Member
+    {
+        std::string name;       // As in the archive, like "dir/file.c"
+        uint64_t size = 0;      // Of the contents, once decompressed
+        bool regular = false;   // Not a directory, link, or such
+        std::string problem;    // Why it can't be read, if it can't
+    };
+
+    ArchiveReader() = default;
+    ~ArchiveReader();
+
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    //  True if the beginning of the file looks like one of the archives
+    static bool is_archive(const char* path);
+
+    //  Opens the archive and finds out the format from the contents
+    bool open(const char* path);
+
+    Format format() const { return m_format; }
+
+    //  Move on to the next member, skipping what's left of the last one.
+    //  Returns false at the end of the archive, or on an error.
+    bool next(Member& member);
+
+    //  Read the next piece of the contents of the member, up to the
+    //  size. Returns the size read, zero at the end of the member, or
+    //  -1 on an error.
+    long read(char* buffer, size_t size);
+
+    //  All of the contents of the member, replacing what's in the buffer
+    bool read_all(std::vector<char>& buffer);
+
+    //  What went wrong, empty if nothing did
+    const std::string& error() const { return m_error; }
+
+private:
+    bool fail(const std::string& what);
+
+    //  Tar archives are read as a stream of bytes, gzipped or not.
+    //  Returns the size read, short only at the end, or -1 on an error.
+    long read_stream(char* buffer, size_t size);
+    bool skip_stream(uint64_t size);
+    bool next_tar(Member& member);
+
+    //  Zip archives are read a member at a time, from the offsets
+    bool open_zip();
+    bool next_zip(Member& member);
+    bool start_zip_member();
+    long read_zip(char* buffer, size_t size);
+    bool read_at(uint64_t offset, void* buffer, size_t size);
+
+    std::string m_path;
+    Format m_format = eTAR;
+    int m_fd = -1;
+    std::string m_error;
+
+    //  The decompression, for gzip and for deflated zip members
+    z_stream m_zip_stream;
+    bool m_inflating = false;
+    bool m_stream_end = false;
+    std::vector<unsigned char> m_input;
+
+    //  What's left of the current member, and the padding after it
+    uint64_t m_remaining = 0;
+    uint64_t m_padding = 0;
+
+    //  The central directory of a zip, and the next entry in it
+    std::vector<unsigned char> m_directory;
+    size_t m_entry = 0;
+    uint64_t m_entries_left = 0;
+
+    //  The current zip member
+    uint64_t m_offset = 0;       // Of the compressed data, once started
+    uint64_t m_compressed = 0;   // Compressed bytes not yet read
+    int m_method = 0;            // 0 stored, 8 deflated
+    bool m_started = false;      // Past the local header
+};
@@ -0,0 +1,483 @@
+//  Benchmarks for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//  Every result is printed on a line of its own, as space separated
+//  key=value pairs, so that the output is easy to collect and compare
+//  from one build to the next:
+//
+//      bench=classify kernel=avx2 input=clean bytes=16777216 gbps=5.512
+//      bench=tree files=2000 bytes=8388608 files_per_s=81234.5
+//
+
+#include "buffer_pool.h"
+#include "classifier.h"
+#include "file_scanner.h"
+#include "fixer.h"
+#include "hash.h"
+#include "options.h"
+#include "splitter.h"
+#include "utf16checker.h"
+#include "worker_pool.h"
+
+#include <getopt.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char program_info[] =
+    "\n"
+    "NAME: source_normalizer_bench\n"
+    "VERSION: 1.5\n"
+    "COPYRIGHT: Copyright (C) 2020 Martti Ylioja\n";
+
+const char usage_msg[] =
+    "Usage: bench [--size=MiB] [--files=n] [--seconds=s]\n"
+    "  --size=MiB   Size of each synthetic kernel input (default is 16)\n"
+    "  --files=n    Number of files in the generated tree (default is 2000)\n"
+    "  --seconds=s  Minimum time spent on each measurement (default is 0.5)\n";
+
+struct Settings
+{
+    size_t size = 16;
+    int files = 2000;
+    double seconds = 0.5;
+};
+
+using Clock = std::chrono::steady_clock;
+
+//  Run the function over and over for at least the given time,
+//  and return the fastest single run in seconds.
+double best_time(double seconds, const std::function<void()>& function)
+{
+    double best = 1e30;
+    double total = 0;
+    int rounds = 0;
+    while (total < seconds || rounds < 3)
+    {
+        auto start = Clock::now();
+        function();
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        best = std::min(best, elapsed);
+        total += elapsed;
+        ++rounds;
+    }
+
+    return best;
+}
+
+//  Keeps the compiler from optimizing away the results
+volatile uint64_t sink;
+
+
+//  Synthetic inputs, always the same for the same size
+//
+std::string random_line(std::mt19937& rng)
+{
+    static const char letters[] =
+        "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ 0123456789 (){}[];,.=+-*/<>";
+    std::string line(rng() % 100, ' ');
+    for (auto& ch : line)
+    {
+        ch = letters[rng() % (sizeof(letters) - 1)];
+    }
+
+    //  No trailing spaces unless asked for
+    while (!line.empty() && line.back() == ' ')
+    {
+        line.pop_back();
+    }
+
+    return line;
+}
+
+enum class Kind { clean, crlf, tabs, trailing, utf16le, utf16be, binary };
+
+struct Input
+{
+    const char* name;
+    Kind kind;
+};
+
+const Input inputs[] = {
+    {"clean", Kind::clean},
+    {"crlf", Kind::crlf},
+    {"tabs", Kind::tabs},
+    {"trailing", Kind::trailing},
+    {"utf16le", Kind::utf16le},
+    {"utf16be", Kind::utf16be},
+    {"binary", Kind::binary},
+};
+
+std::string make_input(Kind kind, size_t size)
+{
+    std::mt19937 rng(12345);
+    std::string text;
+    text.reserve(size + 256);
+
+    if (kind == Kind::binary)
+    {
+        while (text.size() < size)
+        {
+            text += char(rng());
+        }
+
+        return text;
+    }
+
+    while (text.size() < size)
+    {
+        std::string line;
+        switch (kind)
+        {
+        case Kind::tabs:
+            line.assign(1 + rng() % 3, '\t');
+            line += random_line(rng);
+            line += "\t// note";
+            break;
+
+        case Kind::trailing:
+            line = random_line(rng);
+            line.append(1 + rng() % 4, ' ');
+            break;
+
+        default:
+            line = random_line(rng);
+            break;
+        }
+
+        line += (kind == Kind::crlf) ? "\r\n" : "\n";
+        if (kind == Kind::utf16le || kind == Kind::utf16be)
+        {
+            for (char ch : line)
+            {
+                if (kind == Kind::utf16le)
+                {
+                    text += ch;
+                    text += '\0';
+                }
+                else
+                {
+                    text += '\0';
+                    text += ch;
+                }
+            }
+        }
+        else
+        {
+            text += line;
+        }
+    }
+
+    //  End with the last complete line
+    size_t end = text.rfind('\n', size - 1);
+    if (end != std::string::npos)
+    {
+        text.resize(end + (kind == Kind::utf16le ? 2 : 1));
+    }
+
+    return text;
+}
+
+void report(const char* bench, const char* kernel, const char* input, size_t bytes, double seconds)
+{
+    std::printf("bench=%s kernel=%s input=%s bytes=%zu gbps=%.3f\n", bench, kernel, input, bytes,
+                bytes / seconds / 1e9);
+}
+
+
+void run_kernels(const Settings& settings)
+{
+    std::vector<char> output;
+    WorkerPool workers(int(std::max(2u, std::thread::hardware_concurrency())) - 1);
+    BufferPool buffers;
+    std::vector<Splitter::Piece> pieces;
+    for (auto& input : inputs)
+    {
+        size_t size = settings.size * 1024 * 1024;
+        std::string text = make_input(input.kind, size);
+        const char* data = text.data();
+        size = text.size();
+
+        for (auto& kernel : Classifier::kernels())
+        {
+            double time = best_time(settings.seconds, [&]() { sink = kernel.classify(data, size); });
+            report("classify", kernel.name, input.name, size, time);
+        }
+
+        //  The check mode, which stops at the first error. Only the clean
+        //  input is read to the end, so it's the only one measured, as the
+        //  others would seem to go at the speed of their first error.
+        if (input.kind == Kind::clean)
+        {
+            for (auto& kernel : Classifier::kernels())
+            {
+                double time = best_time(settings.seconds, [&]() {
+                    Classifier::State state;
+                    sink = kernel.feed_until_error[0](state, data, size);
+                });
+                report("first_error", kernel.name, input.name, size, time);
+            }
+        }
+
+        for (auto& kernel : Classifier::kernels())
+        {
+            double time = best_time(settings.seconds, [&]() {
+                const char* end = data + size;
+                uint64_t count = 0;
+                for (const char* ptr = data; ptr != end; ++count)
+                {
+                    ptr = kernel.find_special(ptr, end);
+                    if (ptr != end)
+                        ++ptr;
+                }
+                sink = count;
+            });
+            report("find_special", kernel.name, input.name, size, time);
+        }
+
+        double time = best_time(settings.seconds,
+                                [&]() { sink = Fixer::fix(data, size, 4, output); });
+        report("fix", "best", input.name, size, time);
+
+        //  The same text cut into pieces for all the hardware threads
+        time = best_time(settings.seconds, [&]() {
+            sink = Classifier::errors(Splitter::classify(data, size, 0, workers));
+        });
+        report("classify", "split", input.name, size, time);
+
+        time = best_time(settings.seconds, [&]() {
+            Splitter::fix(data, size, 4, 0, workers, buffers, pieces);
+            for (auto& piece : pieces)
+            {
+                sink = piece.size;
+                buffers.give(piece.buffer);
+            }
+        });
+        report("fix", "split", input.name, size, time);
+
+        //  Anything else is rejected right at the start
+        if (input.kind == Kind::utf16le || input.kind == Kind::utf16be)
+        {
+            for (auto& kernel : Utf16Checker::kernels())
+            {
+                time = best_time(settings.seconds, [&]() {
+                    Utf16Checker checker;
+                    checker.set_kernel(kernel);
+                    sink = checker.check(data, int(size));
+                });
+                report("utf16", kernel.name, input.name, size, time);
+            }
+        }
+
+        time = best_time(settings.seconds, [&]() { sink = Hash::content(data, size); });
+        report("hash", "scalar", input.name, size, time);
+    }
+}
+
+
+//  Fixing in pieces must give the same text as fixing all of it at once,
+//  under every rule set, wherever the pieces end. The text has runs of
+//  spaces, tabs, and carriage returns at the ends of its lines, and the
+//  pieces are of random sizes, some of them empty.
+bool check_seams(const Settings& settings)
+{
+    std::mt19937 rng(777);
+    static const char blanks[] = "  \t\t\r\v";
+    std::string text;
+    size_t size = settings.size * 1024 * 1024;
+    while (text.size() < size)
+    {
+        text += random_line(rng);
+        text.append(rng() % 5, blanks[rng() % (sizeof(blanks) - 1)]);
+        text += (rng() % 2) ? "\r\n" : "\n";
+    }
+
+    text += "a \t";  // Without a line feed at the end
+    const char* data = text.data();
+    size = text.size();
+
+    bool ok = true;
+    WorkerPool workers(int(std::max(2u, std::thread::hardware_concurrency())) - 1);
+    BufferPool buffers;
+    std::vector<Splitter::Piece> pieces;
+    std::vector<char> whole;
+    std::vector<char> output;
+    std::string joined;
+    const unsigned rule_sets[] = {0, allow_tabs, allow_cr_lf, allow_tabs | allow_cr_lf};
+    for (unsigned allowed : rule_sets)
+    {
+        size_t whole_size = Fixer::fix(data, size, 4, whole, allowed);
+
+        Fixer::Stream stream(4, allowed);
+        joined.clear();
+        for (size_t pos = 0; pos < size;)
+        {
+            size_t piece = std::min(size_t(rng() % 4 == 0 ? rng() % 4 : rng() % 8192), size - pos);
+            size_t fixed = stream.feed(data + pos, piece, output);
+            joined.append(output.data(), fixed);
+            pos += piece;
+        }
+
+        size_t fixed = stream.finish(output);
+        joined.append(output.data(), fixed);
+        bool stream_same = joined.size() == whole_size &&
+                           std::equal(joined.begin(), joined.end(), whole.begin());
+
+        Splitter::fix(data, size, 4, allowed, workers, buffers, pieces);
+        joined.clear();
+        for (auto& piece : pieces)
+        {
+            joined.append(piece.buffer.data(), piece.size);
+            buffers.give(piece.buffer);
+        }
+
+        bool split_same = joined.size() == whole_size &&
+                          std::equal(joined.begin(), joined.end(), whole.begin());
+
+        std::printf("bench=seams allowed=%u bytes=%zu stream_same=%d split_same=%d\n", allowed,
+                    size, int(stream_same), int(split_same));
+        ok = ok && stream_same && split_same;
+    }
+
+    return ok;
+}
+
+
+//  A tree of small files, mostly clean, with some of them
+//  having the usual problems.
+size_t make_tree(const fs::path& root, int files)
+{
+    std::mt19937 rng(54321);
+    const Kind kinds[] = {Kind::clean, Kind::clean, Kind::clean, Kind::crlf, Kind::tabs,
+                          Kind::trailing};
+    const char* extensions[] = {".c", ".cpp", ".h", ".hpp"};
+
+    size_t bytes = 0;
+    for (int ix = 0; ix < files; ++ix)
+    {
+        fs::path dir = root / ("d" + std::to_string(ix / 100));
+        if (ix % 100 == 0)
+        {
+            fs::create_directories(dir);
+        }
+
+        size_t size = 512 + rng() % 8192;
+        std::string text = make_input(kinds[rng() % 6], size);
+        fs::path name = dir / ("f" + std::to_string(ix) + extensions[ix % 4]);
+        std::ofstream(name, std::ios::binary).write(text.data(), text.size());
+        bytes += text.size();
+    }
+
+    return bytes;
+}
+
+
+void run_tree(const Settings& settings)
+{
+    std::string pattern = (fs::temp_directory_path() / "source_normalizer_bench.XXXXXX").string();
+    if (!::mkdtemp(&pattern[0]))
+    {
+        std::perror("Could not create a temporary directory");
+        return;
+    }
+
+    fs::path root = pattern;
+    size_t bytes = make_tree(root, settings.files);
+
+    //  The reports are part of the work, but not worth seeing
+    std::ofstream null("/dev/null");
+    auto saved = std::cerr.rdbuf(null.rdbuf());
+
+    double time = best_time(settings.seconds, [&]() { FileScanner::process(root.c_str()); });
+
+    std::cerr.rdbuf(saved);
+    fs::remove_all(root);
+
+    std::printf("bench=tree jobs=%d files=%d bytes=%zu files_per_s=%.1f gbps=%.3f\n",
+                Options::get()->jobs(), settings.files, bytes, settings.files / time,
+                bytes / time / 1e9);
+}
+
+}  // namespace
+
+
+int main(int argc, char** argv)
+{
+    enum { opt_size = 256, opt_files, opt_seconds };
+    static const struct option long_options[] = {
+        {"size", required_argument, 0, opt_size},
+        {"files", required_argument, 0, opt_files},
+        {"seconds", required_argument, 0, opt_seconds},
+        {0, 0, 0, 0},
+    };
+
+    Settings settings;
+    for (;;)
+    {
+        int ch = getopt_long(argc, argv, "", long_options, nullptr);
+        if (ch == -1)
+            break;
+
+        switch (ch)
+        {
+        case opt_size:
+            settings.size = std::max(1, std::atoi(optarg));
+            break;
+
+        case opt_files:
+            settings.files = std::max(1, std::atoi(optarg));
+            break;
+
+        case opt_seconds:
+            settings.seconds = std::atof(optarg);
+            break;
+
+        default:
+            std::cerr << usage_msg;
+            return 1;
+        }
+    }
+
+    //  The tree is scanned with the normal recursive settings
+    char arg0[] = "bench";
+    char arg1[] = "-r";
+    char* args[] = {arg0, arg1, nullptr};
+    optind = 1;
+    Options options;
+    if (options.parse(2, args, program_info) != Options::eOK)
+    {
+        return 1;
+    }
+
+    bool same = check_seams(settings);
+    run_kernels(settings);
+    run_tree(settings);
+    return same ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+/*
+    Bounded lock-free queue for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+//  A fixed size multi-producer multi-consumer queue.
+//
+//  This is the well known ring buffer design by Dmitry Vyukov, where
+//  each slot carries a sequence number telling whether it's ready to
+//  be written or read. Producers and consumers only compete for one
+//  atomic index each, and never take a lock.
+//
+//  The blocking push and pop back off by yielding and then sleeping
+//  briefly, which is plenty for queues that carry file names.
+//
+template <typename T>
+class BoundedQueue
+{
+public:
+    //  Capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+
+        m_mask = size - 1;
+        m_slots = std::make_unique<Slot[]>(size);
+        for (size_t ix = 0; ix < size; ++ix)
+        {
+            m_slots[ix].sequence.store(ix, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    //  Returns false if the queue is full
+    bool try_push(T& value)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot& slot = m_slots[pos & m_mask];
+            size_t seq = slot.sequence.load(std::memory_order_acquire);
+            auto diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    slot.value = std::move(value);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //  Returns false if the queue is empty
+    bool try_pop(T& value)
+    {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot& slot = m_slots[pos & m_mask];
+            size_t seq = slot.sequence.load(std::memory_order_acquire);
+            auto diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+            if (diff == 0)
+            {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(slot.value);
+                    slot.sequence.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //  Wait for room if the queue is full
+    void push(T value)
+    {
+        for (int round = 0; !try_push(value); ++round)
+        {
+            back_off(round);
+        }
+    }
+
+    //  Wait for a value. Returns false once the queue
+    //  is closed and everything has been taken out.
+    bool pop(T& value)
+    {
+        for (int round = 0;; ++round)
+        {
+            //  Check the flag first, so that nothing pushed
+            //  before the close can be missed.
+            bool closed = m_closed.load(std::memory_order_acquire);
+            if (try_pop(value))
+            {
+                return true;
+            }
+
+            if (closed)
+            {
+                return false;
+            }
+
+            back_off(round);
+        }
+    }
+
+    //  No more values will be pushed
+    void close() { m_closed.store(true, std::memory_order_release); }
+
+    //  Once closed, an empty queue stays empty. Check this before
+    //  try_pop, for the same reason as in pop.
+    bool is_closed() const { return m_closed.load(std::memory_order_acquire); }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static void back_off(int round)
+    {
+        if (round < 16)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    //  Keep the indexes in separate cache lines,
+    //  producers and consumers shouldn't disturb each other.
+    alignas(64) std::atomic<size_t> m_tail{0};
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<bool> m_closed{false};
+
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_mask;
+};
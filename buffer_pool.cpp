@@ -0,0 +1,71 @@
+//  Reusable buffers for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "buffer_pool.h"
+
+#include <utility>
+
+
+std::vector<char> BufferPool::take(size_t size)
+{
+    if (size > max_pooled)
+    {
+        return std::vector<char>(size);
+    }
+
+    //  The smallest class where every buffer is big enough
+    int ix = 0;
+    while ((min_pooled << ix) < size)
+    {
+        ++ix;
+    }
+
+    //  Or one class up, rather than allocating
+    for (int i = ix; i < class_count && i <= ix + 1; ++i)
+    {
+        if (m_counts[i] > 0)
+        {
+            return std::move(m_free[i][--m_counts[i]]);
+        }
+    }
+
+    return std::vector<char>(min_pooled << ix);
+}
+
+
+void BufferPool::give(std::vector<char>& buffer)
+{
+    size_t size = buffer.size();
+    if (size >= min_pooled && size <= max_pooled)
+    {
+        //  The biggest class it can serve
+        int ix = 0;
+        while ((min_pooled << (ix + 1)) <= size)
+        {
+            ++ix;
+        }
+
+        if (m_counts[ix] < kept_per_class)
+        {
+            m_free[ix][m_counts[ix]++] = std::move(buffer);
+            buffer.clear();
+            return;
+        }
+    }
+
+    std::vector<char>().swap(buffer);
+}
@@ -0,0 +1,58 @@
+/*
+    Reusable buffers for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+//  Each worker keeps the buffers for loading and fixing files here, so
+//  that once it's warmed up, going from one file to the next doesn't
+//  allocate anything, and the workers never meet in malloc.
+//
+//  The buffers come in power of two size classes, and a buffer for
+//  loading one file may well be the output buffer for the next one.
+//  The size of a buffer is all of its usable room, like the loader and
+//  the fixer expect, so taking one never clears anything.
+//
+//  Buffers bigger than max_pooled are not kept. Those come straight
+//  from mmap (see main.cpp), so a worker that came across one big file
+//  gives the memory back to the system as soon as it's done with it.
+//
+//  Not thread safe. Each worker has a pool of its own.
+//
+class BufferPool
+{
+public:
+    static constexpr size_t min_pooled = 4 * 1024;
+    static constexpr size_t max_pooled = 8 * 1024 * 1024;
+
+    //  A buffer with a size of at least the size given
+    std::vector<char> take(size_t size);
+
+    //  Keep the buffer for later, or free it. Leaves it empty.
+    void give(std::vector<char>& buffer);
+
+private:
+    static constexpr int class_count = 12;
+    static constexpr int kept_per_class = 2;
+    static_assert((min_pooled << (class_count - 1)) == max_pooled, "Classes up to max_pooled");
+
+    std::vector<char> m_free[class_count][kept_per_class];
+    int m_counts[class_count] = {};
+};
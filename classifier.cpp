@@ -0,0 +1,874 @@
+//  Whitespace and character classification for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "classifier.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNEL 1
+#endif
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+namespace {
+
+//  An arbitrary character that isn't regarded as whitespace
+constexpr int not_a_space = 0;
+
+//  The original byte at a time version.
+//  Every other kernel must give exactly the same results.
+//
+unsigned classify_scalar(const char* data, size_t size)
+{
+    unsigned errors = 0;
+    int unusual_whitespace = 0;
+
+    int current = not_a_space;
+    int penultimate = not_a_space;
+    int antepenultimate = not_a_space;
+    int last_character = not_a_space;
+
+    //  The last character should be a line feed.
+    if (size > 0 && data[size - 1] != '\n')
+    {
+        errors |= err_no_lf_at_end;
+    }
+
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data);
+    while (size--)
+    {
+        current = *ptr++;
+
+        //  Examine the character more closely if it's outside printable range
+        if (current < ' ' || current > '~')
+        {
+            switch (current)
+            {
+            case '\n':  //  Line feed (newline)
+                last_character = penultimate;
+                if (penultimate == '\r')
+                {
+                    //  Found a CR-LF pair "\r\n"
+                    errors |= err_cr_lf_line_endings;
+
+                    //  Adjust the last character on the line
+                    last_character = antepenultimate;
+
+                    //  The carriage return has already been counted as
+                    //  unusual whitespace, so have to adjust the count.
+                    //  Only free standing carriage returns are counted as
+                    //  whitespace.
+                    --unusual_whitespace;
+
+                    //  Make sure the carriage return won't be counted as a
+                    //  trailing space
+                    penultimate = not_a_space;
+                }
+                if (isspace(last_character))
+                {
+                    errors |= err_trailing_whitespace;
+                }
+                //  Make sure this line feed won't be counted as a trailing
+                //  space
+                current = not_a_space;
+                break;
+
+            case '\t':  //  horizontal tab
+                errors |= err_tabs;
+                break;
+
+            case '\r':  //  carriage return
+            case '\v':  //  vertical tab
+            case '\f':  //  form feed
+                ++unusual_whitespace;
+                break;
+
+            default:
+                errors |= err_invalid_characters;
+                break;
+            }
+        }
+
+        antepenultimate = penultimate;
+        penultimate = current;
+    }
+
+    if (unusual_whitespace)
+    {
+        errors |= err_unusual_whitespace;
+    }
+
+    return errors;
+}
+
+
+//  The block kernels only look for the bytes outside the printable
+//  range. Those are rare, and get the same treatment as in the scalar
+//  version, except that instead of carrying the previous characters
+//  along, they are simply looked up from the data. Only the first two
+//  bytes of a piece need the characters carried over in the state.
+//
+using Classifier::State;
+
+ALWAYS_INLINE bool is_special(unsigned char ch)
+{
+    return ch < ' ' || ch > '~';
+}
+
+//  As seen by the scalar state machine, where a line feed
+//  has already been replaced by a harmless character.
+ALWAYS_INLINE int previous_character(const unsigned char* data, size_t pos, size_t back,
+                                     const State& state)
+{
+    if (pos < back)
+    {
+        return (back - pos == 1) ? state.last : state.before_last;
+    }
+
+    int ch = data[pos - back];
+    return (ch == '\n') ? not_a_space : ch;
+}
+
+//  Same as isspace in the "C" locale, but never true for a line feed
+ALWAYS_INLINE bool is_trailing_space(int ch)
+{
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+//  Each kernel function comes in a version for every set of rules, so
+//  that a rule that's not in use costs nothing. The set is chosen once
+//  for a file, by the index from rule_set.
+enum {
+    rules_tabs = 1,   // Tabs are fine
+    rules_cr_lf = 2,  // So are CR-LF line endings
+    rules_utf8 = 4,   // Valid UTF-8 sequences aren't invalid characters
+};
+
+unsigned rule_set(unsigned allowed)
+{
+    return ((allowed & allow_tabs) ? rules_tabs : 0) |
+           ((allowed & allow_cr_lf) ? rules_cr_lf : 0) | ((allowed & allow_utf8) ? rules_utf8 : 0);
+}
+
+template <unsigned Rules>
+ALWAYS_INLINE void examine(const unsigned char* data, size_t pos, State& state)
+{
+    switch (data[pos])
+    {
+    case '\n':
+    {
+        int last_character = previous_character(data, pos, 1, state);
+        if (last_character == '\r')
+        {
+            //  A CR-LF pair, where the carriage return isn't
+            //  unusual whitespace, nor trailing whitespace.
+            if (!(Rules & rules_cr_lf))
+            {
+                state.errors |= err_cr_lf_line_endings;
+            }
+
+            --state.unusual_whitespace;
+            last_character = previous_character(data, pos, 2, state);
+        }
+
+        if (is_trailing_space(last_character))
+        {
+            state.errors |= err_trailing_whitespace;
+        }
+        break;
+    }
+
+    case '\t':
+        if (!(Rules & rules_tabs))
+        {
+            state.errors |= err_tabs;
+        }
+        break;
+
+    case '\r':
+    case '\v':
+    case '\f':
+        ++state.unusual_whitespace;
+        break;
+
+    default:
+        state.errors |= err_invalid_characters;
+        ++state.invalid_count;
+        break;
+    }
+}
+
+ALWAYS_INLINE void invalid_utf8(State& state)
+{
+    state.errors |= err_invalid_characters;
+    ++state.invalid_count;
+    state.utf8_pending = 0;
+}
+
+//  Past the continuation bytes still expected from the position on,
+//  or at the first byte that isn't one. A sequence cut short that way
+//  counts as one invalid character.
+ALWAYS_INLINE size_t continue_utf8(const unsigned char* data, size_t pos, size_t size, State& state)
+{
+    for (; state.utf8_pending > 0 && pos < size; ++pos)
+    {
+        if (data[pos] < state.utf8_low || data[pos] > state.utf8_high)
+        {
+            invalid_utf8(state);
+            break;
+        }
+
+        --state.utf8_pending;
+        state.utf8_low = 0x80;
+        state.utf8_high = 0xbf;
+    }
+
+    return pos;
+}
+
+//  Past the UTF-8 sequence beginning with the byte at the position, or
+//  just past the byte if it can't begin one. The ranges of the second
+//  byte rule out overlong forms, surrogates, and code points above
+//  U+10FFFF. A sequence cut off at the end of the piece is finished in
+//  the next one.
+ALWAYS_INLINE size_t skip_utf8(const unsigned char* data, size_t pos, size_t size, State& state)
+{
+    unsigned char lead = data[pos];
+    state.utf8_low = 0x80;
+    state.utf8_high = 0xbf;
+    if (lead >= 0xc2 && lead <= 0xdf)
+    {
+        state.utf8_pending = 1;
+    }
+    else if (lead >= 0xe0 && lead <= 0xef)
+    {
+        state.utf8_pending = 2;
+        state.utf8_low = (lead == 0xe0) ? 0xa0 : 0x80;
+        state.utf8_high = (lead == 0xed) ? 0x9f : 0xbf;
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4)
+    {
+        state.utf8_pending = 3;
+        state.utf8_low = (lead == 0xf0) ? 0x90 : 0x80;
+        state.utf8_high = (lead == 0xf4) ? 0x8f : 0xbf;
+    }
+    else
+    {
+        invalid_utf8(state);
+        return pos + 1;
+    }
+
+    return continue_utf8(data, pos + 1, size, state);
+}
+
+//  The bits of the mask for the bytes before skip are dropped.
+//  Bit 0 is for the byte at pos.
+ALWAYS_INLINE uint64_t skip_mask(uint64_t mask, size_t pos, size_t skip)
+{
+    if (skip <= pos)
+    {
+        return mask;
+    }
+
+    return (skip - pos >= 64) ? 0 : mask & (~uint64_t(0) << (skip - pos));
+}
+
+//  Walk the data 64 bytes at a time and examine the special bytes
+//  flagged by the vector unit. Isa::special_mask returns one bit per
+//  byte, the lowest bit for the first byte. With UTF-8 allowed, the
+//  bytes from 0x80 up are taken a sequence at a time instead.
+//
+//  The instruction set specific parts can only be inlined into a
+//  function compiled for the same target, so each kernel below is
+//  flattened, which pulls all of this into it.
+//
+template <typename Isa, unsigned Rules>
+inline void feed_blocks(State& state, const char* text, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    //  A local copy stays in registers
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(text);
+    State tally = state;
+
+    //  Where the bytes of the last UTF-8 sequence end
+    size_t skip = 0;
+    if (Rules & rules_utf8)
+    {
+        skip = continue_utf8(data, 0, size, tally);
+    }
+
+    size_t pos = 0;
+    for (; pos + 64 <= size; pos += 64)
+    {
+        uint64_t mask = Isa::special_mask(data + pos);
+        if (Rules & rules_utf8)
+        {
+            mask = skip_mask(mask, pos, skip);
+        }
+
+        while (mask)
+        {
+            size_t at = pos + __builtin_ctzll(mask);
+            if ((Rules & rules_utf8) && data[at] >= 0x80)
+            {
+                skip = skip_utf8(data, at, size, tally);
+                mask = skip_mask(mask, pos, skip);
+                continue;
+            }
+
+            examine<Rules>(data, at, tally);
+            mask &= mask - 1;
+        }
+    }
+
+    for (pos = std::max(pos, skip); pos < size;)
+    {
+        if ((Rules & rules_utf8) && data[pos] >= 0x80)
+        {
+            pos = skip_utf8(data, pos, size, tally);
+            continue;
+        }
+
+        if (is_special(data[pos]))
+        {
+            examine<Rules>(data, pos, tally);
+        }
+
+        ++pos;
+    }
+
+    //  Carry the last characters over to the next piece
+    tally.last = previous_character(data, size, 1, state);
+    tally.before_last = previous_character(data, size, 2, state);
+    tally.empty = false;
+    tally.ends_with_lf = (data[size - 1] == '\n');
+    state = tally;
+}
+
+unsigned final_errors(const State& state)
+{
+    unsigned errors = state.errors;
+    if (!state.empty && !state.ends_with_lf)
+    {
+        errors |= err_no_lf_at_end;
+    }
+
+    if (state.unusual_whitespace || state.pending_cr)
+    {
+        errors |= err_unusual_whitespace;
+    }
+
+    //  Cut off by the end of the file
+    if (state.utf8_pending)
+    {
+        errors |= err_invalid_characters;
+    }
+
+    return errors;
+}
+
+template <typename Isa>
+inline unsigned classify_blocks(const char* data, size_t size)
+{
+    State state;
+    feed_blocks<Isa, 0>(state, data, size);
+    return final_errors(state);
+}
+
+
+//  For a yes or no answer, the first error is enough. Every special
+//  byte other than a line feed is an error in itself, unless the rules
+//  allow it. A carriage return is unusual whitespace, or a CR-LF if a
+//  line feed follows it. If CR-LF is allowed, one at the end of the
+//  piece has to wait for the next piece to decide.
+template <unsigned Rules>
+ALWAYS_INLINE unsigned first_error_at(const unsigned char* data, size_t pos, size_t size,
+                                      State& state)
+{
+    switch (data[pos])
+    {
+    case '\n':
+    {
+        int last_character = previous_character(data, pos, 1, state);
+        if ((Rules & rules_cr_lf) && last_character == '\r')
+        {
+            last_character = previous_character(data, pos, 2, state);
+        }
+
+        return is_trailing_space(last_character) ? err_trailing_whitespace : 0;
+    }
+
+    case '\t':
+        return (Rules & rules_tabs) ? 0 : err_tabs;
+
+    case '\r':
+        if (pos + 1 == size && (Rules & rules_cr_lf))
+        {
+            state.pending_cr = true;
+            return 0;
+        }
+
+        if (pos + 1 < size && data[pos + 1] == '\n')
+        {
+            return (Rules & rules_cr_lf) ? 0 : err_cr_lf_line_endings;
+        }
+
+        return err_unusual_whitespace;
+
+    case '\v':
+    case '\f':
+        return err_unusual_whitespace;
+
+    default:
+        return err_invalid_characters;
+    }
+}
+
+//  The same walk as feed_blocks, but it stops at the first error and
+//  returns its bit. The state is carried over only if there was none.
+template <typename Isa, unsigned Rules>
+inline unsigned feed_blocks_until_error(State& state, const char* text, size_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(text);
+    unsigned error = 0;
+    size_t skip = 0;
+    if (state.pending_cr)
+    {
+        //  Only a CR-LF if this piece begins with the line feed
+        state.pending_cr = false;
+        error = (data[0] == '\n') ? 0 : err_unusual_whitespace;
+    }
+    else if (Rules & rules_utf8)
+    {
+        skip = continue_utf8(data, 0, size, state);
+        error = state.errors & err_invalid_characters;
+    }
+
+    size_t pos = 0;
+    for (; !error && pos + 64 <= size; pos += 64)
+    {
+        uint64_t mask = Isa::special_mask(data + pos);
+        if (Rules & rules_utf8)
+        {
+            mask = skip_mask(mask, pos, skip);
+        }
+
+        while (mask)
+        {
+            size_t at = pos + __builtin_ctzll(mask);
+            if ((Rules & rules_utf8) && data[at] >= 0x80)
+            {
+                skip = skip_utf8(data, at, size, state);
+                error = state.errors & err_invalid_characters;
+                if (error)
+                {
+                    break;
+                }
+
+                mask = skip_mask(mask, pos, skip);
+                continue;
+            }
+
+            error = first_error_at<Rules>(data, at, size, state);
+            if (error)
+            {
+                break;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+
+    for (pos = std::max(pos, skip); !error && pos < size;)
+    {
+        if ((Rules & rules_utf8) && data[pos] >= 0x80)
+        {
+            pos = skip_utf8(data, pos, size, state);
+            error = state.errors & err_invalid_characters;
+            continue;
+        }
+
+        if (is_special(data[pos]))
+        {
+            error = first_error_at<Rules>(data, pos, size, state);
+        }
+
+        ++pos;
+    }
+
+    if (error)
+    {
+        state.errors |= error;
+        return error;
+    }
+
+    int last = previous_character(data, size, 1, state);
+    state.before_last = previous_character(data, size, 2, state);
+    state.last = last;
+    state.empty = false;
+    state.ends_with_lf = (data[size - 1] == '\n');
+    return 0;
+}
+
+//  Every rule set of a kernel function, in the order of rule_set.
+//  The kernels below are function templates over the rule set.
+#define ALL_RULE_SETS(function)                                                       \
+    {                                                                                 \
+        function<0>, function<1>, function<2>, function<3>, function<4>, function<5>, \
+            function<6>, function<7>                                                  \
+    }
+
+
+//  The block walk for CPUs without any of the vector kernels
+struct Scalar
+{
+    static inline uint64_t special_mask(const unsigned char* ptr)
+    {
+        uint64_t mask = 0;
+        for (int ix = 0; ix < 64; ++ix)
+        {
+            mask |= uint64_t(is_special(ptr[ix])) << ix;
+        }
+
+        return mask;
+    }
+};
+
+template <unsigned Rules>
+void feed_scalar(State& state, const char* data, size_t size)
+{
+    feed_blocks<Scalar, Rules>(state, data, size);
+}
+
+template <unsigned Rules>
+unsigned feed_until_error_scalar(State& state, const char* data, size_t size)
+{
+    return feed_blocks_until_error<Scalar, Rules>(state, data, size);
+}
+
+
+const char* find_special_scalar(const char* begin, const char* end)
+{
+    for (; begin != end; ++begin)
+    {
+        if (is_special(*begin))
+        {
+            break;
+        }
+    }
+
+    return begin;
+}
+
+template <typename Isa>
+inline const char* find_special_blocks(const char* begin, const char* end)
+{
+    for (; end - begin >= 64; begin += 64)
+    {
+        uint64_t mask = Isa::special_mask(reinterpret_cast<const unsigned char*>(begin));
+        if (mask)
+        {
+            return begin + __builtin_ctzll(mask);
+        }
+    }
+
+    return find_special_scalar(begin, end);
+}
+
+
+#if HAVE_X86_KERNELS
+
+//  Bytes below ' ' or above '~'. As signed bytes, everything from
+//  0x80 up is negative, so only the DEL needs a separate compare.
+//
+struct Sse2
+{
+    __attribute__((target("sse2"))) static inline uint64_t mask16(const unsigned char* ptr)
+    {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+        __m128i low = _mm_cmpgt_epi8(_mm_set1_epi8(' '), data);
+        __m128i del = _mm_cmpeq_epi8(data, _mm_set1_epi8(0x7f));
+        return uint16_t(_mm_movemask_epi8(_mm_or_si128(low, del)));
+    }
+
+    __attribute__((target("sse2"))) static inline uint64_t special_mask(const unsigned char* ptr)
+    {
+        return mask16(ptr) | (mask16(ptr + 16) << 16) | (mask16(ptr + 32) << 32) |
+               (mask16(ptr + 48) << 48);
+    }
+};
+
+struct Avx2
+{
+    __attribute__((target("avx2"))) static inline uint64_t mask32(const unsigned char* ptr)
+    {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+        __m256i low = _mm256_cmpgt_epi8(_mm256_set1_epi8(' '), data);
+        __m256i del = _mm256_cmpeq_epi8(data, _mm256_set1_epi8(0x7f));
+        return uint32_t(_mm256_movemask_epi8(_mm256_or_si256(low, del)));
+    }
+
+    __attribute__((target("avx2"))) static inline uint64_t special_mask(const unsigned char* ptr)
+    {
+        return mask32(ptr) | (mask32(ptr + 32) << 32);
+    }
+};
+
+__attribute__((target("sse2"), flatten)) unsigned classify_sse2(const char* data, size_t size)
+{
+    return classify_blocks<Sse2>(data, size);
+}
+
+__attribute__((target("avx2"), flatten)) unsigned classify_avx2(const char* data, size_t size)
+{
+    return classify_blocks<Avx2>(data, size);
+}
+
+template <unsigned Rules>
+__attribute__((target("sse2"), flatten)) void feed_sse2(State& state, const char* data, size_t size)
+{
+    feed_blocks<Sse2, Rules>(state, data, size);
+}
+
+template <unsigned Rules>
+__attribute__((target("sse2"), flatten)) unsigned feed_until_error_sse2(State& state,
+                                                                           const char* data,
+                                                                           size_t size)
+{
+    return feed_blocks_until_error<Sse2, Rules>(state, data, size);
+}
+
+template <unsigned Rules>
+__attribute__((target("avx2"), flatten)) void feed_avx2(State& state, const char* data, size_t size)
+{
+    feed_blocks<Avx2, Rules>(state, data, size);
+}
+
+template <unsigned Rules>
+__attribute__((target("avx2"), flatten)) unsigned feed_until_error_avx2(State& state,
+                                                                           const char* data,
+                                                                           size_t size)
+{
+    return feed_blocks_until_error<Avx2, Rules>(state, data, size);
+}
+
+__attribute__((target("sse2"), flatten)) const char* find_special_sse2(const char* begin, const char* end)
+{
+    return find_special_blocks<Sse2>(begin, end);
+}
+
+__attribute__((target("avx2"), flatten)) const char* find_special_avx2(const char* begin, const char* end)
+{
+    return find_special_blocks<Avx2>(begin, end);
+}
+
+#endif  // HAVE_X86_KERNELS
+
+
+#if HAVE_NEON_KERNEL
+
+struct Neon
+{
+    static inline uint8x16_t special16(const unsigned char* ptr)
+    {
+        uint8x16_t data = vld1q_u8(ptr);
+        return vorrq_u8(vcltq_u8(data, vdupq_n_u8(' ')), vcgtq_u8(data, vdupq_n_u8('~')));
+    }
+
+    //  There's no movemask, so give each byte its own bit
+    //  and add the neighbours together until 64 bits remain.
+    static inline uint64_t special_mask(const unsigned char* ptr)
+    {
+        static const uint8_t bit_values[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                               1, 2, 4, 8, 16, 32, 64, 128};
+        const uint8x16_t bits = vld1q_u8(bit_values);
+        uint8x16_t m0 = vandq_u8(special16(ptr), bits);
+        uint8x16_t m1 = vandq_u8(special16(ptr + 16), bits);
+        uint8x16_t m2 = vandq_u8(special16(ptr + 32), bits);
+        uint8x16_t m3 = vandq_u8(special16(ptr + 48), bits);
+        uint8x16_t sum = vpaddq_u8(vpaddq_u8(m0, m1), vpaddq_u8(m2, m3));
+        sum = vpaddq_u8(sum, sum);
+        return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+    }
+};
+
+__attribute__((flatten)) unsigned classify_neon(const char* data, size_t size)
+{
+    return classify_blocks<Neon>(data, size);
+}
+
+template <unsigned Rules>
+__attribute__((flatten)) void feed_neon(State& state, const char* data, size_t size)
+{
+    feed_blocks<Neon, Rules>(state, data, size);
+}
+
+template <unsigned Rules>
+__attribute__((flatten)) unsigned feed_until_error_neon(State& state, const char* data, size_t size)
+{
+    return feed_blocks_until_error<Neon, Rules>(state, data, size);
+}
+
+__attribute__((flatten)) const char* find_special_neon(const char* begin, const char* end)
+{
+    return find_special_blocks<Neon>(begin, end);
+}
+
+#endif  // HAVE_NEON_KERNEL
+
+
+std::vector<Classifier::Kernel> supported_kernels()
+{
+    std::vector<Classifier::Kernel> list;
+
+#if HAVE_X86_KERNELS
+    //  May run before the constructors that would otherwise do this
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        list.push_back({"avx2", classify_avx2, ALL_RULE_SETS(feed_avx2),
+                        ALL_RULE_SETS(feed_until_error_avx2), find_special_avx2});
+    }
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        list.push_back({"sse2", classify_sse2, ALL_RULE_SETS(feed_sse2),
+                        ALL_RULE_SETS(feed_until_error_sse2), find_special_sse2});
+    }
+#endif
+
+#if HAVE_NEON_KERNEL
+    list.push_back({"neon", classify_neon, ALL_RULE_SETS(feed_neon),
+                    ALL_RULE_SETS(feed_until_error_neon), find_special_neon});
+#endif
+
+    list.push_back({"scalar", classify_scalar, ALL_RULE_SETS(feed_scalar),
+                    ALL_RULE_SETS(feed_until_error_scalar), find_special_scalar});
+    return list;
+}
+
+//  Chosen once at startup
+const std::vector<Classifier::Kernel> the_kernels = supported_kernels();
+const Classifier::Kernel best_kernel = the_kernels.front();
+
+}  // namespace
+
+
+bool is_fixable(unsigned errors)
+{
+    //  Can't fix if any hopeless errors
+    if ((errors & err_hopeless) != 0)
+    {
+        return false;
+    }
+
+    //  Must have at least one fixable error
+    if ((errors & err_fixable) != 0)
+    {
+        return true;
+    }
+
+    return false;
+}
+
+
+namespace Classifier {
+
+unsigned classify(const char* data, size_t size)
+{
+    return best_kernel.classify(data, size);
+}
+
+
+void feed(State& state, const char* data, size_t size)
+{
+    best_kernel.feed[rule_set(state.allowed)](state, data, size);
+}
+
+
+unsigned first_error(const char* data, size_t size, unsigned allowed)
+{
+    State state;
+    state.allowed = allowed;
+    unsigned error = feed_until_error(state, data, size);
+    return error ? error : final_errors(state);
+}
+
+
+unsigned feed_until_error(State& state, const char* data, size_t size)
+{
+    return best_kernel.feed_until_error[rule_set(state.allowed)](state, data, size);
+}
+
+
+unsigned errors(const State& state)
+{
+    return final_errors(state);
+}
+
+
+void join(State& state, const State& next)
+{
+    if (next.empty)
+    {
+        return;
+    }
+
+    state.errors |= next.errors;
+    state.unusual_whitespace += next.unusual_whitespace;
+    state.invalid_count += next.invalid_count;
+    state.last = next.last;
+    state.before_last = next.before_last;
+    state.empty = false;
+    state.ends_with_lf = next.ends_with_lf;
+    state.utf8_pending = next.utf8_pending;
+    state.utf8_low = next.utf8_low;
+    state.utf8_high = next.utf8_high;
+    state.pending_cr = next.pending_cr;
+}
+
+
+const char* find_special(const char* begin, const char* end)
+{
+    return best_kernel.find_special(begin, end);
+}
+
+
+const std::vector<Kernel>& kernels()
+{
+    return the_kernels;
+}
+
+}  // namespace Classifier
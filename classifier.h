@@ -0,0 +1,141 @@
+/*
+    Whitespace and character classification for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+//  Error bits
+enum {
+    //  Fixable errors
+    err_tabs = 0x0001,                 // Tabs
+    err_unusual_whitespace = 0x0002,   // '\v', '\f', etc...
+    err_trailing_whitespace = 0x0004,  // Lines with whitespace at end
+    err_cr_lf_line_endings = 0x0008,   // Windows "\r\n" line endings
+    err_no_lf_at_end = 0x0010,         // No '\n' at end of file
+    err_utf16_encoding = 0x0020,       // UTF-16 text that can be converted
+    err_fixable = 0x00ff,
+    //
+    //  Hopeless errors
+    err_invalid_encoding = 0x0100,    // Possibly UTF-16
+    err_invalid_characters = 0x0200,  // Strange characters
+    err_not_a_text_file = 0x0400,     // Not a text file
+    err_hopeless = 0xff00,
+};
+
+//  Rules that can be relaxed for some files, like tabs in makefiles.
+//  The first two use the bits of the errors they no longer report.
+enum {
+    allow_tabs = err_tabs,
+    allow_cr_lf = err_cr_lf_line_endings,
+    allow_utf8 = 0x10000,  // Valid UTF-8 isn't invalid characters
+    allow_all = allow_tabs | allow_cr_lf | allow_utf8,
+};
+
+//  True if there's something to fix, and nothing that prevents fixing
+bool is_fixable(unsigned errors);
+
+namespace Classifier {
+
+//  Examine the data and return the error bits found, with none of the
+//  rules relaxed. Uses the fastest implementation this CPU can run.
+unsigned classify(const char* data, size_t size);
+
+//  Classification carried from one piece of a file to the next,
+//  so that big files can be examined a chunk at a time.
+struct State
+{
+    //  The allow_ bits for the file, set before the first piece
+    unsigned allowed = 0;
+
+    unsigned errors = 0;
+    long unusual_whitespace = 0;
+
+    //  Bytes that are neither printable nor whitespace
+    long invalid_count = 0;
+
+    //  The last two characters so far, with line feeds replaced
+    //  by a character that isn't whitespace
+    int last = 0;
+    int before_last = 0;
+
+    bool empty = true;
+    bool ends_with_lf = false;
+
+    //  A UTF-8 sequence still going on, and the range for the next byte
+    int utf8_pending = 0;
+    unsigned char utf8_low = 0x80;
+    unsigned char utf8_high = 0xbf;
+
+    //  A carriage return at the end, when feeding until an error
+    //  with CR-LF allowed
+    bool pending_cr = false;
+};
+
+//  Examine the next piece of the data. Feeding all of the data in any
+//  number of pieces gives the same results as classifying it at once.
+//  The kernel for the rules in the state is chosen on each call, so
+//  the rules cost nothing per byte.
+void feed(State& state, const char* data, size_t size);
+
+//  The error bits for all the data fed so far
+unsigned errors(const State& state);
+
+//  Add the results for the next piece of the data, fed from a new state
+//  with the same rules, to the state for the data before it. Classifying
+//  pieces split just after line feeds this way, even in parallel, gives
+//  the same results as feeding them one after another: nothing but the
+//  line ending itself carries over a line feed.
+void join(State& state, const State& next);
+
+//  Only whether the data is clean: zero if it is, and otherwise the bit
+//  of the first error found, without looking any further. Always one of
+//  the bits that classify would return, except that a carriage return
+//  at the end of a piece may turn out to be part of a CR-LF.
+unsigned first_error(const char* data, size_t size, unsigned allowed = 0);
+
+//  The same a piece at a time. Once this returns an error, the state
+//  is no longer good for feeding more.
+unsigned feed_until_error(State& state, const char* data, size_t size);
+
+//  Find the first byte outside the printable range from ' ' to '~',
+//  so that the clean runs in between can be handled in bulk.
+//  Returns end if there are none.
+const char* find_special(const char* begin, const char* end);
+
+//  Every combination of the allow_ bits has its own version
+//  of the feed functions
+constexpr int rule_sets = 8;
+
+//  One implementation of the above. The feed functions are indexed by
+//  the rule set, where index zero has none of the rules relaxed.
+struct Kernel
+{
+    const char* name;
+    unsigned (*classify)(const char* data, size_t size);
+    void (*feed[rule_sets])(State& state, const char* data, size_t size);
+    unsigned (*feed_until_error[rule_sets])(State& state, const char* data, size_t size);
+    const char* (*find_special)(const char* begin, const char* end);
+};
+
+//  All the implementations this CPU can run, the fastest first.
+//  The last one is always the plain scalar reference version.
+const std::vector<Kernel>& kernels();
+
+}  // namespace Classifier
@@ -0,0 +1,183 @@
+//  Unified diffs of the fixes for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "differ.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+//  Walks a text a line at a time, from the first line to the last
+class Lines
+{
+public:
+    Lines(const char* data, size_t size) : m_data(data), m_end(data + size) { }
+
+    //  Move to the start of the line, which must not be behind
+    void skip_to(long line)
+    {
+        while (m_line < line && m_data != m_end)
+        {
+            next();
+        }
+    }
+
+    bool at_end() const { return m_data == m_end; }
+    long line() const { return m_line; }
+
+    //  The current line, with its line break if it has one, and move
+    //  past it
+    const char* next()
+    {
+        const char* start = m_data;
+        auto found = static_cast<const char*>(std::memchr(m_data, '\n', m_end - m_data));
+        m_data = found ? found + 1 : m_end;
+        m_size = size_t(m_data - start);
+        ++m_line;
+        return start;
+    }
+
+    //  Size of the line next returned
+    size_t size() const { return m_size; }
+
+private:
+    const char* m_data;
+    const char* m_end;
+    long m_line = 1;
+    size_t m_size = 0;
+};
+
+void add_line(std::string& out, char prefix, const char* line, size_t size)
+{
+    out += prefix;
+    out.append(line, size);
+    if (size == 0 || line[size - 1] != '\n')
+    {
+        out += "\n\\ No newline at end of file\n";
+    }
+}
+
+//  The start and the count of a hunk header, the count left out when
+//  it's one, like diff does
+void add_range(std::string& out, long start, long count)
+{
+    out += std::to_string(start);
+    if (count != 1)
+    {
+        out += ',';
+        out += std::to_string(count);
+    }
+}
+
+}  // namespace
+
+
+namespace Differ {
+
+void unified(const char* original, size_t original_size, const char* fixed, size_t fixed_size,
+             const std::vector<long>& changed, const std::string& path, std::string& out)
+{
+    if (changed.empty())
+    {
+        return;
+    }
+
+    out += "--- ";
+    out += path;
+    out += "\n+++ ";
+    out += path;
+    out += '\n';
+
+    Lines before(original, original_size);
+    Lines after(fixed, fixed_size);
+    std::string removed;
+    std::string added;
+    std::string hunk;
+    size_t ix = 0;
+    while (ix < changed.size())
+    {
+        //  The changes close enough to each other share a hunk
+        long start = std::max(1L, changed[ix] - context_lines);
+        before.skip_to(start);
+        after.skip_to(start);
+        if (before.at_end())
+        {
+            break;
+        }
+
+        hunk.clear();
+        long old_count = 0;
+        long new_count = 0;
+        long last_change = changed[ix];
+        while (!before.at_end() && before.line() <= last_change + context_lines)
+        {
+            long line = before.line();
+            const char* old_line = before.next();
+            ++old_count;
+            bool is_changed = ix < changed.size() && changed[ix] == line;
+            while (ix < changed.size() && changed[ix] == line)
+            {
+                ++ix;
+            }
+
+            if (!is_changed)
+            {
+                //  The removed and added lines of a run go together
+                hunk += removed;
+                hunk += added;
+                removed.clear();
+                added.clear();
+                const char* new_line = after.next();
+                add_line(hunk, ' ', new_line, after.size());
+                ++new_count;
+                continue;
+            }
+
+            add_line(removed, '-', old_line, before.size());
+
+            //  A last line of only whitespace and no line feed is gone
+            //  from the fixed text
+            if (!after.at_end())
+            {
+                const char* new_line = after.next();
+                add_line(added, '+', new_line, after.size());
+                ++new_count;
+            }
+
+            if (ix < changed.size() && changed[ix] <= line + 2 * context_lines + 1)
+            {
+                last_change = changed[ix];
+            }
+        }
+
+        hunk += removed;
+        hunk += added;
+        removed.clear();
+        added.clear();
+
+        //  An empty range starts from the line before, like diff has it
+        out += "@@ -";
+        add_range(out, start, old_count);
+        out += " +";
+        add_range(out, new_count > 0 ? start : start - 1, new_count);
+        out += " @@\n";
+        out += hunk;
+    }
+}
+
+}  // namespace Differ
@@ -0,0 +1,45 @@
+/*
+    Unified diffs of the fixes for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//  Shows what fixing a file would change, as a unified diff like
+//  "diff -u" makes, without writing anything.
+//
+//  The fixer never adds or removes a line break, so each line of the
+//  fixed text is the same line of the original, fixed. That makes the
+//  diff a matter of knowing which lines changed, and the locator already
+//  knows that. Only the lines around those are looked at, and the clean
+//  stretches in between are just skipped over to the next line break.
+//
+namespace Differ {
+
+//  Lines around each change, like "diff -u"
+constexpr long context_lines = 3;
+
+//  Append the diff of the original and the fixed text to out. The
+//  changed lines are the line numbers from the locator, counting from
+//  one, in order and possibly repeated. The path goes in the headers.
+void unified(const char* original, size_t original_size, const char* fixed, size_t fixed_size,
+             const std::vector<long>& changed, const std::string& path, std::string& out);
+
+}  // namespace Differ
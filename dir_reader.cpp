@@ -0,0 +1,183 @@
+//  Directory reading for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "dir_reader.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+//  The record layout of getdents64, which glibc doesn't always declare
+struct LinuxDirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+int type_of(const struct stat& info)
+{
+    if (S_ISDIR(info.st_mode))
+    {
+        return DirReader::eDIRECTORY;
+    }
+
+    if (S_ISREG(info.st_mode))
+    {
+        return DirReader::eREGULAR;
+    }
+
+    return DirReader::eOTHER;
+}
+
+}  // namespace
+
+
+DirReader::~DirReader()
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+}
+
+
+bool DirReader::open(const char* path)
+{
+    m_fd = ::openat(AT_FDCWD, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    m_error = 0;
+    m_pos = 0;
+    m_end = 0;
+    return m_fd >= 0;
+}
+
+
+bool DirReader::fill()
+{
+    for (;;)
+    {
+        long count = ::syscall(SYS_getdents64, m_fd, m_buffer, sizeof(m_buffer));
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            m_error = errno;
+            return false;
+        }
+
+        m_pos = 0;
+        m_end = size_t(count);
+        return count > 0;
+    }
+}
+
+
+bool DirReader::next(Entry& entry)
+{
+    for (;;)
+    {
+        if (m_pos == m_end && !fill())
+        {
+            return false;
+        }
+
+        auto dirent = reinterpret_cast<const LinuxDirent64*>(m_buffer + m_pos);
+        m_pos += dirent->d_reclen;
+
+        const char* name = dirent->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        {
+            continue;
+        }
+
+        entry.name = std::string_view(name);
+        entry.is_symlink = false;
+        switch (dirent->d_type)
+        {
+        case DT_DIR:
+            entry.type = eDIRECTORY;
+            break;
+
+        case DT_REG:
+            entry.type = eREGULAR;
+            break;
+
+        case DT_LNK:
+        case DT_UNKNOWN:
+        {
+            //  Look at the entry itself first, unless it's known to be a link
+            struct stat info;
+            if (dirent->d_type == DT_UNKNOWN)
+            {
+                if (::fstatat(m_fd, name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+                {
+                    entry.type = eOTHER;
+                    break;
+                }
+
+                entry.is_symlink = S_ISLNK(info.st_mode);
+                if (!entry.is_symlink)
+                {
+                    entry.type = type_of(info);
+                    break;
+                }
+            }
+
+            //  Follow the link
+            entry.is_symlink = true;
+            entry.type = ::fstatat(m_fd, name, &info, 0) == 0 ? type_of(info) : eOTHER;
+            break;
+        }
+
+        default:
+            entry.type = eOTHER;
+            break;
+        }
+
+        return true;
+    }
+}
+
+
+std::string_view file_extension(std::string_view name)
+{
+    size_t slash = name.rfind('/');
+    if (slash != std::string_view::npos)
+    {
+        name.remove_prefix(slash + 1);
+    }
+
+    //  A leading period begins a hidden name, not an extension
+    size_t pos = name.rfind('.');
+    if (pos == std::string_view::npos || pos == 0 || name == "..")
+    {
+        return {};
+    }
+
+    return name.substr(pos);
+}
@@ -0,0 +1,76 @@
+/*
+    Directory reading for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+//  Reads the entries of one directory with getdents64, a big batch per
+//  system call. The names point straight into the buffer, so nothing
+//  is allocated per entry. The type comes from d_type, and stat is
+//  needed only for symbolic links and file systems that don't fill it.
+//
+class DirReader
+{
+public:
+    DirReader() = default;
+    ~DirReader();
+
+    DirReader(const DirReader&) = delete;
+    DirReader& operator=(const DirReader&) = delete;
+
+    //  Entry types, with symbolic links followed
+    enum {
+        eOTHER,      // Something else, or a broken link
+        eDIRECTORY,
+        eREGULAR,
+    };
+
+    struct Entry
+    {
+        std::string_view name;  // Valid until the next call
+        int type;
+        bool is_symlink;
+    };
+
+    //  Returns false, with errno set, if the directory can't be opened
+    bool open(const char* path);
+
+    //  Gets the next entry, skipping "." and "..". Returns false
+    //  at the end, or if reading failed.
+    bool next(Entry& entry);
+
+    //  The errno from a failed read, zero if none
+    int error() const { return m_error; }
+
+private:
+    bool fill();
+
+    int m_fd = -1;
+    int m_error = 0;
+    size_t m_pos = 0;
+    size_t m_end = 0;
+
+    //  Big enough for a few hundred entries per call
+    alignas(8) char m_buffer[32 * 1024];
+};
+
+//  The extension of the last component of a path, the same as what
+//  std::filesystem::path::extension would give.
+std::string_view file_extension(std::string_view name);
@@ -0,0 +1,489 @@
+//  Loading file contents for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "file_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+namespace {
+
+//  Mapping a file costs a few system calls and page faults,
+//  so smaller files are faster to just read.
+constexpr size_t min_size_to_map = 64 * 1024;
+
+//  Closes the file descriptor on the way out
+class FileDescriptor
+{
+public:
+    explicit FileDescriptor(int fd) : m_fd(fd) { }
+    ~FileDescriptor()
+    {
+        if (m_fd >= 0)
+            ::close(m_fd);
+    }
+
+    int get() const { return m_fd; }
+
+    //  Keep the file open after all
+    int release()
+    {
+        int fd = m_fd;
+        m_fd = -1;
+        return fd;
+    }
+
+private:
+    int m_fd;
+};
+
+
+//  Mapped files can change under our feet, or vanish, if the server
+//  decides so. That would be a SIGBUS, so better read these instead.
+bool is_network_filesystem(int fd)
+{
+    struct statfs info;
+    if (::fstatfs(fd, &info) != 0)
+    {
+        return true;  // Don't know, so be careful
+    }
+
+    switch (static_cast<unsigned long>(info.f_type))
+    {
+    case 0x6969:      // NFS
+    case 0x517b:      // SMB
+    case 0xff534d42:  // CIFS
+    case 0xfe534d42:  // SMB2
+    case 0x65735546:  // FUSE
+    case 0x01021997:  // 9P
+    case 0x73757245:  // Coda
+    case 0x564c:      // NCP
+    case 0x5346414f:  // AFS
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+//  A mapped file that is truncated by someone else while it's being
+//  read would kill the program with SIGBUS as soon as the missing pages
+//  are touched. The mappings are listed here, so that the handler can
+//  put a page of zeros in place of the missing one, and mark the mapping
+//  as faulted. The code reading it goes on as if nothing happened, and
+//  the results are thrown away once the loader sees the mark.
+//
+//  The handler can't take locks, so the slots are claimed with atomics.
+struct MappedRegion
+{
+    std::atomic<bool> used{false};
+    std::atomic<uintptr_t> begin{0};
+    std::atomic<size_t> size{0};
+    std::atomic<bool> faulted{false};
+};
+
+constexpr int max_regions = 1024;
+MappedRegion the_regions[max_regions];
+
+struct sigaction the_previous_bus_action;
+uintptr_t the_page_size = 4096;
+
+void on_bus_error(int signal, siginfo_t* info, void* context)
+{
+    uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+    for (auto& region : the_regions)
+    {
+        uintptr_t begin = region.begin.load(std::memory_order_acquire);
+        if (begin != 0 && address >= begin && address - begin < region.size.load())
+        {
+            void* page = reinterpret_cast<void*>(address & ~(the_page_size - 1));
+            if (::mmap(page, the_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                       -1, 0) != MAP_FAILED)
+            {
+                region.faulted.store(true, std::memory_order_release);
+                return;
+            }
+        }
+    }
+
+    //  Not ours, so let it do what it would have done
+    if (the_previous_bus_action.sa_flags & SA_SIGINFO)
+    {
+        the_previous_bus_action.sa_sigaction(signal, info, context);
+        return;
+    }
+
+    if (the_previous_bus_action.sa_handler != SIG_DFL &&
+        the_previous_bus_action.sa_handler != SIG_IGN)
+    {
+        the_previous_bus_action.sa_handler(signal);
+        return;
+    }
+
+    ::signal(SIGBUS, SIG_DFL);
+}
+
+bool install_bus_handler()
+{
+    static std::once_flag once;
+    static bool installed = false;
+    std::call_once(once, []() {
+        the_page_size = uintptr_t(::sysconf(_SC_PAGESIZE));
+        struct sigaction action = {};
+        action.sa_sigaction = on_bus_error;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        installed = ::sigaction(SIGBUS, &action, &the_previous_bus_action) == 0;
+    });
+
+    return installed;
+}
+
+//  Returns the slot, or -1 if they are all taken
+int add_region(const void* map, size_t size)
+{
+    for (int ix = 0; ix < max_regions; ++ix)
+    {
+        bool expected = false;
+        if (the_regions[ix].used.compare_exchange_strong(expected, true))
+        {
+            the_regions[ix].size.store(size);
+            the_regions[ix].faulted.store(false);
+            the_regions[ix].begin.store(reinterpret_cast<uintptr_t>(map),
+                                        std::memory_order_release);
+            return ix;
+        }
+    }
+
+    return -1;
+}
+
+void remove_region(int slot)
+{
+    the_regions[slot].begin.store(0, std::memory_order_release);
+    the_regions[slot].used.store(false, std::memory_order_release);
+}
+
+}  // namespace
+
+
+bool FileLoader::load(const char* path)
+{
+    return open(path) && load();
+}
+
+
+bool FileLoader::open(const char* path)
+{
+    release();
+
+    FileDescriptor fd(::open(path, O_RDONLY | O_CLOEXEC));
+    if (fd.get() < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (::fstat(fd.get(), &info) != 0)
+    {
+        return false;
+    }
+
+    m_file_size = size_t(info.st_size);
+    m_regular = S_ISREG(info.st_mode);
+    m_info = info;
+    m_has_info = true;
+    m_fd = fd.release();
+    return true;
+}
+
+
+bool FileLoader::load()
+{
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    //  Left open, to be read a chunk at a time
+    size_t size = m_file_size;
+    if (m_stream_threshold > 0 && size > m_stream_threshold && m_regular)
+    {
+        m_streamed = true;
+        return true;
+    }
+
+    FileDescriptor fd(m_fd);
+    m_fd = -1;
+    if (m_mapping && size >= min_size_to_map && m_regular && !is_network_filesystem(fd.get()))
+    {
+        if (map_file(fd.get(), size))
+        {
+            return true;
+        }
+    }
+
+    return read_file(fd.get(), size);
+}
+
+
+void FileLoader::adopt(std::vector<char>& buffer, const struct stat* info)
+{
+    release();
+    m_buffer.swap(buffer);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+    m_file_size = m_size;
+    m_regular = true;
+    if (info)
+    {
+        m_info = *info;
+        m_has_info = true;
+    }
+}
+
+
+const char* FileLoader::head(size_t& size)
+{
+    if (m_fd < 0)
+    {
+        return nullptr;
+    }
+
+    if (m_head.size() < size)
+    {
+        m_head.resize(size);
+    }
+
+    //  Leaves the file position alone
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t count = ::pread(m_fd, m_head.data() + done, size - done, off_t(done));
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return nullptr;
+        }
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        done += size_t(count);
+    }
+
+    size = done;
+    return m_head.data();
+}
+
+
+void FileLoader::release()
+{
+    if (m_map)
+    {
+        remove_region(m_region);
+        ::munmap(m_map, m_map_size);
+        m_map = nullptr;
+        m_map_size = 0;
+        m_region = -1;
+    }
+
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+    if (m_pool)
+    {
+        m_pool->give(m_buffer);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+    m_file_size = 0;
+    m_regular = false;
+    m_streamed = false;
+    m_read_failed = false;
+    m_has_info = false;
+}
+
+
+bool FileLoader::next_chunk()
+{
+    m_data = nullptr;
+    m_size = 0;
+    if (!m_streamed || m_read_failed)
+    {
+        return false;
+    }
+
+    make_room(chunk_size, 0);
+    ssize_t count = read_fully(m_fd, m_buffer.data(), chunk_size);
+    if (count < 0)
+    {
+        m_read_failed = true;
+        return false;
+    }
+
+    m_data = m_buffer.data();
+    m_size = size_t(count);
+    return count > 0;
+}
+
+
+bool FileLoader::rewind()
+{
+    m_data = nullptr;
+    m_size = 0;
+    return m_streamed && !m_read_failed && ::lseek(m_fd, 0, SEEK_SET) == 0;
+}
+
+
+ssize_t FileLoader::read_fully(int fd, char* buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t count = ::read(fd, buffer + done, size - done);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        done += size_t(count);
+    }
+
+    return ssize_t(done);
+}
+
+
+bool FileLoader::map_file(int fd, size_t size)
+{
+    //  Without the protection, reading is the safe way
+    if (!install_bus_handler())
+    {
+        return false;
+    }
+
+    void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_region = add_region(map, size);
+    if (m_region < 0)
+    {
+        ::munmap(map, size);
+        return false;
+    }
+
+    //  The data is read once from beginning to end
+    ::madvise(map, size, MADV_SEQUENTIAL);
+
+    m_map = map;
+    m_map_size = size;
+    m_data = static_cast<const char*>(map);
+    m_size = size;
+    return true;
+}
+
+
+bool FileLoader::was_truncated() const
+{
+    return m_map && the_regions[m_region].faulted.load(std::memory_order_acquire);
+}
+
+
+bool FileLoader::read_file(int fd, size_t size_hint)
+{
+    //  The size is only a hint, the file might be growing or
+    //  shrinking, or be something that doesn't know its size.
+    //  Keep reading until the end, and make room as needed.
+    make_room(size_hint + 1, 0);
+    size_t size = 0;
+    for (;;)
+    {
+        if (size == m_buffer.size())
+        {
+            make_room(2 * m_buffer.size(), size);
+        }
+
+        ssize_t count = ::read(fd, m_buffer.data() + size, m_buffer.size() - size);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        size += size_t(count);
+    }
+
+    m_data = m_buffer.data();
+    m_size = size;
+    return true;
+}
+
+
+void FileLoader::make_room(size_t size, size_t keep)
+{
+    if (m_buffer.size() >= size)
+    {
+        return;
+    }
+
+    if (!m_pool)
+    {
+        m_buffer.resize(size);
+        return;
+    }
+
+    std::vector<char> bigger = m_pool->take(size);
+    std::copy_n(m_buffer.data(), keep, bigger.data());
+    m_pool->give(m_buffer);
+    m_buffer.swap(bigger);
+}
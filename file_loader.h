@@ -0,0 +1,140 @@
+/*
+    Loading file contents for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "buffer_pool.h"
+
+#include <cstddef>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+//  Gives read only access to the contents of a file.
+//
+//  Big files on local filesystems are memory mapped, so the data
+//  is never copied. Small files, and files on network filesystems,
+//  are read into a buffer that is reused from one file to the next.
+//  A mapped file truncated while it's being read doesn't crash
+//  anything, the loader just tells about it.
+//
+//  Files above the stream threshold are not loaded at all. They are
+//  left open, to be read one chunk at a time into the same buffer, so
+//  that even huge files take only a constant amount of memory.
+//
+//  With a pool, the buffer is taken from there when needed and given
+//  back when the file is released, so that others can use it, too.
+//
+class FileLoader
+{
+public:
+    FileLoader() = default;
+    ~FileLoader() { release(); }
+
+    FileLoader(const FileLoader&) = delete;
+    FileLoader& operator=(const FileLoader&) = delete;
+
+    //  Size of the chunks for streamed files
+    static constexpr size_t chunk_size = 1024 * 1024;
+
+    //  Stream files bigger than this, zero means never
+    void set_stream_threshold(size_t size) { m_stream_threshold = size; }
+
+    //  Where to get the buffers from, nullptr for a buffer of its own
+    void set_pool(BufferPool* pool) { m_pool = pool; }
+
+    //  Returns false if the file couldn't be opened or read
+    bool load(const char* path);
+
+    //  The same in two steps, so that the file can be looked at first
+    bool open(const char* path);
+    bool load();
+
+    //  Take over contents someone else already read. The buffer is
+    //  swapped with the loader's own, so nothing is copied.
+    void adopt(std::vector<char>& buffer, const struct stat* info = nullptr);
+
+    //  Read up to size bytes from the beginning of an opened file,
+    //  without loading it. Returns nullptr if the read failed.
+    const char* head(size_t& size);
+
+    //  For a streamed file, read the next chunk into data() and size().
+    //  Every chunk is full size, except the last one. Returns false at
+    //  the end of the file, or if the read failed.
+    bool next_chunk();
+
+    //  Start reading a streamed file again from the beginning
+    bool rewind();
+
+    bool is_streamed() const { return m_streamed; }
+    bool read_failed() const { return m_read_failed; }
+
+    //  Size of the whole file, even if streamed
+    size_t file_size() const { return m_file_size; }
+
+    //  What fstat said about the file, if known
+    bool has_info() const { return m_has_info; }
+    const struct stat& info() const { return m_info; }
+
+    //  Drop the contents, and unmap if it was mapped
+    void release();
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool is_mapped() const { return m_map != nullptr; }
+
+    //  True if the mapped file turned out to be shorter than it was when
+    //  mapped, because someone truncated it. The missing pages read as
+    //  zeros, so nothing found in the contents can be trusted.
+    bool was_truncated() const;
+
+    //  Big files are mapped unless told otherwise
+    void set_mapping(bool mapping) { m_mapping = mapping; }
+
+private:
+    bool read_file(int fd, size_t size_hint);
+    bool map_file(int fd, size_t size);
+
+    //  Make the buffer at least the size, keeping what's at the start
+    void make_room(size_t size, size_t keep);
+
+    //  Fill the buffer as far as possible, returns the size or -1 on error
+    ssize_t read_fully(int fd, char* buffer, size_t size);
+
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_file_size = 0;
+
+    size_t m_stream_threshold = 0;
+    int m_fd = -1;
+    bool m_regular = false;
+    bool m_streamed = false;
+    bool m_read_failed = false;
+    bool m_has_info = false;
+    struct stat m_info;
+
+    void* m_map = nullptr;
+    size_t m_map_size = 0;
+    int m_region = -1;  // Where the mapping is listed for the SIGBUS handler
+    bool m_mapping = true;
+
+    BufferPool* m_pool = nullptr;
+    std::vector<char> m_buffer;
+    std::vector<char> m_head;
+};
@@ -15,79 +15,1102 @@
 //  You should have received a copy of the GNU General Public License
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include "archive_reader.h"
+#include "bounded_queue.h"
+#include "classifier.h"
+#include "dir_reader.h"
+#include "file_loader.h"
+#include "locator.h"
 #include "normalizer.h"
 #include "options.h"
+#include "path_matcher.h"
+#include "reporter.h"
+#include "scan_cache.h"
+#include "seen_files.h"
+#include "stats.h"
+#include "uring_loader.h"
+#include "watcher.h"
+#include "worker_pool.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
-namespace {
+namespace {
+
+//  Output for one directory or file.
+//  Kept aside and reported in path order once all the work is done,
+//  so the output won't depend on which worker was the fastest.
+using Results = Reporter::Records;
+
+//  Shared by all the arguments, saved when all is done
+ScanCache the_cache;
+Reporter the_reporter;
+SeenFiles the_seen_files;
+
+//  Work on the pieces of the files split for all the jobs. The caller
+//  takes a piece too. Shared by the checkers, so that splitting many
+//  files at once doesn't multiply the threads.
+std::unique_ptr<WorkerPool> the_split_workers;
+std::once_flag the_split_workers_started;
+
+WorkerPool* split_workers(const Options* opts)
+{
+    std::call_once(the_split_workers_started, [opts]() {
+        if (opts->split_above() > 0 && opts->jobs() > 1)
+        {
+            the_split_workers = std::make_unique<WorkerPool>(opts->jobs() - 1);
+        }
+    });
+
+    return the_split_workers.get();
+}
+
+//  Set when any file turns out to have errors. With --fail-fast, that's
+//  the signal for everyone to stop.
+std::atomic<bool> the_errors_found{false};
+
+bool is_stopping()
+{
+    return Options::get()->fail_fast() && the_errors_found.load(std::memory_order_relaxed);
+}
+
+//  The records read from the reports being merged, written at the end
+Results the_merged;
+
+using CacheEntries = std::vector<ScanCache::Entry>;
+
+ScanCache::Entry cache_entry(const struct stat& info)
+{
+    ScanCache::Entry entry = {};
+    entry.device = info.st_dev;
+    entry.inode = info.st_ino;
+    entry.size = info.st_size;
+    entry.mtime_ns = int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return entry;
+}
+
+//  True if the cached results can be reported as they are
+bool is_known(const ScanCache::Entry* previous, const ScanCache::Entry& entry, const Options* opts)
+{
+    if (previous && previous->size == entry.size && previous->mtime_ns == entry.mtime_ns)
+    {
+        //  Unchanged. Need to load it only if there's something to fix,
+        //  or to find.
+        bool fix = (opts->fix() || opts->diff()) && is_fixable(previous->errors);
+        bool locate = opts->locations() > 0 && (previous->errors & Locator::locatable);
+        return !fix && !locate;
+    }
+
+    return false;
+}
+
+//  True if the file needs to be loaded, not just reported from the cache
+bool needs_loading(const struct stat& info, const Options* opts)
+{
+    //  Left for the normalizer to take from the other link
+    SeenFiles::Findings findings;
+    if (the_seen_files.find(info, findings) && !(opts->fix() && is_fixable(findings.errors)))
+    {
+        return false;
+    }
+
+    if (!the_cache.is_open())
+    {
+        return true;
+    }
+
+    ScanCache::Entry entry = cache_entry(info);
+    return !is_known(the_cache.find(entry.device, entry.inode), entry, opts);
+}
+
+//  Normalize a file, but skip loading it if the cache says it hasn't
+//  changed. New results for the cache are added to the entries. The
+//  stat info may be known already.
+void examine(Normalizer& normalizer, const std::string& full_name, const Options* opts,
+             CacheEntries& entries, const struct stat* known = nullptr)
+{
+    unsigned allowed = opts->allowed_for(full_name);
+    normalizer.set_allowed(allowed);
+    if (!the_cache.is_open())
+    {
+        normalizer.normalize(full_name.c_str(), opts->tabsize(), opts->fix());
+        return;
+    }
+
+    struct stat info;
+    if (known)
+    {
+        info = *known;
+    }
+    else if (::stat(full_name.c_str(), &info) != 0)
+    {
+        //  Let the normalizer deal with it
+        normalizer.normalize(full_name.c_str(), opts->tabsize(), opts->fix());
+        return;
+    }
+
+    //  The same file under another name may have had other rules
+    ScanCache::Entry entry = cache_entry(info);
+    entry.allowed = allowed;
+    const ScanCache::Entry* previous = the_cache.find(entry.device, entry.inode);
+    if (is_known(previous, entry, opts) && previous->allowed == allowed)
+    {
+        normalizer.report_known(full_name.c_str(), previous->errors);
+        return;
+    }
+
+    normalizer.normalize(full_name.c_str(), opts->tabsize(), opts->fix(), previous);
+
+    //  A fixed file is a new file, so let the next run examine it again
+    if (normalizer.was_loaded() && !normalizer.was_fixed() && !normalizer.is_partial())
+    {
+        entry.content_hash = normalizer.content_hash();
+        entry.errors = normalizer.errors();
+        entries.push_back(entry);
+    }
+}
+
+
+//  The .gitignore rules in effect in a directory, one level for each
+//  directory on the way down that has a .gitignore file. The deeper
+//  levels come first, and they win over the ones above.
+struct IgnoreLevel
+{
+    std::shared_ptr<const IgnoreLevel> parent;
+    size_t base;  // Length of the directory part of the full names
+    PathMatcher rules;
+};
+
+using Ignores = std::shared_ptr<const IgnoreLevel>;
+
+bool is_ignored(const IgnoreLevel* level, std::string_view path, bool is_directory)
+{
+    for (; level; level = level->parent.get())
+    {
+        int found = level->rules.match(path.substr(level->base), is_directory);
+        if (found != PathMatcher::eNO_MATCH)
+        {
+            return found == PathMatcher::eMATCH;
+        }
+    }
+
+    return false;
+}
+
+//  Add the rules from the .gitignore file in the directory, if it has one.
+//  The prefix is the directory name with a slash at the end.
+Ignores add_ignores(const std::string& prefix, Ignores parent)
+{
+    FileLoader file;
+    if (!file.load((prefix + ".gitignore").c_str()) || file.size() == 0)
+    {
+        return parent;
+    }
+
+    auto level = std::make_shared<IgnoreLevel>();
+    level->rules.add_lines(std::string_view(file.data(), file.size()));
+    if (level->rules.empty())
+    {
+        return parent;
+    }
+
+    level->rules.compile();
+    level->parent = std::move(parent);
+    level->base = prefix.size();
+    return level;
+}
+
+//  True if the directory or file is left out by the skip patterns or
+//  the .gitignore files. The root is the length of the part of the path
+//  that is the directory being scanned.
+bool is_skipped(const Options* opts, std::string_view path, size_t root,
+                const IgnoreLevel* ignores, bool is_directory)
+{
+    std::string_view relative = path.substr(std::min(root, path.size()));
+    return opts->should_be_skipped(relative, is_directory) ||
+           is_ignored(ignores, path, is_directory);
+}
+
+//  True if the regular file should be examined
+bool is_selected(const Options* opts, std::string_view path, std::string_view name, size_t root,
+                 const IgnoreLevel* ignores)
+{
+    return !is_skipped(opts, path, root, ignores, false) &&
+           (opts->is_source_extension(file_extension(name)) ||
+            opts->is_included(path.substr(std::min(root, path.size()))));
+}
+
+//  True if the file belongs to the shard examined here
+bool is_in_shard(const Options* opts, std::string_view path, size_t root)
+{
+    return opts->in_shard(path.substr(std::min(root, path.size())));
+}
+
+
+//  The directories watched for changes, and what's needed to decide
+//  about the names in them, the same way the walk does
+struct WatchedDir
+{
+    std::string path;
+    Ignores ignores;
+    size_t root;
+};
+
+struct WatchedDirs
+{
+    Watcher watcher;
+    bool active = false;
+
+    std::mutex mutex;
+    std::unordered_map<int, WatchedDir> dirs;
+    bool warned = false;
+
+    //  Called from the walkers for every directory entered
+    void add(const std::string& dir, const Ignores& ignores, size_t root);
+};
+
+WatchedDirs the_watch;
+
+void WatchedDirs::add(const std::string& dir, const Ignores& ignores, size_t root)
+{
+    int wd = watcher.add(dir.c_str());
+    std::lock_guard<std::mutex> lock(mutex);
+    if (wd < 0)
+    {
+        //  Most likely out of watches, no need to tell about every one
+        if (!warned)
+        {
+            warned = true;
+            std::cerr << "Warning: Could not watch " << dir << ": " << std::strerror(errno) << '\n';
+        }
+
+        return;
+    }
+
+    dirs[wd] = {dir, ignores, root};
+}
+
+
+std::string quoted(const fs::path& path, const char* prefix)
+{
+    std::ostringstream os;
+    os << prefix << path << '\n';
+    return os.str();
+}
+
+Reporter::Record verbose_record(const std::string& path, const char* prefix)
+{
+    Reporter::Record record;
+    record.path = path;
+    record.verbose = quoted(path, prefix);
+    return record;
+}
+
+//  Set up a normalizer the way the options say
+void configure(Normalizer& normalizer)
+{
+    const Options* opts = Options::get();
+    normalizer.set_hashing(the_cache.is_open() || the_seen_files.by_content());
+    normalizer.set_seen_files(&the_seen_files);
+    normalizer.set_stream_threshold(opts->stream_above());
+    normalizer.set_split(opts->split_above(), split_workers(opts));
+    normalizer.set_non_ascii(opts->non_ascii());
+    normalizer.set_max_locations(opts->locations());
+    normalizer.set_write_policy(opts->backup(), opts->sync());
+    normalizer.set_check_only(opts->check());
+    normalizer.set_diff(opts->diff());
+}
+
+//  True if there's something to tell about the file. Also notes the
+//  errors found, for the exit status.
+bool should_report(const Normalizer& normalizer, const Options* opts)
+{
+    if (normalizer.errors() != 0)
+    {
+        the_errors_found = true;
+    }
+
+    //  Only the exit status tells about the errors in the check mode
+    return opts->verbose() || (normalizer.errors() != 0 && !opts->check()) ||
+           !normalizer.report().empty() || the_watch.active;
+}
+
+//  What the normalizer found out about the file
+Reporter::Record result_record(const Normalizer& normalizer, std::string path, bool verbose)
+{
+    Reporter::Record record;
+    if (verbose)
+    {
+        record.verbose = quoted(path, "examine ");
+    }
+
+    record.path = std::move(path);
+    record.errors = normalizer.errors();
+    record.invalid_count = normalizer.invalid_count();
+    record.non_ascii_count = normalizer.non_ascii_count();
+    record.fixed = normalizer.was_fixed();
+    record.examined = true;
+    record.locations = normalizer.locations();
+    record.omitted_locations = normalizer.omitted_locations();
+    record.problems = normalizer.report();
+    record.diff = normalizer.diff();
+    return record;
+}
+
+
+//  Scanning a directory is done in two stages connected by a queue.
+//
+//  The walkers read the directories, one task per directory, so a
+//  slow directory won't hold up the others. Names of files that
+//  should be examined are pushed to the queue, and the checkers
+//  pop them one at a time and do the actual work. This way the
+//  latency of reading directories overlaps with checking files.
+//
+//  With io_uring, there's a loader in between. It takes the names,
+//  reads the small files ahead, and passes them on in another queue.
+//
+class Pipeline
+{
+public:
+    explicit Pipeline(const Options* opts);
+
+    //  Scan everything under the path, and wait until all is done.
+    //  Returns false if there was a filesystem error.
+    bool run(const fs::path& path);
+
+    //  Examine the files named in a list read from the file descriptor.
+    //  The names are separated by NUL characters or line feeds.
+    bool run_list(int fd);
+
+    //  Examine the members of the archive. They are read here, one after
+    //  another, and then checked in parallel like the files.
+    bool run_archive(const std::string& path);
+
+    //  Check the changed files, and walk the new directories
+    bool run_changes(const std::vector<std::string>& files, const std::vector<WatchedDir>& dirs);
+
+    //  The first filesystem error, if any
+    const std::string& error() const { return m_error; }
+
+    void print() { the_reporter.write(m_results); }
+
+private:
+    void start_checkers();
+    void stop_checkers();
+
+    void walk(const std::string& dir, Ignores ignores, size_t root, int walker);
+
+    //  Queue a file named in the list
+    void add_listed(std::string name);
+
+    //  Queue the members of the archive for the checkers
+    void read_archive(const std::string& path);
+
+    //  True if the member of an archive should be examined
+    bool is_selected_member(const std::string& name);
+
+    //  Read and queue the member, or examine it right here if it's big
+    void add_member(ArchiveReader& reader, const ArchiveReader::Member& member,
+                    std::string path, Normalizer& normalizer);
+
+    void check(int checker);
+
+    //  The next file for a checker, read ahead or not
+    bool next_file(UringLoader::File& file);
+
+    //  Remember the first error, and stop walking any further.
+    //  After the first file with errors with --fail-fast, the walkers
+    //  stop too, and the checkers only empty the queue.
+    void fail(const char* what);
+
+    const Options* m_opts;
+    int m_checkers;
+    int m_walker_count;
+    WorkerPool* m_walkers = nullptr;
+
+    BoundedQueue<std::string> m_queue{4096};
+
+    bool m_read_ahead = false;
+    bool m_from_archive = false;  // The checkers take the members from m_files
+    UringLoader m_loader;
+    BoundedQueue<UringLoader::File> m_files{256};
+    std::thread m_loader_thread;
+
+    //  Checkers have the first slots, walkers the rest
+    std::vector<Results> m_results;
+
+    std::vector<std::thread> m_checker_threads;
+
+    std::atomic<bool> m_failed{false};
+    std::mutex m_error_mutex;
+    std::string m_error;
+};
+
+
+Pipeline::Pipeline(const Options* opts) : m_opts(opts)
+{
+    //  Walkers mostly just wait for the filesystem,
+    //  so there's no need to have quite as many of them.
+    m_checkers = opts->jobs();
+    m_walker_count = std::min(m_checkers, 8);
+    m_results.resize(m_checkers + m_walker_count);
+
+    //  Falls back to the normal loading if there's no io_uring
+    m_read_ahead = opts->io_uring() && m_loader.init();
+}
+
+
+void Pipeline::start_checkers()
+{
+    if (m_read_ahead)
+    {
+        m_loader_thread = std::thread([this]() {
+            m_loader.run(m_queue, m_files,
+                         [this](const struct stat& info) { return needs_loading(info, m_opts); });
+        });
+    }
+
+    for (int ix = 0; ix < m_checkers; ++ix)
+    {
+        m_checker_threads.emplace_back(&Pipeline::check, this, ix);
+    }
+}
+
+
+void Pipeline::stop_checkers()
+{
+    //  All the names are in the queue, let the checkers finish.
+    //  The loader closes its own queue when it's done.
+    m_queue.close();
+    if (m_loader_thread.joinable())
+    {
+        m_loader_thread.join();
+    }
+
+    for (auto& thread : m_checker_threads)
+    {
+        thread.join();
+    }
+
+    m_checker_threads.clear();
+}
+
+
+bool Pipeline::run(const fs::path& path)
+{
+    start_checkers();
+
+    {
+        WorkerPool walkers(m_walker_count);
+        m_walkers = &walkers;
+        std::string dir = path.string();
+        size_t root = dir.size() + (dir.back() == '/' ? 0 : 1);
+        walkers.submit([this, dir, root](int walker) { walk(dir, nullptr, root, walker); });
+        walkers.wait();
+        m_walkers = nullptr;
+    }
+
+    stop_checkers();
+    return !m_failed;
+}
+
+
+bool Pipeline::run_archive(const std::string& path)
+{
+    //  No loader, the members come already read
+    m_read_ahead = false;
+    m_from_archive = true;
+    start_checkers();
+
+    //  Whatever the archive has in it, the checkers must be let go
+    try
+    {
+        read_archive(path);
+    }
+    catch (const std::exception& err)
+    {
+        fail((path + ": " + err.what()).c_str());
+    }
+
+    m_files.close();
+    stop_checkers();
+    return !m_failed;
+}
+
+
+void Pipeline::read_archive(const std::string& path)
+{
+    ArchiveReader reader;
+    if (reader.open(path.c_str()))
+    {
+        //  For the big members, examined here as they are decompressed
+        Normalizer normalizer;
+        configure(normalizer);
+        ArchiveReader::Member member;
+        while (!is_stopping() && reader.next(member))
+        {
+            //  Like the walk, the names are relative to the archive
+            std::string name = member.name;
+            while (name.compare(0, 2, "./") == 0)
+            {
+                name.erase(0, 2);
+            }
+
+            if (!member.regular || name.empty())
+            {
+                continue;
+            }
+
+            if (!is_selected_member(name))
+            {
+                Stats::add(Stats::files_skipped);
+                if (m_opts->verbose())
+                {
+                    m_results[m_checkers].push_back(verbose_record(path + '/' + name, "skip "));
+                }
+
+                continue;
+            }
+
+            if (m_opts->in_shard(name))
+            {
+                add_member(reader, member, path + '/' + name, normalizer);
+            }
+        }
+    }
+
+    if (!reader.error().empty())
+    {
+        fail(reader.error().c_str());
+    }
+}
+
+
+bool Pipeline::is_selected_member(const std::string& name)
+{
+    //  Each directory on the way is checked, as the walk would have
+    //  skipped it before getting to the member
+    size_t slash = name.find('/');
+    if (slash != std::string::npos && !m_opts->recursive())
+    {
+        return false;
+    }
+
+    for (; slash != std::string::npos; slash = name.find('/', slash + 1))
+    {
+        if (m_opts->should_be_skipped(std::string_view(name).substr(0, slash), true))
+        {
+            return false;
+        }
+    }
+
+    return is_selected(m_opts, name, name.substr(name.rfind('/') + 1), 0, nullptr);
+}
+
+
+void Pipeline::add_member(ArchiveReader& reader, const ArchiveReader::Member& member,
+                          std::string path, Normalizer& normalizer)
+{
+    if (!member.problem.empty())
+    {
+        Reporter::Record record;
+        record.path = std::move(path);
+        record.problems = member.problem + '\n';
+        m_results[m_checkers].push_back(std::move(record));
+        return;
+    }
+
+    size_t threshold = m_opts->stream_above();
+    if (threshold > 0 && member.size > threshold)
+    {
+        normalizer.set_allowed(m_opts->allowed_for(path));
+        normalizer.normalize_stream(
+            path.c_str(), [&reader](char* buffer, size_t size) { return reader.read(buffer, size); });
+        if (normalizer.was_loaded() && should_report(normalizer, m_opts))
+        {
+            m_results[m_checkers].push_back(
+                result_record(normalizer, std::move(path), m_opts->verbose()));
+        }
+
+        return;
+    }
+
+    UringLoader::File file;
+    file.path = std::move(path);
+    if (!reader.read_all(file.data))
+    {
+        return;
+    }
+
+    file.loaded = true;
+    file.has_info = false;
+    m_files.push(std::move(file));
+}
+
+
+bool Pipeline::run_changes(const std::vector<std::string>& files,
+                           const std::vector<WatchedDir>& dirs)
+{
+    start_checkers();
+    for (const auto& file : files)
+    {
+        m_queue.push(file);
+    }
+
+    if (!dirs.empty())
+    {
+        WorkerPool walkers(m_walker_count);
+        m_walkers = &walkers;
+        for (const auto& dir : dirs)
+        {
+            walkers.submit([this, dir](int walker) { walk(dir.path, dir.ignores, dir.root, walker); });
+        }
+
+        walkers.wait();
+        m_walkers = nullptr;
+    }
+
+    stop_checkers();
+    return !m_failed;
+}
+
+
+bool Pipeline::run_list(int fd)
+{
+    start_checkers();
+
+    //  Read the list in big chunks, and queue each name as soon as
+    //  it's complete. The first chunk decides between NUL and line feed
+    //  as the separator, so that "git diff -z" style output can carry
+    //  even names with line feeds in them.
+    std::vector<char> buffer(64 * 1024);
+    std::string name;
+    char separator = 0;
+    bool first = true;
+    while (!is_stopping())
+    {
+        ssize_t count = ::read(fd, buffer.data(), buffer.size());
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            fail(std::strerror(errno));
+            break;
+        }
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        const char* cursor = buffer.data();
+        const char* end = cursor + count;
+        if (first)
+        {
+            first = false;
+            separator = std::memchr(cursor, '\0', count) ? '\0' : '\n';
+        }
+
+        while (cursor != end)
+        {
+            auto found = static_cast<const char*>(std::memchr(cursor, separator, end - cursor));
+            const char* stop = found ? found : end;
+            name.append(cursor, stop);
+            cursor = stop;
+            if (found)
+            {
+                ++cursor;
+                add_listed(std::move(name));
+                name.clear();
+            }
+        }
+    }
+
+    //  The last name may be missing the separator
+    add_listed(std::move(name));
+
+    stop_checkers();
+    return !m_failed;
+}
+
 
-void scan_and_process(fs::path& path)
+void Pipeline::add_listed(std::string name)
 {
-    Normalizer normalizer;
+    if (name.empty() || !m_opts->in_shard(name))
+    {
+        return;
+    }
 
-    const Options* opts = Options::get();
-    bool fix = opts->fix();
-    bool verbose = opts->verbose();
-    bool recursive = opts->recursive();
-    int tabsize = opts->tabsize();
+    if (m_opts->by_extension())
+    {
+        bool select = m_opts->is_source_extension(file_extension(name));
+        if (!select)
+        {
+            Stats::add(Stats::files_skipped);
+            if (m_opts->verbose())
+            {
+                m_results[m_checkers].push_back(verbose_record(name, "skip "));
+            }
+
+            return;
+        }
+    }
+
+    m_queue.push(std::move(name));
+}
+
+
+void Pipeline::walk(const std::string& dir, Ignores ignores, size_t root, int walker)
+{
+    if (m_failed || is_stopping())
+    {
+        return;
+    }
+
+    Stats::Timer timer(Stats::phase_walk);
+    Stats::add(Stats::directories);
+
+    Results& results = m_results[m_checkers + walker];
+    bool verbose = m_opts->verbose();
+    bool recursive = m_opts->recursive();
+
+    DirReader reader;
+    if (!reader.open(dir.c_str()))
+    {
+        fail(("Could not open directory " + dir + ": " + std::strerror(errno)).c_str());
+        return;
+    }
+
+    //  The full names are built in place, one after another
+    std::string path = dir;
+    if (path.empty() || path.back() != '/')
+    {
+        path += '/';
+    }
+
+    if (m_opts->gitignore())
+    {
+        ignores = add_ignores(path, std::move(ignores));
+    }
 
-    auto iter = fs::recursive_directory_iterator(path);
-    const auto end = fs::recursive_directory_iterator();
-    for (; iter != end; ++iter)
+    if (the_watch.active)
     {
-        const auto& entry = *iter;
-        if (entry.is_directory())
+        the_watch.add(dir, ignores, root);
+    }
+
+    size_t base = path.size();
+    DirReader::Entry entry;
+    while (!is_stopping() && reader.next(entry))
+    {
+        path.resize(base);
+        path.append(entry.name);
+
+        if (entry.type == DirReader::eDIRECTORY)
         {
             const char* prefix = "enter ";
-            if (!recursive || opts->should_be_skipped(entry.path().filename().string()))
+            if (!recursive || is_skipped(m_opts, path, root, ignores.get(), true))
             {
-                iter.disable_recursion_pending();
                 prefix = "skip ";
             }
+            else if (!entry.is_symlink)
+            {
+                //  Fan out, the subdirectory becomes a task of its own.
+                //  Like the recursive_directory_iterator, don't follow
+                //  symbolic links to directories.
+                m_walkers->submit(
+                    [this, path, ignores, root](int next) { walk(path, ignores, root, next); });
+            }
 
             if (verbose)
             {
-                std::cout << prefix << entry.path() << '\n';
+                results.push_back(verbose_record(path, prefix));
             }
 
             continue;
         }
 
-        if (entry.is_regular_file())
+        if (entry.type == DirReader::eREGULAR)
         {
-            bool select = opts->is_source_extension(entry.path().extension().string());
-            if (verbose)
+            if (is_selected(m_opts, path, entry.name, root, ignores.get()))
             {
-                std::cout << (select ? "examine " : "skip ") << entry.path() << '\n';
+                //  Another shard's files are left alone, without a word
+                if (is_in_shard(m_opts, path, root))
+                {
+                    m_queue.push(path);
+                }
+
+                continue;
             }
 
-            if (select)
+            Stats::add(Stats::files_skipped);
+            if (verbose)
             {
-                std::string full_name = entry.path().string();
-                normalizer.normalize(full_name.c_str(), tabsize, fix);
+                results.push_back(verbose_record(path, "skip "));
             }
         }
     }
+
+    if (reader.error())
+    {
+        fail(("Could not read directory " + dir + ": " + std::strerror(reader.error())).c_str());
+    }
+}
+
+
+void Pipeline::check(int checker)
+{
+    Normalizer normalizer;
+    configure(normalizer);
+    Results& results = m_results[checker];
+    CacheEntries entries;
+    bool verbose = m_opts->verbose();
+
+    UringLoader::File file;
+    while (next_file(file))
+    {
+        //  Keep taking the names, so that nobody waits for room
+        if (is_stopping())
+        {
+            continue;
+        }
+
+        if (file.loaded)
+        {
+            normalizer.preload(file.data, file.has_info ? &file.info : nullptr);
+        }
+
+        examine(normalizer, file.path, m_opts, entries, file.has_info ? &file.info : nullptr);
+        if (should_report(normalizer, m_opts))
+        {
+            results.push_back(result_record(normalizer, std::move(file.path), verbose));
+        }
+    }
+
+    the_cache.add(entries);
+}
+
+
+bool Pipeline::next_file(UringLoader::File& file)
+{
+    if (m_read_ahead || m_from_archive)
+    {
+        return m_files.pop(file);
+    }
+
+    file.loaded = false;
+    file.has_info = false;
+    return m_queue.pop(file.path);
+}
+
+
+void Pipeline::fail(const char* what)
+{
+    std::lock_guard<std::mutex> lock(m_error_mutex);
+    if (!m_failed)
+    {
+        m_error = what;
+        m_failed = true;
+    }
+}
+
+
+void scan_and_process(fs::path& path)
+{
+    Pipeline pipeline(Options::get());
+    bool ok = pipeline.run(path);
+
+    //  Show what was done even if there was an error
+    pipeline.print();
+    if (!ok)
+    {
+        throw std::runtime_error(pipeline.error());
+    }
+}
+
+
+void scan_archive(const fs::path& path)
+{
+    Pipeline pipeline(Options::get());
+    bool ok = pipeline.run_archive(path.string());
+
+    //  Show what was found even if the archive turned out to be broken
+    pipeline.print();
+    if (!ok)
+    {
+        throw std::runtime_error(pipeline.error());
+    }
 }
 
 
 void process_file(fs::path& path)
 {
     Normalizer normalizer;
-    if (Options::get()->verbose())
+    configure(normalizer);
+    CacheEntries entries;
+    examine(normalizer, path.string(), Options::get(), entries);
+    the_cache.add(entries);
+
+    //  Always written otherwise, the reporter knows what to do with it
+    bool report = should_report(normalizer, Options::get());
+    if (!report && Options::get()->check())
     {
-        std::cout << "examine " << path << '\n';
+        return;
     }
 
-    const Options* opts = Options::get();
-    std::string full_name = path.string();
-    normalizer.normalize(full_name.c_str(), opts->tabsize(), opts->fix());
+    Reporter::Record record = result_record(normalizer, path.string(), Options::get()->verbose());
+    the_reporter.write(record);
+}
+
+//  Without the trailing slashes, so that a parent can be found by name
+std::string_view without_slash(std::string_view path)
+{
+    while (path.size() > 1 && path.back() == '/')
+    {
+        path.remove_suffix(1);
+    }
+
+    return path;
+}
+
+//  All of the watched directories to walk again, when the changes
+//  that were missed can't be known. Each tree is walked from the top,
+//  with the rules it was under, not counting its own .gitignore.
+void rewalk_watched(const Options* opts, std::vector<WatchedDir>& dirs)
+{
+    std::set<std::string_view> watched;
+    for (const auto& entry : the_watch.dirs)
+    {
+        watched.insert(without_slash(entry.second.path));
+    }
+
+    std::set<std::string_view> added;
+    for (const auto& entry : the_watch.dirs)
+    {
+        const WatchedDir& dir = entry.second;
+        std::string_view path = without_slash(dir.path);
+        auto slash = path.rfind('/');
+        bool below = slash != std::string_view::npos &&
+                     watched.count(without_slash(path.substr(0, slash + 1))) > 0;
+        if ((below && opts->recursive()) || !added.insert(path).second)
+        {
+            continue;
+        }
+
+        Ignores ignores = dir.ignores;
+        if (ignores && ignores->base == path.size() + 1)
+        {
+            ignores = ignores->parent;
+        }
+
+        dirs.push_back({dir.path, std::move(ignores), dir.root});
+    }
+}
+
+//  Turn the events into the files to check and the new directories to
+//  walk. The same file often has several events, so the files are a set.
+void collect_changes(const std::vector<Watcher::Event>& events, const Options* opts,
+                     std::set<std::string>& files, std::vector<WatchedDir>& dirs)
+{
+    std::lock_guard<std::mutex> lock(the_watch.mutex);
+    for (const auto& event : events)
+    {
+        //  Some changes were lost, so everything is looked at again
+        if (event.mask & IN_Q_OVERFLOW)
+        {
+            std::cerr << "Warning: Too many changes at once, checking all the files again\n";
+            files.clear();
+            dirs.clear();
+            rewalk_watched(opts, dirs);
+            return;
+        }
+
+        auto found = the_watch.dirs.find(event.wd);
+        if (found == the_watch.dirs.end())
+        {
+            continue;
+        }
+
+        const WatchedDir& dir = found->second;
+        if (event.mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+        {
+            //  Gone, or somewhere else now. If it was moved within the
+            //  tree, it's walked again under the new name.
+            if (event.mask & IN_MOVE_SELF)
+            {
+                the_watch.watcher.remove(event.wd);
+            }
+
+            the_watch.dirs.erase(found);
+            continue;
+        }
+
+        std::string path = dir.path;
+        if (path.back() != '/')
+        {
+            path += '/';
+        }
+
+        path += event.name;
+        if (event.mask & IN_ISDIR)
+        {
+            if ((event.mask & (IN_CREATE | IN_MOVED_TO)) && opts->recursive() &&
+                !is_skipped(opts, path, dir.root, dir.ignores.get(), true))
+            {
+                dirs.push_back({path, dir.ignores, dir.root});
+            }
+        }
+        else if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        {
+            std::string_view name = std::string_view(path).substr(path.size() - event.name.size());
+            if (is_selected(opts, path, name, dir.root, dir.ignores.get()) &&
+                is_in_shard(opts, path, dir.root))
+            {
+                files.insert(std::move(path));
+            }
+        }
+    }
+}
+
+
+//  Also sets up the reporter, which can be done any number of times
+bool open_cache()
+{
+    the_reporter.set_format(Options::get()->format());
+    the_seen_files.set_mode(Options::get()->dedup());
+
+    static bool cache_opened = false;
+    const std::string& cache_file = Options::get()->cache_file();
+    if (cache_opened || cache_file.empty())
+    {
+        return true;
+    }
+
+    cache_opened = true;
+    return the_cache.open(cache_file, Options::get()->result_settings());
 }
 
 }  // namespace
@@ -98,6 +1121,12 @@ namespace FileScanner {
 
 bool process(const char* arg)
 {
+    //  Open the cache on first use
+    if (!open_cache())
+    {
+        return false;
+    }
+
     try
     {
         fs::path path = fs::canonical(arg);
@@ -106,12 +1135,17 @@ bool process(const char* arg)
         {
             scan_and_process(path);
         }
-        else if (dir.is_regular_file())
+        else if (dir.is_regular_file() && Options::get()->archives() &&
+                 ArchiveReader::is_archive(path.c_str()))
+        {
+            scan_archive(path);
+        }
+        else if (dir.is_regular_file() && Options::get()->in_shard(arg))
         {
             process_file(path);
         }
     }
-    catch (const fs::filesystem_error& err)
+    catch (const std::exception& err)
     {
         std::cerr << err.what() << '\n';
         return false;
@@ -120,4 +1154,204 @@ bool process(const char* arg)
     return true;
 }
 
+
+bool process_list(const char* list)
+{
+    //  Open the cache on first use
+    if (!open_cache())
+    {
+        return false;
+    }
+
+    int fd = 0;
+    if (std::strcmp(list, "-") != 0)
+    {
+        fd = ::open(list, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            std::string msg = "Could not open ";
+            msg += list;
+            std::perror(msg.c_str());
+            return false;
+        }
+    }
+
+    Pipeline pipeline(Options::get());
+    bool ok = pipeline.run_list(fd);
+    pipeline.print();
+    if (fd != 0)
+    {
+        ::close(fd);
+    }
+
+    if (!ok)
+    {
+        std::cerr << list << ": " << pipeline.error() << '\n';
+    }
+
+    return ok;
+}
+
+
+bool merge_report(const char* report)
+{
+    the_reporter.set_format(Options::get()->format());
+
+    std::ifstream file;
+    bool is_stdin = std::strcmp(report, "-") == 0;
+    if (!is_stdin)
+    {
+        file.open(report);
+        if (!file)
+        {
+            std::string msg = "Could not open ";
+            msg += report;
+            std::perror(msg.c_str());
+            return false;
+        }
+    }
+
+    std::istream& in = is_stdin ? std::cin : file;
+    std::string line;
+    long line_number = 0;
+    while (std::getline(in, line))
+    {
+        ++line_number;
+        if (line.empty())
+        {
+            continue;
+        }
+
+        Reporter::Record record;
+        if (!Reporter::parse_json(line, record))
+        {
+            std::cerr << report << ':' << line_number << ": Not a line of a JSON Lines report\n";
+            return false;
+        }
+
+        if (record.errors != 0)
+        {
+            the_errors_found = true;
+        }
+
+        the_merged.push_back(std::move(record));
+    }
+
+    if (in.bad())
+    {
+        std::string msg = "Could not read ";
+        msg += report;
+        std::perror(msg.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+bool filter(const char* name)
+{
+    const Options* opts = Options::get();
+    the_reporter.set_format(opts->format());
+
+    std::string path = name ? name : "-";
+    Normalizer normalizer;
+    configure(normalizer);
+    normalizer.set_allowed(opts->allowed_for(path));
+    bool ok = normalizer.filter(0, 1, path.c_str(), opts->tabsize());
+
+    //  Git shows what a filter says, so only what's left unfixed
+    if (normalizer.errors() != 0)
+    {
+        the_errors_found = true;
+    }
+
+    if (opts->verbose() || (normalizer.errors() != 0 && !normalizer.was_fixed()) ||
+        !normalizer.report().empty())
+    {
+        Reporter::Record record = result_record(normalizer, path, opts->verbose());
+        the_reporter.write(record);
+    }
+
+    return ok;
+}
+
+
+bool found_errors()
+{
+    return the_errors_found;
+}
+
+
+bool start_watching()
+{
+    if (!the_watch.watcher.init())
+    {
+        std::perror("Could not watch for changes");
+        return false;
+    }
+
+    the_watch.active = true;
+    the_reporter.set_report_clean(true);
+    return true;
+}
+
+
+bool watch()
+{
+    const Options* opts = Options::get();
+    std::vector<Watcher::Event> events;
+    for (;;)
+    {
+        //  Saving a file tends to give a burst of events, so wait for
+        //  things to calm down a bit, but not for too long
+        int got = the_watch.watcher.wait(events, 100, 1000);
+        if (got == Watcher::eSTOPPED)
+        {
+            return true;
+        }
+
+        if (got == Watcher::eERROR)
+        {
+            std::perror("Could not watch for changes");
+            return false;
+        }
+
+        std::set<std::string> files;
+        std::vector<WatchedDir> dirs;
+        collect_changes(events, opts, files, dirs);
+        if (files.empty() && dirs.empty())
+        {
+            continue;
+        }
+
+        Pipeline pipeline(opts);
+        bool ok = pipeline.run_changes({files.begin(), files.end()}, dirs);
+        pipeline.print();
+        FileWriter::sync_batch();
+        if (!ok)
+        {
+            //  Something changed while looking at it, not a reason to stop
+            std::cerr << pipeline.error() << '\n';
+        }
+    }
+}
+
+
+bool finish()
+{
+    //  All the merged reports together, in the order a single run
+    //  would have them
+    if (!the_merged.empty())
+    {
+        std::vector<Results> merged(1);
+        merged[0].swap(the_merged);
+        the_reporter.write(merged);
+    }
+
+    the_reporter.finish();
+    bool synced = FileWriter::sync_batch();
+    return the_cache.save() && synced;
 }
+
+}  // namespace FileScanner
@@ -23,4 +23,49 @@ namespace FileScanner {
 //
 bool process(const char* arg);
 
+//
+//  Process the files named in a list file, or in the standard input
+//  if the name is "-". The names go straight to the checking, without
+//  any looking around in the filesystem.
+//
+bool process_list(const char* list);
+
+//
+//  Fix the contents of the standard input, and write them to the
+//  standard output. The name, if any, is what the contents would be
+//  called in a file, for the rules and the messages.
+//
+bool filter(const char* name);
+
+//
+//  Read a JSON Lines report, or the standard input if the name is "-".
+//  The records from all the reports are written together at the end,
+//  in the format chosen, as if they came from a single run.
+//
+bool merge_report(const char* report);
+
+//
+//  True if any of the files processed so far had errors
+//
+bool found_errors();
+
+//
+//  Watch the directories walked from now on for changes.
+//  Must be called before any of the arguments are processed.
+//
+bool start_watching();
+
+//
+//  Keep checking the files that change in the watched directories,
+//  until stopped by SIGINT or SIGTERM.
+//
+bool watch();
+
+//
+//  Called once all the arguments have been processed.
+//  Saves the scan cache if there is one, and syncs the fixed
+//  files if they are synced as a batch.
+//
+bool finish();
+
 }  // namespace FileScanner
@@ -0,0 +1,371 @@
+//  Replacing files with their fixed versions for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "file_writer.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
+namespace {
+
+//  Name of the directory for eDIR backups
+const char backup_dir[] = ".source_normalizer.bak";
+
+//  Turned off for good if the kernel turns out not to have these.
+//  Naming an unnamed file needs /proc, unless the process is privileged.
+std::atomic<bool> has_tmpfile{::access("/proc/self/fd", X_OK) == 0};
+std::atomic<bool> has_exchange{true};
+
+//  A directory on each file system written to, for the batch sync
+std::mutex batch_mutex;
+std::vector<std::pair<dev_t, int>> batch_dirs;
+
+//  Into a string given, so that its room is reused
+void directory_of(const std::string& path, std::string& dir)
+{
+    auto pos = path.rfind('/');
+    if (pos == std::string::npos)
+    {
+        dir = ".";
+    }
+    else
+    {
+        dir.assign(path, 0, pos == 0 ? 1 : pos);
+    }
+}
+
+void note_for_batch(int fd, const std::string& dir)
+{
+    struct stat info;
+    if (::fstat(fd, &info) != 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    for (const auto& dir : batch_dirs)
+    {
+        if (dir.first == info.st_dev)
+        {
+            return;
+        }
+    }
+
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
+    {
+        batch_dirs.emplace_back(info.st_dev, dir_fd);
+    }
+}
+
+}  // namespace
+
+
+FileWriter::~FileWriter()
+{
+    discard();
+}
+
+
+bool FileWriter::open(const std::string& path)
+{
+    discard();
+    m_path = path;
+    m_temp_name = path;
+    m_temp_name += ".tmp~";
+    directory_of(path, m_dir);
+
+    if (has_tmpfile)
+    {
+        m_fd = ::open(m_dir.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+        if (m_fd >= 0)
+        {
+            m_unnamed = true;
+            return true;
+        }
+
+        //  Old kernels say one of these. A file system without support
+        //  says EOPNOTSUPP, and another one may still do it.
+        if (errno == EISDIR || errno == EINVAL)
+        {
+            has_tmpfile = false;
+        }
+        else if (errno != EOPNOTSUPP)
+        {
+            return fail("Could not create a file in", m_dir);
+        }
+    }
+
+    m_unnamed = false;
+    m_fd = ::open(m_temp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (m_fd < 0)
+    {
+        return fail("Could not create", m_temp_name);
+    }
+
+    return true;
+}
+
+
+bool FileWriter::write(const char* data, size_t size)
+{
+    if (!write_all(m_fd, data, size))
+    {
+        return fail("Could not write", m_unnamed ? m_path : m_temp_name);
+    }
+
+    return true;
+}
+
+
+bool FileWriter::commit()
+{
+    if (m_sync == eSYNC_FILE && ::fsync(m_fd) != 0)
+    {
+        return fail("Could not sync", m_path);
+    }
+
+    if (m_sync == eSYNC_BATCH)
+    {
+        note_for_batch(m_fd, m_dir);
+    }
+
+    //  The new contents go where the backup will be, and then the two
+    //  trade places. Without a backup the new file takes the name over,
+    //  and the original is gone.
+    const std::string& staged = m_backup == eNO_BACKUP ? m_temp_name : backup_name();
+
+    //  An unnamed file gets its name while it's still open
+    bool ok = !m_unnamed || link_to(staged);
+
+    //  Writing may fail only by the time of closing, and then the
+    //  original stays as it was
+    int fd = m_fd;
+    m_fd = -1;
+    if (::close(fd) != 0 && ok)
+    {
+        fail("Could not write", m_path);
+        if (m_unnamed)
+        {
+            ::unlink(staged.c_str());
+        }
+
+        ok = false;
+    }
+
+    if (ok && !m_unnamed && m_backup != eNO_BACKUP)
+    {
+        ok = std::rename(m_temp_name.c_str(), staged.c_str()) == 0 ||
+             fail("Could not rename", m_temp_name, staged);
+    }
+
+    if (ok && m_backup == eNO_BACKUP)
+    {
+        ok = std::rename(staged.c_str(), m_path.c_str()) == 0 ||
+             fail("Could not rename", staged, m_path);
+    }
+    else if (ok)
+    {
+        ok = exchange(staged, m_path);
+    }
+
+    if (!ok && !m_unnamed)
+    {
+        ::unlink(m_temp_name.c_str());
+    }
+
+    return ok;
+}
+
+
+void FileWriter::discard()
+{
+    m_error.clear();
+    if (m_fd < 0)
+    {
+        return;
+    }
+
+    ::close(m_fd);
+    m_fd = -1;
+    if (!m_unnamed)
+    {
+        ::unlink(m_temp_name.c_str());
+    }
+}
+
+
+bool FileWriter::sync_batch()
+{
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    bool ok = true;
+    for (const auto& dir : batch_dirs)
+    {
+        if (::syncfs(dir.second) != 0)
+        {
+            std::perror("Could not sync the fixed files");
+            ok = false;
+        }
+
+        ::close(dir.second);
+    }
+
+    batch_dirs.clear();
+    return ok;
+}
+
+
+bool FileWriter::write_all(int fd, const char* data, size_t size)
+{
+    //  Normally this takes just one write
+    while (size > 0)
+    {
+        ssize_t count = ::write(fd, data, size);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        data += count;
+        size -= size_t(count);
+    }
+
+    return true;
+}
+
+
+bool FileWriter::fail(const char* what, const std::string& name)
+{
+    m_error = what;
+    m_error += ' ';
+    m_error += name;
+    m_error += ": ";
+    m_error += std::strerror(errno);
+    return false;
+}
+
+
+bool FileWriter::fail(const char* what, const std::string& from, const std::string& to)
+{
+    m_error = what;
+    m_error += ' ';
+    m_error += from;
+    m_error += " to ";
+    m_error += to;
+    m_error += ": ";
+    m_error += std::strerror(errno);
+    return false;
+}
+
+
+bool FileWriter::link_to(const std::string& name)
+{
+    char proc_name[64];
+    std::snprintf(proc_name, sizeof(proc_name), "/proc/self/fd/%d", m_fd);
+    for (int tries = 0; tries < 2; ++tries)
+    {
+        if (::linkat(AT_FDCWD, proc_name, AT_FDCWD, name.c_str(), AT_SYMLINK_FOLLOW) == 0)
+        {
+            return true;
+        }
+
+        //  A leftover from before, like an old backup
+        if (errno != EEXIST || ::unlink(name.c_str()) != 0)
+        {
+            break;
+        }
+    }
+
+    return fail("Could not link", name);
+}
+
+
+bool FileWriter::exchange(const std::string& a, const std::string& b)
+{
+    if (has_exchange)
+    {
+        if (::syscall(SYS_renameat2, AT_FDCWD, a.c_str(), AT_FDCWD, b.c_str(), RENAME_EXCHANGE) == 0)
+        {
+            return true;
+        }
+
+        if (errno != ENOSYS && errno != EINVAL)
+        {
+            return fail("Could not rename", a, b);
+        }
+
+        has_exchange = false;
+    }
+
+    //  The long way around, with the temporary name free by now
+    if (std::rename(b.c_str(), m_temp_name.c_str()) != 0)
+    {
+        return fail("Could not rename", b, m_temp_name);
+    }
+
+    if (std::rename(a.c_str(), b.c_str()) != 0)
+    {
+        fail("Could not rename", a, b);
+        std::rename(m_temp_name.c_str(), b.c_str());
+        return false;
+    }
+
+    if (std::rename(m_temp_name.c_str(), a.c_str()) != 0)
+    {
+        return fail("Could not rename", m_temp_name, a);
+    }
+
+    return true;
+}
+
+
+const std::string& FileWriter::backup_name()
+{
+    if (m_backup == eBAK)
+    {
+        m_backup_name = m_path;
+        m_backup_name += ".bak~";
+        return m_backup_name;
+    }
+
+    m_backup_name = m_dir;
+    m_backup_name += '/';
+    m_backup_name += backup_dir;
+    ::mkdir(m_backup_name.c_str(), 0777);  // Usually there already. If not, linking says why.
+
+    auto pos = m_path.rfind('/');
+    m_backup_name += '/';
+    m_backup_name.append(m_path, pos == std::string::npos ? 0 : pos + 1, std::string::npos);
+    return m_backup_name;
+}
@@ -0,0 +1,106 @@
+/*
+    Replacing files with their fixed versions for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+//  Writes the new contents of a file, and then swaps it in place of
+//  the original, with as few changes to the directory as it takes.
+//
+//  Where the kernel and the file system allow, the new contents go to
+//  an unnamed O_TMPFILE. It gets a name only when it's complete, so
+//  nothing is left lying around if writing fails. The original and the
+//  new file trade places with renameat2(RENAME_EXCHANGE), so there's
+//  never a moment without the file. Older systems get the same result
+//  with a named temporary file and plain renames.
+//
+class FileWriter
+{
+public:
+    //  What to keep of the original
+    enum Backup {
+        eNO_BACKUP,  // Nothing
+        eBAK,        // "name.bak~" next to the file
+        eDIR,        // ".source_normalizer.bak/name" in the same directory
+    };
+
+    //  How sure to be that the new contents are on the disk
+    enum Sync {
+        eNO_SYNC,     // Leave it to the system
+        eSYNC_FILE,   // fsync each file before it replaces the original
+        eSYNC_BATCH,  // One syncfs for each file system at the end
+    };
+
+    FileWriter() = default;
+    ~FileWriter();
+
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+    void set_policy(Backup backup, Sync sync)
+    {
+        m_backup = backup;
+        m_sync = sync;
+    }
+
+    //  Start writing the new contents for the file
+    bool open(const std::string& path);
+
+    bool write(const char* data, size_t size);
+
+    //  Put the new contents in place of the original. Either this or
+    //  discard must follow a successful open.
+    bool commit();
+
+    //  Forget about the new contents, if not committed, and the error
+    void discard();
+
+    //  What went wrong, in the words of perror
+    const std::string& error() const { return m_error; }
+
+    //  Do the syncfs calls for the batch policy, once all is done
+    static bool sync_batch();
+
+    //  Write all of the data to a descriptor, however many writes it
+    //  takes. For writing elsewhere than to files being replaced.
+    static bool write_all(int fd, const char* data, size_t size);
+
+private:
+    bool fail(const char* what, const std::string& name);
+    bool fail(const char* what, const std::string& from, const std::string& to);
+
+    //  Give the unnamed file a name
+    bool link_to(const std::string& name);
+
+    bool exchange(const std::string& a, const std::string& b);
+
+    const std::string& backup_name();
+
+    Backup m_backup = eBAK;
+    Sync m_sync = eNO_SYNC;
+
+    int m_fd = -1;
+    bool m_unnamed = false;  // O_TMPFILE, not at m_temp_name
+    std::string m_path;
+    std::string m_temp_name;
+    std::string m_dir;  // Where the file is
+    std::string m_backup_name;
+    std::string m_error;
+};
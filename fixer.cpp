@@ -0,0 +1,443 @@
+//  Fixing whitespace issues for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "fixer.h"
+#include "classifier.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace {
+
+//  Everything between the special characters is copied as is, and the
+//  output is kept big enough for the rest of the input as it is. Only
+//  tabs can make the text longer, so room is checked only for those.
+//
+//  A piece of a longer text begins with the whitespace held back from
+//  the previous piece, at the given column. Unless it's the last piece,
+//  the whitespace at the end is again held back, because the line could
+//  still turn out to end there.
+//
+//  Tabs and CR-LF line endings are left alone if the rules allow them.
+//  A tab is still trailing whitespace, though, and may be held back
+//  with the spaces around it. A carriage return at the
+//  end of a piece is held back too, until it's known whether a line
+//  feed follows. A missing line ending at the end is the same kind as
+//  the one before it, which cr_lf remembers.
+//
+size_t fix_piece(const char* data, size_t size, int tab_width, unsigned allowed,
+                 std::vector<char>& output, std::string& pending, size_t& column,
+                 bool& pending_cr, bool& cr_lf, bool last)
+{
+    //  Room for a missing line ending at the end, too
+    size_t room = pending.size() + size + 3;
+    if (output.size() < room)
+    {
+        output.resize(room);
+    }
+
+    char* out = output.data();
+    std::memcpy(out, pending.data(), pending.size());
+    size_t out_pos = pending.size();
+    size_t line_start = 0;
+
+    //  Column of the first byte in the output
+    size_t column_base = column - pending.size();
+
+    //  Drop the whitespace at the end of the current line
+    bool keep_tabs = (allowed & allow_tabs) != 0;
+    bool keep_cr_lf = (allowed & allow_cr_lf) != 0;
+    auto trim = [&]() {
+        while (out_pos > line_start &&
+               (out[out_pos - 1] == ' ' || (keep_tabs && out[out_pos - 1] == '\t')))
+        {
+            --out_pos;
+        }
+    };
+
+    auto end_line = [&](bool with_cr) {
+        trim();
+        cr_lf = with_cr;
+        if (with_cr)
+        {
+            out[out_pos++] = '\r';
+        }
+
+        out[out_pos++] = '\n';
+        line_start = out_pos;
+        column_base = 0;
+    };
+
+    const char* cursor = data;
+    const char* end = data + size;
+    //  An empty piece doesn't tell whether a line feed follows
+    if (pending_cr && (cursor != end || last))
+    {
+        pending_cr = false;
+        if (cursor != end && *cursor == '\n')
+        {
+            end_line(true);
+            ++cursor;
+        }
+        else
+        {
+            out[out_pos++] = ' ';
+        }
+    }
+
+    while (cursor != end)
+    {
+        const char* special = Classifier::find_special(cursor, end);
+        size_t count = special - cursor;
+        std::memcpy(out + out_pos, cursor, count);
+        out_pos += count;
+        if (special == end)
+        {
+            break;
+        }
+
+        cursor = special + 1;
+        switch (*special)
+        {
+        case '\t':  // tab
+        {
+            size_t needed = out_pos + tab_width + (end - cursor) + 3;
+            if (output.size() < needed)
+            {
+                output.resize(2 * needed);
+                out = output.data();
+            }
+
+            if (keep_tabs)
+            {
+                out[out_pos++] = '\t';
+                break;
+            }
+
+            size_t length = column_base + out_pos - line_start;
+            size_t spaces = tab_width - (length % tab_width);
+            std::memset(out + out_pos, ' ', spaces);
+            out_pos += spaces;
+            break;
+        }
+
+        case '\n':  // newline
+            end_line(false);
+            break;
+
+        case '\r':  // carriage return
+            if (keep_cr_lf)
+            {
+                if (cursor != end && *cursor == '\n')
+                {
+                    end_line(true);
+                    ++cursor;
+                    break;
+                }
+
+                if (cursor == end && !last)
+                {
+                    pending_cr = true;
+                    break;
+                }
+            }
+
+            out[out_pos++] = ' ';
+            break;
+
+        case '\v':  // vertical tab
+        case '\f':  // form feed
+            out[out_pos++] = ' ';
+            break;
+
+        default:
+            //  Not whitespace, so leave it be
+            out[out_pos++] = *special;
+            break;
+        }
+    }
+
+    if (!last)
+    {
+        column = column_base + out_pos - line_start;
+        size_t text_end = out_pos;
+        trim();
+        pending.assign(out + out_pos, text_end - out_pos);
+        return out_pos;
+    }
+
+    //  If the file didn't end with a line feed,
+    //  there might be one last line still pending.
+    //  It ends like the line before it, if CR-LF is allowed.
+    trim();
+    if (out_pos > line_start || column_base > 0)
+    {
+        end_line(keep_cr_lf && cr_lf);
+    }
+
+    pending.clear();
+    column = 0;
+    cr_lf = false;
+    return out_pos;
+}
+
+
+//  The longest output for one code unit, other than a tab
+constexpr size_t max_unit_output = 10;
+
+//  Encode a code point above ASCII in UTF-8
+size_t put_utf8(char* out, long code)
+{
+    if (code < 0x800)
+    {
+        out[0] = char(0xc0 | (code >> 6));
+        out[1] = char(0x80 | (code & 0x3f));
+        return 2;
+    }
+
+    if (code < 0x10000)
+    {
+        out[0] = char(0xe0 | (code >> 12));
+        out[1] = char(0x80 | ((code >> 6) & 0x3f));
+        out[2] = char(0x80 | (code & 0x3f));
+        return 3;
+    }
+
+    out[0] = char(0xf0 | (code >> 18));
+    out[1] = char(0x80 | ((code >> 12) & 0x3f));
+    out[2] = char(0x80 | ((code >> 6) & 0x3f));
+    out[3] = char(0x80 | (code & 0x3f));
+    return 4;
+}
+
+//  The same as a C and C++ universal character name
+size_t put_escape(char* out, long code)
+{
+    char text[max_unit_output + 1];
+    int size = code < 0x10000 ? std::snprintf(text, sizeof(text), "\\u%04lX", code)
+                              : std::snprintf(text, sizeof(text), "\\U%08lX", code);
+    std::memcpy(out, text, size);
+    return size;
+}
+
+}  // namespace
+
+
+namespace Fixer {
+
+size_t fix(const char* data, size_t size, int tab_width, std::vector<char>& output,
+           unsigned allowed)
+{
+    std::string pending;
+    size_t column = 0;
+    bool pending_cr = false;
+    bool cr_lf = false;
+    return fix_piece(data, size, tab_width, allowed, output, pending, column, pending_cr,
+                     cr_lf, true);
+}
+
+
+size_t fix_lines(const char* data, size_t size, int tab_width, std::vector<char>& output,
+                 unsigned allowed, bool after_cr_lf)
+{
+    std::string pending;
+    size_t column = 0;
+    bool pending_cr = false;
+    bool cr_lf = after_cr_lf;
+    return fix_piece(data, size, tab_width, allowed, output, pending, column, pending_cr,
+                     cr_lf, true);
+}
+
+
+size_t Stream::feed(const char* data, size_t size, std::vector<char>& output)
+{
+    return fix_piece(data, size, m_tab_width, m_allowed, output, m_pending, m_column,
+                     m_pending_cr, m_cr_lf, false);
+}
+
+
+size_t Stream::finish(std::vector<char>& output)
+{
+    return fix_piece(nullptr, 0, m_tab_width, m_allowed, output, m_pending, m_column,
+                     m_pending_cr, m_cr_lf, true);
+}
+
+
+size_t Utf16Stream::feed(const char* data, size_t size, std::vector<char>& output)
+{
+    return convert(data, size, output, false);
+}
+
+
+size_t Utf16Stream::finish(std::vector<char>& output)
+{
+    return convert(nullptr, 0, output, true);
+}
+
+
+//  Works like fix_piece, one code unit at a time. The column is counted
+//  in characters, not bytes, so that tabs line up in UTF-8, too.
+size_t Utf16Stream::convert(const char* data, size_t size, std::vector<char>& output, bool last)
+{
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data);
+    size_t units = size / 2;
+
+    size_t room = m_pending_spaces + 1;
+    if (output.size() < room)
+    {
+        output.resize(room);
+    }
+
+    char* out = output.data();
+    std::memset(out, ' ', m_pending_spaces);
+    size_t out_pos = m_pending_spaces;
+    size_t line_start = 0;
+    size_t column = m_column;
+
+    //  The current line had text before this piece
+    bool text_before = m_column > m_pending_spaces;
+
+    auto trim = [&]() {
+        while (out_pos > line_start && out[out_pos - 1] == ' ')
+        {
+            --out_pos;
+        }
+    };
+
+    for (size_t ix = 0; ix < units; ++ix, ptr += 2)
+    {
+        size_t needed = out_pos + max_unit_output + m_tab_width;
+        if (output.size() < needed)
+        {
+            output.resize(2 * needed + units - ix);
+            out = output.data();
+        }
+
+        long code = m_little_endian ? (ptr[0] | (ptr[1] << 8)) : ((ptr[0] << 8) | ptr[1]);
+        bool first = !m_started;
+        m_started = true;
+
+        if (m_high_surrogate)
+        {
+            if (code < 0xdc00 || code > 0xdfff)
+            {
+                m_failed = true;
+                return 0;
+            }
+
+            code = 0x10000 + ((m_high_surrogate - 0xd800) << 10) + (code - 0xdc00);
+            m_high_surrogate = 0;
+        }
+        else if (code >= 0xd800 && code <= 0xdbff)
+        {
+            m_high_surrogate = int(code);
+            continue;
+        }
+        else if (code >= 0xdc00 && code <= 0xdfff)
+        {
+            m_failed = true;
+            return 0;
+        }
+
+        switch (code)
+        {
+        case '\t':  // tab
+        {
+            size_t spaces = m_tab_width - (column % m_tab_width);
+            std::memset(out + out_pos, ' ', spaces);
+            out_pos += spaces;
+            column += spaces;
+            break;
+        }
+
+        case '\n':  // newline
+            trim();
+            out[out_pos++] = '\n';
+            line_start = out_pos;
+            column = 0;
+            text_before = false;
+            break;
+
+        case '\r':  // carriage return
+        case '\v':  // vertical tab
+        case '\f':  // form feed
+            out[out_pos++] = ' ';
+            ++column;
+            break;
+
+        case 0xfeff:  // byte order mark
+            if (first)
+            {
+                break;
+            }
+            // fall through
+
+        default:
+            if (code < 0x80)
+            {
+                out[out_pos++] = char(code);
+                ++column;
+            }
+            else if (m_non_ascii == eUTF8)
+            {
+                out_pos += put_utf8(out + out_pos, code);
+                ++column;
+            }
+            else if (m_non_ascii == eESCAPE)
+            {
+                size_t count = put_escape(out + out_pos, code);
+                out_pos += count;
+                column += count;
+            }
+            else
+            {
+                m_failed = true;
+                return 0;
+            }
+            break;
+        }
+    }
+
+    if (!last)
+    {
+        size_t text_end = out_pos;
+        trim();
+        m_pending_spaces = text_end - out_pos;
+        m_column = column;
+        return out_pos;
+    }
+
+    //  A lonely high surrogate at the very end
+    if (m_high_surrogate)
+    {
+        m_failed = true;
+        return 0;
+    }
+
+    trim();
+    if (out_pos > line_start || text_before)
+    {
+        out[out_pos++] = '\n';
+    }
+
+    m_pending_spaces = 0;
+    m_column = 0;
+    return out_pos;
+}
+
+}  // namespace Fixer
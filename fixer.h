@@ -0,0 +1,118 @@
+/*
+    Fixing whitespace issues for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Fixer {
+
+//  Expand tabs, turn all other whitespace to spaces, remove trailing
+//  spaces and carriage returns from the ends of lines, and make sure
+//  the last line ends with a line feed. With the allow_tabs and
+//  allow_cr_lf rules, those are kept as they are.
+//
+//  The fixed text replaces the contents of output, and the return value
+//  is its size. The vector is only grown, never shrunk, so the same one
+//  can be reused without new allocations.
+//
+size_t fix(const char* data, size_t size, int tab_width, std::vector<char>& output,
+           unsigned allowed = 0);
+
+//  The same for a piece of a longer text that begins at the start of a
+//  line. A piece that ends with a line feed has nothing held back, so a
+//  text split after line feeds can have its pieces fixed independently,
+//  even in parallel, and put back together in order. Only a last line
+//  without a line feed needs to know how the line before it ended, as
+//  it ends the same way if CR-LF is allowed.
+//
+size_t fix_lines(const char* data, size_t size, int tab_width, std::vector<char>& output,
+                 unsigned allowed, bool after_cr_lf);
+
+//  The same for a text that comes in pieces, so that big files can be
+//  fixed a chunk at a time. Each call gives the fixed text for the piece
+//  in output, except for whitespace that may yet turn out to be
+//  trailing. That comes out with the next piece, or is dropped by
+//  finish.
+//
+class Stream
+{
+public:
+    explicit Stream(int tab_width, unsigned allowed = 0)
+        : m_tab_width(tab_width), m_allowed(allowed)
+    {
+    }
+
+    size_t feed(const char* data, size_t size, std::vector<char>& output);
+
+    //  Whatever is left after the last piece
+    size_t finish(std::vector<char>& output);
+
+private:
+    int m_tab_width;
+    unsigned m_allowed;
+    std::string m_pending;        // Whitespace held back from the output
+    size_t m_column = 0;          // Column at the end of the last piece
+    bool m_pending_cr = false;    // Maybe a CR-LF, held back
+    bool m_cr_lf = false;         // The last line ended with one
+};
+
+//  What to do with characters outside ASCII when converting from UTF-16
+enum NonAscii {
+    eREJECT,  // Convert only files that have none
+    eUTF8,    // Keep them, encoded in UTF-8
+    eESCAPE,  // Write them as \uXXXX, or as \UXXXXXXXX above the BMP
+};
+
+//  Converts UTF-16 text to ASCII or UTF-8 while fixing it as above, in
+//  the same pass and straight into the output. A byte order mark at the
+//  beginning is dropped. Every piece except the last must have an even
+//  size.
+//
+//  The text should be valid UTF-16, and for eREJECT, plain ASCII. If it
+//  isn't, failed() turns true and the output must not be used.
+//
+class Utf16Stream
+{
+public:
+    Utf16Stream(int tab_width, bool little_endian, NonAscii non_ascii)
+        : m_tab_width(tab_width), m_little_endian(little_endian), m_non_ascii(non_ascii)
+    {
+    }
+
+    size_t feed(const char* data, size_t size, std::vector<char>& output);
+    size_t finish(std::vector<char>& output);
+
+    bool failed() const { return m_failed; }
+
+private:
+    size_t convert(const char* data, size_t size, std::vector<char>& output, bool last);
+
+    int m_tab_width;
+    bool m_little_endian;
+    NonAscii m_non_ascii;
+    bool m_started = false;
+    bool m_failed = false;
+    int m_high_surrogate = 0;     // Waiting for the low one
+    size_t m_pending_spaces = 0;  // Spaces held back from the output
+    size_t m_column = 0;          // Column at the end of the last piece
+};
+
+}  // namespace Fixer
@@ -0,0 +1,164 @@
+//  Hash functions for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t prime_1 = 0x9e3779b185ebca87ULL;
+constexpr uint64_t prime_2 = 0xc2b2ae3d27d4eb4fULL;
+
+inline uint64_t rotate(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t load64(const char* ptr)
+{
+    uint64_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+//  Spread the bits around, so that every input bit affects every output bit
+inline uint64_t finalize(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= prime_2;
+    hash ^= hash >> 29;
+    hash *= prime_1;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+//  The lanes are first set to these
+void start_lanes(uint64_t* lane)
+{
+    lane[0] = prime_1;
+    lane[1] = prime_2;
+    lane[2] = ~prime_1;
+    lane[3] = ~prime_2;
+}
+
+//  Mix in all the complete 32 byte stripes, and return the first byte
+//  that didn't fit.
+//
+//  Four independent lanes of 8 bytes each, so that the multiplies
+//  can overlap. Much the same idea as in xxHash.
+inline const char* add_stripes(uint64_t* lane, const char* ptr, const char* end)
+{
+    for (; end - ptr >= 32; ptr += 32)
+    {
+        for (int ix = 0; ix < 4; ++ix)
+        {
+            lane[ix] = rotate(lane[ix] + load64(ptr + 8 * ix) * prime_2, 31) * prime_1;
+        }
+    }
+
+    return ptr;
+}
+
+//  Combine the lanes and mix in the last partial stripe
+inline uint64_t finish_hash(const uint64_t* lane, uint64_t size, const char* ptr, const char* end)
+{
+    uint64_t hash = rotate(lane[0], 1) + rotate(lane[1], 7) + rotate(lane[2], 12) +
+                    rotate(lane[3], 18) + size;
+
+    for (; end - ptr >= 8; ptr += 8)
+    {
+        hash = rotate(hash ^ (load64(ptr) * prime_2), 27) * prime_1;
+    }
+
+    for (; ptr != end; ++ptr)
+    {
+        hash = rotate(hash ^ (uint64_t(static_cast<unsigned char>(*ptr)) * prime_1), 11) * prime_2;
+    }
+
+    return finalize(hash);
+}
+
+}  // namespace
+
+
+namespace Hash {
+
+uint64_t content(const char* data, size_t size)
+{
+    uint64_t lane[4];
+    start_lanes(lane);
+
+    const char* end = data + size;
+    const char* ptr = add_stripes(lane, data, end);
+    return finish_hash(lane, size, ptr, end);
+}
+
+
+Stream::Stream()
+{
+    start_lanes(m_lane);
+}
+
+
+void Stream::add(const char* data, size_t size)
+{
+    m_size += size;
+    const char* end = data + size;
+
+    //  First complete the stripe left over from last time
+    if (m_stripe_size > 0)
+    {
+        size_t count = std::min(size, sizeof(m_stripe) - m_stripe_size);
+        std::memcpy(m_stripe + m_stripe_size, data, count);
+        m_stripe_size += count;
+        data += count;
+        if (m_stripe_size < sizeof(m_stripe))
+        {
+            return;
+        }
+
+        add_stripes(m_lane, m_stripe, m_stripe + sizeof(m_stripe));
+        m_stripe_size = 0;
+    }
+
+    data = add_stripes(m_lane, data, end);
+    m_stripe_size = end - data;
+    std::memcpy(m_stripe, data, m_stripe_size);
+}
+
+
+uint64_t Stream::finish() const
+{
+    return finish_hash(m_lane, m_size, m_stripe, m_stripe + m_stripe_size);
+}
+
+
+uint64_t fnv1a(const char* data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t ix = 0; ix < size; ++ix)
+    {
+        hash ^= static_cast<unsigned char>(data[ix]);
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+}  // namespace Hash
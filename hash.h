@@ -0,0 +1,54 @@
+/*
+    Hash functions for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Hash {
+
+//  A fast 64-bit hash for file contents. Not cryptographic, but good
+//  enough to tell apart files that have the same size and name.
+uint64_t content(const char* data, size_t size);
+
+//  The same content hash for data that comes in pieces
+class Stream
+{
+public:
+    Stream();
+
+    void add(const char* data, size_t size);
+
+    //  The hash of everything added so far
+    uint64_t finish() const;
+
+private:
+    uint64_t m_lane[4];
+    uint64_t m_size = 0;
+
+    //  Bytes left over from the last piece, short of a full stripe
+    char m_stripe[32];
+    size_t m_stripe_size = 0;
+};
+
+//  The classic FNV-1a, for short strings. It's simple enough to give
+//  the same results on every machine and in every program.
+uint64_t fnv1a(const char* data, size_t size);
+
+}  // namespace Hash
@@ -0,0 +1,277 @@
+//  Finding where the errors are for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "locator.h"
+
+namespace {
+
+//  The same as isspace in the "C" locale
+bool is_space(unsigned char ch)
+{
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+}  // namespace
+
+
+Locator::Locator(unsigned errors, size_t max_each, unsigned allowed)
+    : m_errors(errors & locatable), m_max_each(max_each), m_utf8((allowed & allow_utf8) != 0)
+{
+}
+
+
+void Locator::feed(const char* data, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    m_empty = false;
+    m_ends_with_lf = data[size - 1] == '\n';
+
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = ptr + size;
+    for (; ptr != end; ++ptr, ++m_column)
+    {
+        unsigned char ch = *ptr;
+        if (m_tab_start && ch != '\t')
+        {
+            add(err_tabs, m_line, m_tab_start, m_column);
+            m_tab_start = 0;
+        }
+
+        //  Only a carriage return right before a line feed is a CR-LF,
+        //  any other one is unusual whitespace
+        if (m_cr_column && ch != '\n')
+        {
+            add(err_unusual_whitespace, m_line, m_cr_column, m_cr_column + 1);
+            m_cr_column = 0;
+        }
+
+        //  The bytes of a UTF-8 sequence are neither valid nor invalid
+        //  until it ends. One cut short is a single invalid character,
+        //  and the byte that cut it is then looked at as usual.
+        if (m_utf8_pending)
+        {
+            if (ch >= m_utf8_low && ch <= m_utf8_high)
+            {
+                m_utf8_low = 0x80;
+                m_utf8_high = 0xbf;
+                if (--m_utf8_pending == 0 && m_invalid_start)
+                {
+                    add(err_invalid_characters, m_line, m_invalid_start, m_utf8_start);
+                    m_invalid_start = 0;
+                }
+
+                continue;
+            }
+
+            m_utf8_pending = 0;
+            if (!m_invalid_start)
+            {
+                m_invalid_start = m_utf8_start;
+            }
+        }
+
+        if (m_utf8 && ch >= 0x80 && start_utf8(ch))
+        {
+            m_space_start = 0;
+            continue;
+        }
+
+        bool invalid = (ch < ' ' && !is_space(ch)) || ch > '~';
+        if (m_invalid_start && !invalid)
+        {
+            add(err_invalid_characters, m_line, m_invalid_start, m_column);
+            m_invalid_start = 0;
+        }
+
+        if (ch == '\n')
+        {
+            long line_end = m_column;
+            if (m_cr_column)
+            {
+                add(err_cr_lf_line_endings, m_line, m_cr_column, m_cr_column + 1);
+                line_end = m_cr_column;
+                m_cr_column = 0;
+            }
+
+            if (m_space_start && m_space_start < line_end)
+            {
+                add(err_trailing_whitespace, m_line, m_space_start, line_end);
+            }
+
+            m_space_start = 0;
+            ++m_line;
+            m_column = 0;  // Counted up to 1 for the next byte
+            continue;
+        }
+
+        if (is_space(ch))
+        {
+            if (!m_space_start)
+            {
+                m_space_start = m_column;
+            }
+        }
+        else
+        {
+            m_space_start = 0;
+        }
+
+        switch (ch)
+        {
+        case '\t':
+            if (!m_tab_start)
+            {
+                m_tab_start = m_column;
+            }
+            break;
+
+        case '\r':
+            m_cr_column = m_column;
+            break;
+
+        case '\v':
+        case '\f':
+            add(err_unusual_whitespace, m_line, m_column, m_column + 1);
+            break;
+
+        default:
+            if (invalid && !m_invalid_start)
+            {
+                m_invalid_start = m_column;
+            }
+            break;
+        }
+    }
+}
+
+
+std::vector<Locator::Location>& Locator::finish()
+{
+    end_runs();
+    if (m_cr_column)
+    {
+        add(err_unusual_whitespace, m_line, m_cr_column, m_cr_column + 1);
+        m_cr_column = 0;
+    }
+
+    //  Trailing whitespace on a last line without a line feed doesn't
+    //  count, like in the classifier. Only the missing line feed does.
+    if (!m_empty && !m_ends_with_lf)
+    {
+        add(err_no_lf_at_end, m_line, m_column, m_column);
+    }
+
+    //  The end of a line is looked at last, but may have started earlier.
+    //  So it's nearly sorted already, and a stable insertion sort does
+    //  it without the temporary buffer std::stable_sort would allocate.
+    auto before = [](const Location& a, const Location& b) {
+        return a.line < b.line || (a.line == b.line && a.column < b.column);
+    };
+
+    for (size_t i = 1; i < m_locations.size(); ++i)
+    {
+        Location location = m_locations[i];
+        size_t j = i;
+        while (j > 0 && before(location, m_locations[j - 1]))
+        {
+            m_locations[j] = m_locations[j - 1];
+            --j;
+        }
+
+        m_locations[j] = location;
+    }
+
+    return m_locations;
+}
+
+
+void Locator::add(unsigned error, long line, long column, long end_column)
+{
+    if (!(m_errors & error))
+    {
+        return;
+    }
+
+    size_t& count = m_counts[__builtin_ctz(error)];
+    if (count == m_max_each)
+    {
+        ++m_omitted;
+        return;
+    }
+
+    ++count;
+    m_locations.push_back({error, line, column, end_column});
+}
+
+
+void Locator::end_runs()
+{
+    if (m_tab_start)
+    {
+        add(err_tabs, m_line, m_tab_start, m_column);
+        m_tab_start = 0;
+    }
+
+    //  A UTF-8 sequence cut off by the end of the text
+    if (m_utf8_pending && !m_invalid_start)
+    {
+        m_invalid_start = m_utf8_start;
+    }
+
+    m_utf8_pending = 0;
+    if (m_invalid_start)
+    {
+        add(err_invalid_characters, m_line, m_invalid_start, m_column);
+        m_invalid_start = 0;
+    }
+}
+
+
+bool Locator::start_utf8(unsigned char lead)
+{
+    //  The same ranges as in the classifier, which rule out overlong
+    //  forms, surrogates, and code points above U+10FFFF
+    m_utf8_low = 0x80;
+    m_utf8_high = 0xbf;
+    if (lead >= 0xc2 && lead <= 0xdf)
+    {
+        m_utf8_pending = 1;
+    }
+    else if (lead >= 0xe0 && lead <= 0xef)
+    {
+        m_utf8_pending = 2;
+        m_utf8_low = (lead == 0xe0) ? 0xa0 : 0x80;
+        m_utf8_high = (lead == 0xed) ? 0x9f : 0xbf;
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4)
+    {
+        m_utf8_pending = 3;
+        m_utf8_low = (lead == 0xf0) ? 0x90 : 0x80;
+        m_utf8_high = (lead == 0xf4) ? 0x8f : 0xbf;
+    }
+    else
+    {
+        return false;
+    }
+
+    m_utf8_start = m_column;
+    return true;
+}
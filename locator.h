@@ -0,0 +1,100 @@
+/*
+    Finding where the errors are for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "classifier.h"
+
+#include <cstddef>
+#include <vector>
+
+//  The classifier only tells what kinds of errors a file has, as fast as
+//  it can. Once it has found some, this goes through the text again, a
+//  byte at a time, and finds the lines and columns of the errors the
+//  same way the classifier would see them.
+//
+//  Only the first few of each kind are kept, so that a file full of tabs
+//  won't produce a million locations. The text may come in pieces.
+//
+class Locator
+{
+public:
+    struct Location
+    {
+        unsigned error;   // One of the error bits
+        long line;        // Starting from 1
+        long column;      // In bytes, starting from 1
+        long end_column;  // Just past the end, the same as column if empty
+    };
+
+    //  The error bits that have locations
+    static constexpr unsigned locatable = err_tabs | err_unusual_whitespace |
+                                          err_trailing_whitespace | err_cr_lf_line_endings |
+                                          err_no_lf_at_end | err_invalid_characters;
+
+    //  Find the errors given, but at most max_each of each kind. With
+    //  allow_utf8, only the bytes from 0x80 up that don't make valid
+    //  UTF-8 are located as invalid characters, as the classifier sees
+    //  them.
+    Locator(unsigned errors, size_t max_each, unsigned allowed = 0);
+
+    //  Keep the locations in the storage given, instead of allocating.
+    //  Call before anything is fed.
+    void reuse(std::vector<Location>& storage)
+    {
+        storage.clear();
+        m_locations.swap(storage);
+    }
+
+    void feed(const char* data, size_t size);
+
+    //  Returns the locations found, in the order of the text
+    std::vector<Location>& finish();
+
+    //  How many more there were than were kept
+    long omitted() const { return m_omitted; }
+
+private:
+    void add(unsigned error, long line, long column, long end_column);
+    void end_runs();
+    bool start_utf8(unsigned char lead);
+
+    unsigned m_errors;
+    size_t m_max_each;
+    bool m_utf8;
+    std::vector<Location> m_locations;
+    size_t m_counts[16] = {};
+    long m_omitted = 0;
+
+    long m_line = 1;
+    long m_column = 1;  // Of the next byte
+    bool m_empty = true;
+    bool m_ends_with_lf = false;
+
+    //  Where the runs now going on started, zero if none
+    long m_space_start = 0;    // Of any whitespace, maybe trailing
+    long m_tab_start = 0;
+    long m_invalid_start = 0;
+    long m_cr_column = 0;      // A carriage return just before, maybe a CR-LF
+
+    //  A UTF-8 sequence going on, not yet known to be valid
+    long m_utf8_start = 0;
+    int m_utf8_pending = 0;            // Continuation bytes still expected
+    unsigned char m_utf8_low = 0x80;   // The range of the next one
+    unsigned char m_utf8_high = 0xbf;
+};
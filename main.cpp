@@ -15,12 +15,16 @@
 //  You should have received a copy of the GNU General Public License
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include "buffer_pool.h"
 #include "file_scanner.h"
 #include "options.h"
+#include "stats.h"
 
 #include <iostream>
 #include <string>
 
+#include <malloc.h>
+
 //  If build system doesn't provide a timestamp, use this instead
 #ifndef BUILD_DATETIME
 #define BUILD_DATETIME __DATE__ " " __TIME__
@@ -73,11 +77,52 @@ int main(int argc, char** argv)
         break;
     }
 
+    if (options.stats())
+    {
+        Stats::enable();
+    }
+
+#ifdef M_MMAP_THRESHOLD
+    //  Buffers too big for the pools come straight from mmap, and go
+    //  back to the system when freed, instead of staying in the heap
+    mallopt(M_MMAP_THRESHOLD, int(BufferPool::max_pooled));
+#endif
+
+    //  Just the one input to fix, and nothing else to do
+    if (options.filter())
+    {
+        int first = options.first_argument();
+        bool ok = FileScanner::filter(first < argc ? argv[first] : nullptr);
+        ok = FileScanner::finish() && ok;
+        Stats::print(std::cerr);
+        return ok ? 0 : 2;
+    }
+
     err = 0;
-    for (int arg_ix = options.first_argument(); arg_ix < argc; ++arg_ix)
+    if (options.watch() && !FileScanner::start_watching())
+    {
+        err = 2;
+    }
+
+    if (!err && !options.files_from().empty())
+    {
+        if (!FileScanner::process_list(options.files_from().c_str()))
+        {
+            err = 2;
+        }
+    }
+
+    for (int arg_ix = options.first_argument(); !err && arg_ix < argc; ++arg_ix)
     {
+        //  One file with errors is enough
+        if (options.fail_fast() && FileScanner::found_errors())
+        {
+            break;
+        }
+
         const char* arg = argv[arg_ix];
-        bool ok = FileScanner::process(arg);
+        bool ok = options.merge_reports() ? FileScanner::merge_report(arg)
+                                          : FileScanner::process(arg);
 
         //  Stop at the first serious error
         if (!ok)
@@ -87,5 +132,23 @@ int main(int argc, char** argv)
         }
     }
 
+    if (!err && options.watch() && !FileScanner::watch())
+    {
+        err = 2;
+    }
+
+    if (!FileScanner::finish())
+    {
+        err = 2;
+    }
+
+    Stats::print(std::cerr);
+
+    //  The check mode tells about the errors only by this
+    if (!err && options.check() && FileScanner::found_errors())
+    {
+        err = 3;
+    }
+
     return err;
 }
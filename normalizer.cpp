@@ -16,418 +16,926 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "normalizer.h"
+#include "classifier.h"
+#include "differ.h"
+#include "fixer.h"
+#include "hash.h"
+#include "locator.h"
+#include "sniffer.h"
+#include "splitter.h"
+#include "stats.h"
 #include "utf16checker.h"
 
+#include <algorithm>
 #include <cctype>
-#include <cstdio>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
-#include <fstream>
-#include <iostream>
-
-namespace {
-
-//  Error bits
-enum {
-    //  Fixable errors
-    err_tabs = 0x0001,                 // Tabs
-    err_unusual_whitespace = 0x0002,   // '\v', '\f', etc...
-    err_trailing_whitespace = 0x0004,  // Lines with whitespace at end
-    err_cr_lf_line_endings = 0x0008,   // Windows "\r\n" line endings
-    err_no_lf_at_end = 0x0010,         // No '\n' at end of file
-    err_fixable = 0x00ff,
-    //
-    //  Hopeless errors
-    err_invalid_encoding = 0x0100,    // Possibly UTF-16
-    err_invalid_characters = 0x0200,  // Strange characters
-    err_not_a_text_file = 0x0400,     // Not a text file
-    err_hopeless = 0xff00,
-};
-
-bool is_fixable(unsigned errors)
+#include <limits>
+
+#include <unistd.h>
+
+void Normalizer::normalize(const char* path, int tabsize, bool fix, const ScanCache::Entry* previous)
 {
-    //  Can't fix if any hopeless errors
-    if ((errors & err_hopeless) != 0)
+    if (!Stats::enabled())
     {
-        return false;
+        normalize_file(path, tabsize, fix, previous);
     }
-
-    //  Must have at least one fixable error
-    if ((errors & err_fixable) != 0)
+    else
     {
-        return true;
+        auto start = std::chrono::steady_clock::now();
+        normalize_file(path, tabsize, fix, previous);
+        if (m_seen_file)
+        {
+            Stats::add(Stats::files_seen);
+            Stats::count_errors(m_errors);
+        }
+        else if (m_loaded)
+        {
+            Stats::add(m_seen_content ? Stats::files_seen : Stats::files_examined);
+            Stats::add(Stats::bytes_read, m_sniffed ? Sniffer::sample_size : m_file.file_size());
+            Stats::add(Stats::files_fixed, m_fixed);
+            Stats::count_errors(m_errors);
+            Stats::note_file(m_full_name, m_file.file_size(),
+                             std::chrono::steady_clock::now() - start);
+        }
     }
 
-    return false;
+    //  Done with the contents, so the buffers can serve the next file
+    m_file.release();
+    m_pool.give(m_output);
 }
 
-unsigned classify_errors(const char* data, int size)
+
+void Normalizer::normalize_file(const char* path, int tabsize, bool fix,
+                                const ScanCache::Entry* previous)
 {
-    unsigned errors = 0;
-    int unusual_whitespace = 0;
+    normalize_contents(path, tabsize, fix, previous);
+    if (m_truncated)
+    {
+        //  Changed while it was mapped, so read what there is now instead
+        m_file.release();
+        m_file.set_mapping(false);
+        normalize_contents(path, tabsize, fix, previous);
+        m_file.set_mapping(true);
+    }
+}
 
-    //  An arbitrary character that isn't regarded as whitespace
-    constexpr int not_a_space = 0;
 
-    int current = not_a_space;
-    int penultimate = not_a_space;
-    int antepenultimate = not_a_space;
-    int last_character = not_a_space;
+void Normalizer::normalize_contents(const char* path, int tabsize, bool fix,
+                                    const ScanCache::Entry* previous)
+{
+    clear_results();
+    m_loaded = load_file(path, fix);
+    if (!m_loaded)
+    {
+        return;
+    }
 
-    //  The last character should be a line feed.
-    if (size > 0 && data[size - 1] != '\n')
+    if (m_seen_file)
     {
-        errors |= err_no_lf_at_end;
+        //  Examined already through another link
+        take_findings(m_found);
+        m_loaded = false;
+        return;
     }
 
-    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data);
-    while (size--)
+    if (m_sniffed)
     {
-        current = *ptr++;
+        //  Rejected without loading
+        m_errors = err_not_a_text_file;
+        remember_findings();
+        return;
+    }
 
-        //  Examine the character more closely if it's outside printable range
-        if (current < ' ' || current > '~')
+    if (m_file.is_streamed())
+    {
+        m_loaded = find_stream_errors(previous);
+        if (!m_loaded)
         {
-            switch (current)
-            {
-            case '\n':  //  Line feed (newline)
-                last_character = penultimate;
-                if (penultimate == '\r')
-                {
-                    //  Found a CR-LF pair "\r\n"
-                    errors |= err_cr_lf_line_endings;
-
-                    //  Adjust the last character on the line
-                    last_character = antepenultimate;
-
-                    //  The carriage return has already been counted as
-                    //  unusual whitespace, so have to adjust the count.
-                    //  Only free standing carriage returns are counted as
-                    //  whitespace.
-                    --unusual_whitespace;
-
-                    //  Make sure the carriage return won't be counted as a
-                    //  trailing space
-                    penultimate = not_a_space;
-                }
-                if (isspace(last_character))
-                {
-                    errors |= err_trailing_whitespace;
-                }
-                //  Make sure this line feed won't be counted as a trailing
-                //  space
-                current = not_a_space;
-                break;
+            return;
+        }
+    }
+    else
+    {
+        if (m_hashing)
+        {
+            m_content_hash = Hash::content(data(), m_file.size());
+        }
 
-            case '\t':  //  horizontal tab
-                errors |= err_tabs;
-                break;
+        //  Same contents as last time, so the same errors too
+        if (m_hashing && previous && previous->content_hash == m_content_hash &&
+            previous->size == m_file.size() && previous->allowed == m_allowed)
+        {
+            m_errors = previous->errors;
+        }
+        else if (m_hashing && m_seen && m_seen->find(m_content_hash, m_file.size(), m_found) &&
+                 m_found.allowed == m_allowed)
+        {
+            //  A copy of a file already examined
+            take_findings(m_found);
+            m_seen_content = true;
+        }
+        else
+        {
+            find_errors();
+        }
+    }
 
-            case '\r':  //  carriage return
-            case '\v':  //  vertical tab
-            case '\f':  //  form feed
-                ++unusual_whitespace;
-                break;
+    if (m_errors != 0 && m_max_locations > 0 && !m_seen_content)
+    {
+        locate_errors();
+    }
+
+    //  Part of what was read was zeros instead of the contents
+    if (m_file.was_truncated())
+    {
+        m_truncated = true;
+        return;
+    }
+
+    remember_findings();
+    if (m_errors == 0)
+    {
+        return;  //  No errors found
+    }
+
+    if (fix && is_fixable(m_errors))
+    {
+        bool written;
+        if (m_errors & err_utf16_encoding)
+        {
+            written = convert_the_file(tabsize);
+        }
+        else
+        {
+            written = m_file.is_streamed() ? fix_the_stream(tabsize) : fix_the_file(tabsize);
+        }
+
+        if (written && m_file.was_truncated())
+        {
+            m_truncated = true;
+            written = false;
+        }
+
+        if (written)
+        {
+            Stats::Timer timer(Stats::phase_rename);
+            m_fixed = m_writer.commit();
+        }
+
+        if (!m_fixed && !m_writer.error().empty())
+        {
+            m_report += m_writer.error();
+            m_report += '\n';
+        }
+
+        m_writer.discard();
+    }
+    else if (m_diff && is_fixable(m_errors) && !(m_errors & err_utf16_encoding) &&
+             !m_file.is_streamed())
+    {
+        make_diff(tabsize);
+        m_truncated = m_file.was_truncated();
+    }
+}
+
+
+void Normalizer::clear_results()
+{
+    m_errors = 0;
+    m_content_hash = 0;
+    m_loaded = false;
+    m_fixed = false;
+    m_invalid_count = 0;
+    m_non_ascii_count = 0;
+    m_locations.clear();
+    m_omitted_locations = 0;
+    m_full_name.clear();
+    m_report.clear();
+    m_seen_file = false;
+    m_seen_content = false;
+    m_partial = false;
+    m_truncated = false;
+    m_diff_text.clear();
+}
+
+
+void Normalizer::report_known(const char* path, unsigned errors)
+{
+    m_errors = errors;
+    m_loaded = false;
+    m_fixed = false;
+    m_has_preloaded = false;
+    m_invalid_count = 0;
+    m_non_ascii_count = 0;
+    m_locations.clear();
+    m_omitted_locations = 0;
+    m_full_name = path;
+    m_report.clear();
+
+    Stats::add(Stats::files_known);
+    Stats::count_errors(m_errors);
+}
+
+
+void Normalizer::normalize_stream(const char* name, const Reader& read)
+{
+    clear_results();
+    m_full_name = name;
+    m_loaded = true;
+
+    Classifier::State state;
+    state.allowed = m_allowed;
+    Hash::Stream hash;
+    take_output(FileLoader::chunk_size);
+    uint64_t total = 0;
+    bool is_elf = false;
+    for (;;)
+    {
+        long size;
+        {
+            Stats::Timer timer(Stats::phase_load);
+            size = read(m_output.data(), FileLoader::chunk_size);
+        }
+
+        if (size <= 0)
+        {
+            m_loaded = size == 0;
+            break;
+        }
 
-            default:
-                errors |= err_invalid_characters;
+        if (total == 0)
+        {
+            is_elf = Sniffer::is_elf(m_output.data(), size_t(size), size_t(size));
+        }
+
+        total += uint64_t(size);
+        Stats::Timer timer(Stats::phase_classify);
+        if (m_check_only)
+        {
+            //  The rest won't change the answer
+            m_errors = Classifier::feed_until_error(state, m_output.data(), size_t(size));
+            if (m_errors)
+            {
+                m_partial = true;
                 break;
             }
         }
+        else
+        {
+            Classifier::feed(state, m_output.data(), size_t(size));
+        }
 
-        antepenultimate = penultimate;
-        penultimate = current;
+        if (m_hashing)
+        {
+            hash.add(m_output.data(), size_t(size));
+        }
     }
 
-    if (unusual_whitespace)
+    if (m_loaded && !m_partial)
     {
-        errors |= err_unusual_whitespace;
+        m_content_hash = m_hashing ? hash.finish() : 0;
+        m_errors = Classifier::errors(state);
+        m_invalid_count = state.invalid_count;
+
+        //  There's no reading it again to look for UTF-16, but binary
+        //  contents can be told the same way as from a file
+        if ((m_errors & err_invalid_characters) &&
+            (is_elf || Sniffer::is_mostly_invalid(m_invalid_count, total)))
+        {
+            m_errors = err_not_a_text_file;
+        }
+    }
+
+    if (m_loaded)
+    {
+        Stats::add(Stats::files_examined);
+        Stats::add(Stats::bytes_read, total);
+        Stats::count_errors(m_errors);
     }
 
-    return errors;
+    m_pool.give(m_output);
 }
 
-//  Add an "and" if needed to make the message nicer
-void beautify_message(std::string& text)
+
+bool Normalizer::filter(int in_fd, int out_fd, const char* name, int tabsize)
 {
-    auto pos = text.rfind(',');
-    if (pos != std::string::npos)
+    clear_results();
+    m_full_name = name;
+    m_loaded = true;
+
+    std::vector<char> buffer;
+    if (!read_input(in_fd, buffer, m_stream_threshold))
+    {
+        m_report += "Could not read the contents of ";
+        m_report += m_full_name;
+        m_report += ": ";
+        m_report += std::strerror(errno);
+        m_report += '\n';
+        return false;
+    }
+
+    m_out_fd = out_fd;
+    m_output_failed = false;
+    bool ok;
+    if (m_stream_threshold > 0 && buffer.size() > m_stream_threshold)
     {
-        text.insert(pos + 1, " and");
+        ok = filter_stream(in_fd, buffer, tabsize);
+    }
+    else
+    {
+        Stats::add(Stats::bytes_read, buffer.size());
+        m_file.adopt(buffer);
+        find_errors();
+        ok = false;
+        if (is_fixable(m_errors))
+        {
+            ok = (m_errors & err_utf16_encoding) ? convert_the_file(tabsize)
+                                                 : fix_the_file(tabsize);
+            m_fixed = ok;
+        }
+
+        //  Anything that can't be fixed goes through as it was
+        if (!ok && !m_output_failed)
+        {
+            ok = write_output(data(), m_file.size());
+        }
     }
+
+    m_out_fd = -1;
+    Stats::add(Stats::files_examined);
+    Stats::add(Stats::files_fixed, m_fixed);
+    Stats::count_errors(m_errors);
+
+    m_file.release();
+    m_pool.give(m_output);
+    return ok;
 }
 
 
-//  Trim trailing spaces from a line of text
-void trim(std::string& text)
+bool Normalizer::filter_stream(int in_fd, std::vector<char>& buffer, int tab_width)
 {
-    while (!text.empty() && text.back() == ' ')
+    //  What's written can't be taken back, so the beginning decides
+    //  whether the contents are text to fix, or something to leave alone
+    Classifier::State state;
+    state.allowed = m_allowed;
+    Classifier::feed(state, buffer.data(), buffer.size());
+    bool fixing = (Classifier::errors(state) & err_hopeless) == 0;
+
+    Stats::Timer timer(Stats::phase_fix);
+    Fixer::Stream fixer(tab_width, m_allowed);
+    take_output(FileLoader::chunk_size + 1);
+    size_t size = buffer.size();
+    bool ok = true;
+    while (ok && size > 0)
     {
-        text.resize(text.size() - 1);
+        Stats::add(Stats::bytes_read, size);
+        if (fixing)
+        {
+            size_t fixed_size = fixer.feed(buffer.data(), size, m_output);
+            ok = write_output(m_output.data(), fixed_size);
+            Stats::add(Stats::bytes_written, fixed_size);
+        }
+        else
+        {
+            ok = write_output(buffer.data(), size);
+        }
+
+        if (!ok)
+        {
+            break;
+        }
+
+        //  The rest a chunk at a time, in the same buffer
+        buffer.resize(FileLoader::chunk_size);
+        ssize_t count;
+        do
+        {
+            count = ::read(in_fd, buffer.data(), buffer.size());
+        } while (count < 0 && errno == EINTR);
+
+        if (count < 0)
+        {
+            m_report += "Could not read the contents of ";
+            m_report += m_full_name;
+            m_report += ": ";
+            m_report += std::strerror(errno);
+            m_report += '\n';
+            return false;
+        }
+
+        size = size_t(count);
+        Classifier::feed(state, buffer.data(), size);
     }
-}
 
+    if (ok && fixing)
+    {
+        size_t fixed_size = fixer.finish(m_output);
+        ok = write_output(m_output.data(), fixed_size);
+        Stats::add(Stats::bytes_written, fixed_size);
+    }
 
-void append_tab_as_spaces(std::string& text, int tab_width)
-{
-    int length = int(text.size());
-    int tabbed_length = tab_width * ((length + tab_width) / tab_width);
-    int count = tabbed_length - length;
-    text.append(count, ' ');
+    m_errors = Classifier::errors(state);
+    m_invalid_count = state.invalid_count;
+    m_fixed = ok && fixing && (m_errors & err_fixable) != 0;
+    if (m_fixed && (m_errors & err_hopeless))
+    {
+        m_report += "Only the whitespace was fixed in ";
+        m_report += m_full_name;
+        m_report += ", the rest came too late to leave it all as it was\n";
+    }
+
+    return ok;
 }
 
-bool rename_file(const std::string& old_name, const std::string& new_name)
+
+bool Normalizer::read_input(int fd, std::vector<char>& buffer, size_t limit)
 {
-    int err = std::rename(old_name.c_str(), new_name.c_str());
-    if (!err)
+    size_t size = 0;
+    while (limit == 0 || size <= limit)
     {
-        return true;
+        if (buffer.size() - size < FileLoader::chunk_size)
+        {
+            buffer.resize(size + FileLoader::chunk_size);
+        }
+
+        ssize_t count = ::read(fd, buffer.data() + size, buffer.size() - size);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        size += size_t(count);
     }
 
-    std::string msg = "Could not rename ";
-    msg += old_name;
-    msg += " to ";
-    msg += new_name;
+    buffer.resize(size);
+    return true;
+}
 
-    std::perror(msg.c_str());
 
-    return false;
+bool Normalizer::open_output()
+{
+    return m_out_fd >= 0 || m_writer.open(m_full_name);
 }
 
-}  //  namespace
+
+bool Normalizer::write_output(const char* data, size_t size)
+{
+    if (m_out_fd < 0)
+    {
+        return m_writer.write(data, size);
+    }
+
+    if (!FileWriter::write_all(m_out_fd, data, size))
+    {
+        m_report += "Could not write the fixed contents of ";
+        m_report += m_full_name;
+        m_report += ": ";
+        m_report += std::strerror(errno);
+        m_report += '\n';
+        m_output_failed = true;
+        return false;
+    }
+
+    return true;
+}
 
 
-void Normalizer::normalize(const char* path, int tabsize, bool fix)
+bool Normalizer::load_file(const char* path, bool fix)
 {
-    m_errors = 0;
-    m_full_name.clear();
-    m_error_message.clear();
-    m_data.clear();
-    m_data.reserve(64 * 1024);
+    Stats::Timer timer(Stats::phase_load);
+    m_full_name = path;
+    m_sniffed = false;
+    if (m_has_preloaded)
+    {
+        m_has_preloaded = false;
+        m_file.adopt(m_preloaded, m_has_preloaded_info ? &m_preloaded_info : nullptr);
+        m_seen_file = is_seen_file(fix);
+        return true;
+    }
 
-    if (!load_file(path))
+    if (!m_file.open(path))
     {
-        return;
+        return false;
     }
 
-    if (!find_errors())
+    if (is_seen_file(fix))
     {
-        return;  //  No errors found
+        m_seen_file = true;
+        return true;
     }
 
-    if (fix && is_fixable(m_errors))
+    //  Have a quick look at the beginning of a big file,
+    //  there's no need to load it if it's obviously binary.
+    if (m_file.file_size() >= Sniffer::min_file_size)
     {
-        if (fix_the_file(tabsize))
+        size_t size = Sniffer::sample_size;
+        const char* sample = m_file.head(size);
+        if (sample && Sniffer::sniff(sample, size, m_file.file_size()) == Sniffer::eBINARY)
         {
-            //  Rename the original to backup
-            std::string backup = m_full_name + ".bak~";
-            std::remove(backup.c_str());
-            if (rename_file(m_full_name, backup))
-            {
-                //  Rename the temporary to the original
-                rename_file(m_temp_name, m_full_name);
-            }
+            Stats::add(Stats::files_sniffed);
+            m_sniffed = true;
+            return true;
         }
     }
+
+    return m_file.load();
 }
 
 
-bool Normalizer::load_file(const char* path)
+bool Normalizer::is_seen_file(bool fix)
 {
-    m_full_name = path;
+    //  A file to fix must be written through its own path anyway
+    return m_seen && m_file.has_info() && m_seen->find(m_file.info(), m_found) &&
+           m_found.allowed == m_allowed &&
+           !(fix && is_fixable(m_found.errors));
+}
+
 
-    std::ifstream input(m_full_name, std::ifstream::binary | std::ifstream::ate);
-    if (!input)
+void Normalizer::take_findings(SeenFiles::Findings& findings)
+{
+    m_errors = findings.errors;
+    m_invalid_count = findings.invalid_count;
+    m_non_ascii_count = findings.non_ascii_count;
+    m_locations.swap(findings.locations);
+    m_omitted_locations = findings.omitted_locations;
+}
+
+
+void Normalizer::remember_findings()
+{
+    if (m_partial)
     {
-        return false;
+        return;
     }
 
-    m_data.reserve(input.tellg());
+    bool by_inode = m_seen && m_file.has_info() && m_seen->remembers(m_file.info());
+    bool by_content = m_seen && m_seen->by_content() && m_hashing && !m_seen_content;
+    if (!by_inode && !by_content)
+    {
+        return;
+    }
 
-    input.seekg(0);
-    m_data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    m_found.allowed = m_allowed;
+    m_found.errors = m_errors;
+    m_found.invalid_count = m_invalid_count;
+    m_found.non_ascii_count = m_non_ascii_count;
+    m_found.locations = m_locations;
+    m_found.omitted_locations = m_omitted_locations;
+    if (by_inode)
+    {
+        m_seen->add(m_file.info(), m_found);
+    }
 
-    return true;
+    //  The hash is there only for files loaded whole or streamed
+    if (by_content && !m_sniffed)
+    {
+        m_seen->add(m_content_hash, m_file.file_size(), m_found);
+    }
 }
 
 
-bool Normalizer::find_errors()
+void Normalizer::find_errors()
 {
-    m_errors = classify_errors(m_data.data(), data_size());
-    if (m_errors == 0)
+    if (m_check_only)
     {
-        //  Return false if no errors found
-        return false;
+        Stats::Timer timer(Stats::phase_classify);
+        m_errors = Classifier::first_error(data(), m_file.size(), m_allowed);
+        m_partial = m_errors != 0;
+        return;
     }
 
-    if (m_errors & err_invalid_characters)
     {
-        int type = classify_invalid();
-        switch (type)
+        Stats::Timer timer(Stats::phase_classify);
+        Classifier::State state;
+        state.allowed = m_allowed;
+        if (is_split())
         {
-        case eBINARY:
-            m_errors = err_not_a_text_file;
-            add_error_message("binary data. Probably not a text file.");
-            break;
+            state = Splitter::classify(data(), m_file.size(), m_allowed, *m_split_workers);
+        }
+        else
+        {
+            Classifier::feed(state, data(), m_file.size());
+        }
 
-        case eUTF16:
-            m_errors = err_invalid_encoding;
-            add_error_message("invalid encoding. Possibly UTF-16");
-            break;
+        m_errors = Classifier::errors(state);
+        m_invalid_count = state.invalid_count;
+    }
 
-        default:
-            break;
+    explain_invalid();
+}
+
+
+bool Normalizer::find_stream_errors(const ScanCache::Entry* previous)
+{
+    Classifier::State state;
+    state.allowed = m_allowed;
+    Hash::Stream hash;
+    for (;;)
+    {
+        {
+            Stats::Timer timer(Stats::phase_load);
+            if (!m_file.next_chunk())
+            {
+                break;
+            }
+        }
+
+        Stats::Timer timer(Stats::phase_classify);
+        if (m_check_only)
+        {
+            //  The rest of the file won't change the answer
+            m_errors = Classifier::feed_until_error(state, data(), m_file.size());
+            if (m_errors)
+            {
+                m_partial = true;
+                return true;
+            }
+        }
+        else
+        {
+            Classifier::feed(state, data(), m_file.size());
+        }
+
+        if (m_hashing)
+        {
+            hash.add(data(), m_file.size());
         }
     }
 
-    if (m_errors & err_invalid_characters)
+    if (m_file.read_failed())
     {
-        add_error_message("invalid characters");
+        return false;
     }
 
-    if (m_errors & err_tabs)
+    if (m_hashing)
     {
-        add_error_message("tabs");
+        m_content_hash = hash.finish();
     }
 
-    if (m_errors & err_unusual_whitespace)
+    //  Same contents as last time, so the same errors too
+    if (m_hashing && previous && previous->content_hash == m_content_hash &&
+        previous->size == m_file.file_size() && previous->allowed == m_allowed)
     {
-        add_error_message("unusual whitespace");
+        m_errors = previous->errors;
+        return true;
     }
 
-    if (m_errors & err_trailing_whitespace)
+    m_errors = Classifier::errors(state);
+    m_invalid_count = state.invalid_count;
+    explain_invalid();
+    return true;
+}
+
+
+void Normalizer::explain_invalid()
+{
+    if (m_errors & err_invalid_characters)
     {
-        add_error_message("trailing whitespace");
+        int type = classify_invalid();
+        m_errors = Sniffer::explained_errors(m_errors, type, m_non_ascii, m_non_ascii_count);
+
+        //  Counted only in case it turned out to be UTF-16
+        if (type != Sniffer::eUTF16)
+        {
+            m_non_ascii_count = 0;
+        }
     }
+}
+
 
-    if (m_errors & err_cr_lf_line_endings)
+void Normalizer::locate_errors()
+{
+    //  The bytes don't mean much if it's not really text
+    unsigned errors = m_errors & Locator::locatable;
+    if (errors == 0 || (m_errors & (err_utf16_encoding | err_invalid_encoding | err_not_a_text_file)))
     {
-        add_error_message("CR-LF line endings");
+        return;
     }
 
-    if (m_errors & err_no_lf_at_end)
+    Stats::Timer timer(Stats::phase_locate);
+    if (m_file.is_streamed() && !(m_file.rewind() && m_file.next_chunk()))
     {
-        add_error_message("no line feed at end");
+        return;
     }
 
-    beautify_message(m_error_message);
-    std::cerr << "File: " << m_full_name << " has " << m_error_message << '\n';
+    Locator locator(errors, m_max_locations, m_allowed);
+    locator.reuse(m_locations);
+    do
+    {
+        locator.feed(data(), m_file.size());
+    } while (m_file.is_streamed() && m_file.next_chunk());
 
-    return true;
+    m_locations.swap(locator.finish());
+    m_omitted_locations = locator.omitted();
 }
 
 
 //  Try to figure out what's up with the invalid characters
-int Normalizer::classify_invalid() const
+int Normalizer::classify_invalid()
 {
-    int size = data_size();
+    Stats::Timer timer(Stats::phase_classify_invalid);
 
-    // clang-format off
-    // ELF binaries begin with "\x7fELF" and the ELF header is at least 52 bytes long.
-    if (size > 50 && std::memcmp(m_data.data(), "\x7f" "ELF", 4) == 0)
+    //  A streamed file is read again, this time a chunk at a time
+    bool streamed = m_file.is_streamed();
+    if (streamed && !(m_file.rewind() && m_file.next_chunk()))
     {
-        return true;
+        return Sniffer::eUNSURE;
+    }
+
+    size_t size = m_file.file_size();
+    if (!streamed)
+    {
+        size = m_file.size();
     }
-    // clang-format on
 
-    //  Files coming from Windows may have UTF-16 encoding.
+    return Sniffer::explain_invalid(data(), m_file.size(), size, m_invalid_count,
+                                    [this]() { return is_utf16(); });
+}
+
+
+bool Normalizer::is_utf16()
+{
     Utf16Checker utf16;
-    int err = utf16.check(m_data.data(), size);
-    if (err == Utf16Checker::eOK)
+    utf16.start();
+    do
     {
-        auto& counts = utf16.counts();
+        utf16.feed(data(), m_file.size());
+    } while (m_file.is_streamed() && !utf16.failed() && m_file.next_chunk());
 
-        //  Don't accept any weird characters in the ASCII range, and
-        //  allow only about 5% non-ascii characters.
-        int non_ascii = counts.total_characters - counts.normal_ascii;
-        if (counts.weird_ascii == 0 && 20*non_ascii < counts.total_characters)
-        {
-            return eUTF16;
-        }
+    return utf16.finish() == Utf16Checker::eOK && Sniffer::is_utf16_text(utf16, m_non_ascii_count);
+}
+
+
+void Normalizer::take_output(size_t size)
+{
+    if (m_output.size() < size)
+    {
+        m_pool.give(m_output);
+        m_output = m_pool.take(size);
     }
+}
 
-    int normal = 0;
-    int weird = 0;
-    for (int ix = 0; ix < size; ++ix)
+
+void Normalizer::make_diff(int tab_width)
+{
+    Stats::Timer timer(Stats::phase_fix);
+    size_t size = fix_contents(tab_width);
+
+    //  Every error the fixer fixes is on a line of its own, so the
+    //  lines with them are the lines that change
+    Locator locator(m_errors & err_fixable & Locator::locatable,
+                    std::numeric_limits<size_t>::max(), m_allowed);
+    locator.reuse(m_changes);
+    locator.feed(data(), m_file.size());
+    m_changes.swap(locator.finish());
+
+    m_changed_lines.clear();
+    for (const auto& change : m_changes)
     {
-        int ch = m_data[ix];
-        if (isprint(ch) || isspace(ch))
-            normal++;
-        else
-            weird++;
+        m_changed_lines.push_back(change.line);
     }
 
-    //  Plenty of weird characters would suggest a binary file
-    if (5*weird > normal)
+    Differ::unified(data(), m_file.size(), m_output.data(), size, m_changed_lines, m_full_name,
+                    m_diff_text);
+}
+
+
+//  Fix the fixable issues
+size_t Normalizer::fix_contents(int tab_width)
+{
+    take_output(m_file.size() + 1);
+    return Fixer::fix(data(), m_file.size(), tab_width, m_output, m_allowed);
+}
+
+
+bool Normalizer::fix_the_file(int tab_width)
+{
+    Stats::Timer timer(Stats::phase_fix);
+    if (is_split())
     {
-        return eBINARY;
+        return fix_the_pieces(tab_width);
     }
 
-    return eDONT_KNOW;
+    size_t size = fix_contents(tab_width);
+    Stats::add(Stats::bytes_written, size);
+
+    //  Write fixed output to a new file, not yet in place
+    return open_output() && write_output(m_output.data(), size);
 }
 
 
-void Normalizer::add_error_message(const char* text)
+//  Each piece is fixed into a buffer of its own, so the fixed text is
+//  never copied, and it takes no more memory than the one output would
+bool Normalizer::fix_the_pieces(int tab_width)
 {
-    if (!m_error_message.empty())
+    Splitter::fix(data(), m_file.size(), tab_width, m_allowed, *m_split_workers, m_pool,
+                  m_pieces);
+
+    bool ok = open_output();
+    for (auto& piece : m_pieces)
     {
-        m_error_message += ", ";
+        ok = ok && write_output(piece.buffer.data(), piece.size);
+        Stats::add(Stats::bytes_written, piece.size);
+        m_pool.give(piece.buffer);
     }
 
-    m_error_message += text;
+    m_pieces.clear();
+    return ok;
 }
 
 
-//  Fix the fixable issues
-bool Normalizer::fix_the_file(int tab_width)
+//  Fix a streamed file a chunk at a time
+bool Normalizer::fix_the_stream(int tab_width)
 {
-    //  Write fixed output to a temporary file
-    m_temp_name = m_full_name;
-    m_temp_name += ".tmp~";
-    std::ofstream output(m_temp_name, std::ofstream::binary | std::ofstream::trunc);
-    std::string line;
+    Stats::Timer timer(Stats::phase_fix);
+    if (!m_file.rewind())
+    {
+        return false;
+    }
 
-    const char* cursor = m_data.data();
-    const char* end = cursor + data_size();
-    while (cursor != end)
+    if (!m_writer.open(m_full_name))
     {
-        int ch = *cursor++;
-        if (!std::isspace(ch))
-        {
-            line += char(ch);
-            continue;
-        }
+        return false;
+    }
 
-        //  Found some sort of whitespace.
-        //  Tab and line feed need special treatment, all the rest are
-        //  replaced by ordinary old fashioned space characters ' '.
-        switch (ch)
-        {
-        case '\t':  // tab
-            append_tab_as_spaces(line, tab_width);
-            break;
+    Fixer::Stream fixer(tab_width, m_allowed);
+    take_output(FileLoader::chunk_size + 1);
+    bool ok = true;
+    while (ok && m_file.next_chunk())
+    {
+        size_t size = fixer.feed(data(), m_file.size(), m_output);
+        ok = m_writer.write(m_output.data(), size);
+        Stats::add(Stats::bytes_written, size);
+    }
 
-        case '\n':  // newline
-            //  Remove trailing spaces if any, write the line out,
-            //  and begin a new one.
-            trim(line);
-            output << line << '\n';
-            line.clear();
-            break;
+    if (ok && !m_file.read_failed())
+    {
+        size_t size = fixer.finish(m_output);
+        ok = m_writer.write(m_output.data(), size);
+        Stats::add(Stats::bytes_written, size);
+    }
+    else
+    {
+        ok = false;
+    }
 
-        default:
-            line += ' ';
-            break;
-        }
+    return ok;
+}
+
+
+//  Convert a UTF-16 file to ASCII or UTF-8, a chunk at a time if it's streamed
+bool Normalizer::convert_the_file(int tab_width)
+{
+    Stats::Timer timer(Stats::phase_fix);
+    if (m_file.is_streamed() && !(m_file.rewind() && m_file.next_chunk()))
+    {
+        return false;
+    }
+
+    bool little_endian = Sniffer::is_little_endian(data(), m_file.size());
+    Fixer::Utf16Stream converter(tab_width, little_endian, m_non_ascii);
+    take_output(m_file.size() + 1);
+
+    if (!open_output())
+    {
+        return false;
+    }
+
+    bool ok = true;
+    do
+    {
+        size_t size = converter.feed(data(), m_file.size(), m_output);
+        ok = !converter.failed() && write_output(m_output.data(), size);
+        Stats::add(Stats::bytes_written, size);
+    } while (ok && m_file.is_streamed() && m_file.next_chunk());
+
+    if (ok && !m_file.read_failed())
+    {
+        size_t size = converter.finish(m_output);
+        ok = !converter.failed() && write_output(m_output.data(), size);
+        Stats::add(Stats::bytes_written, size);
+    }
+    else
+    {
+        ok = false;
     }
 
-    //  If the file didn't end with a line feed,
-    //  there might be one last line still pending.
-    trim(line);
-    if (!line.empty())
+    if (converter.failed())
     {
-        output << line << '\n';
+        m_report += "Could not convert ";
+        m_report += m_full_name;
+        m_report += " from UTF-16\n";
     }
 
-    output.flush();
-    return output.good();
+    return ok;
 }
@@ -18,36 +18,245 @@
 */
 #pragma once
 
-#include <experimental/filesystem>
+#include "buffer_pool.h"
+#include "file_loader.h"
+#include "file_writer.h"
+#include "fixer.h"
+#include "locator.h"
+#include "scan_cache.h"
+#include "seen_files.h"
+#include "splitter.h"
+
+#include <functional>
 #include <string>
 #include <vector>
 
 class Normalizer
 {
 public:
-    void normalize(const char* path, int tabsize, bool fix);
+    Normalizer() { m_file.set_pool(&m_pool); }
+
+    //  If there's a previous cache entry for the file, and its contents
+    //  haven't changed, the errors recorded there are used as they are.
+    void normalize(const char* path, int tabsize, bool fix,
+                   const ScanCache::Entry* previous = nullptr);
+
+    //  Contents for the next file to normalize, already read by the
+    //  caller. Swapped with an internal buffer, so nothing is copied.
+    void preload(std::vector<char>& data, const struct stat* info = nullptr)
+    {
+        m_preloaded.swap(data);
+        m_has_preloaded = true;
+        m_has_preloaded_info = info != nullptr;
+        if (info)
+        {
+            m_preloaded_info = *info;
+        }
+    }
+
+    //  Report the errors already known from the cache, without
+    //  even loading the file.
+    void report_known(const char* path, unsigned errors);
+
+    //  Read the contents from one descriptor and write them to another,
+    //  fixed if they can be, as they were if not. The name is only for
+    //  the rules and the messages. Nothing is written to the file system,
+    //  and contents bigger than the stream threshold go through a chunk
+    //  at a time. Returns false if reading or writing failed.
+    bool filter(int in_fd, int out_fd, const char* name, int tabsize);
+
+    //  Examine contents that aren't in a file of their own, like a big
+    //  member of an archive, a piece at a time. The reader fills the
+    //  buffer, and returns the size, zero at the end, or -1 if reading
+    //  failed. The errors are only classified, not located or fixed.
+    using Reader = std::function<long(char* buffer, size_t size)>;
+    void normalize_stream(const char* name, const Reader& read);
+
+    //  Compute a hash of the contents of each file loaded.
+    //  Needed when the results are cached, or files seen by contents.
+    void set_hashing(bool hashing) { m_hashing = hashing; }
+
+    //  Take the results from there for files already seen through
+    //  another link, or with the same contents, and add new ones
+    void set_seen_files(SeenFiles* seen) { m_seen = seen; }
+
+    //  Files bigger than this are examined and fixed a chunk at a time,
+    //  instead of loading them whole. Zero means never.
+    void set_stream_threshold(size_t size)
+    {
+        m_stream_threshold = size;
+        m_file.set_stream_threshold(size);
+    }
+
+    //  Contents loaded whole and bigger than this are classified and
+    //  fixed in pieces, on the workers given. Zero means never.
+    void set_split(size_t size, WorkerPool* workers)
+    {
+        m_split_above = size;
+        m_split_workers = workers;
+    }
+
+    //  Find the lines and columns of the errors, at most this many of
+    //  each kind. Zero means not at all.
+    void set_max_locations(size_t max_locations) { m_max_locations = max_locations; }
+
+    //  How UTF-16 files with non-ASCII characters are converted
+    void set_non_ascii(Fixer::NonAscii non_ascii) { m_non_ascii = non_ascii; }
+
+    //  The rules relaxed for the next file, the allow_ bits
+    void set_allowed(unsigned allowed) { m_allowed = allowed; }
+
+    //  Only find out whether each file is clean, stopping at the first
+    //  error. A file with errors then gets just the bit for that one.
+    void set_check_only(bool check_only) { m_check_only = check_only; }
+
+    //  Instead of fixing the files, tell what fixing would change, as
+    //  a unified diff. Not for UTF-16 or streamed files.
+    void set_diff(bool diff) { m_diff = diff; }
+
+    //  What to keep of the originals of the fixed files, and how
+    //  to make sure the new ones are on the disk
+    void set_write_policy(FileWriter::Backup backup, FileWriter::Sync sync)
+    {
+        m_writer.set_policy(backup, sync);
+    }
+
+    //  Results from the last normalized file
+    unsigned errors() const { return m_errors; }
+    uint64_t content_hash() const { return m_content_hash; }
+    bool was_loaded() const { return m_loaded; }
+    bool was_fixed() const { return m_fixed; }
+    long invalid_count() const { return m_invalid_count; }
+    long non_ascii_count() const { return m_non_ascii_count; }
+    const std::vector<Locator::Location>& locations() const { return m_locations; }
+    long omitted_locations() const { return m_omitted_locations; }
+    bool is_partial() const { return m_partial; }  // Not all the errors, don't cache
+    const std::string& diff() const { return m_diff_text; }
+
+    //  Messages about anything that went wrong with the last file, such
+    //  as a failed rename. The errors found are described by the reporter.
+    //  Nothing is printed directly, so that parallel workers won't mix
+    //  up their output.
+    const std::string& report() const { return m_report; }
 
 private:
-    using Buffer = std::vector<char>;
+    //  Forget about the last file
+    void clear_results();
+
+    void normalize_file(const char* path, int tabsize, bool fix,
+                        const ScanCache::Entry* previous);
+
+    //  One try at the above. A mapped file truncated on the way sets
+    //  m_truncated instead of any results, and is then read again.
+    void normalize_contents(const char* path, int tabsize, bool fix,
+                            const ScanCache::Entry* previous);
+
+    //  Sets m_seen_file instead of loading, if the results for the
+    //  same file are known and there's nothing to fix
+    bool load_file(const char* path, bool fix);
+
+    //  Results from another path or a copy, instead of finding them
+    bool is_seen_file(bool fix);
+    void take_findings(SeenFiles::Findings& findings);
+    void remember_findings();
+
+    //  Classify the contents and set m_errors
+    void find_errors();
+
+    //  The same for a streamed file, which is read through once
+    //  here. Returns false if reading failed.
+    bool find_stream_errors(const ScanCache::Entry* previous);
 
-    bool load_file(const char* path);
+    const char* data() const { return m_file.data(); }
 
-    //  Returns false if no errors found
-    bool find_errors();
+    //  True if the contents in memory are big enough to work on in pieces
+    bool is_split() const
+    {
+        return m_split_above > 0 && m_split_workers && m_file.size() > m_split_above;
+    }
 
-    int data_size() const { return int(m_data.size()); }
+    //  If invalid characters, try to figure out why: one of the
+    //  explanations of Sniffer::explain_invalid
+    int classify_invalid();
 
-    //  If invalid characters, try to figure out why
-    enum { eDONT_KNOW, eBINARY, eUTF16 };
-    int classify_invalid() const;
+    //  The full UTF-16 check, for the whole file. Also counts
+    //  the characters that aren't ASCII.
+    bool is_utf16();
 
-    void add_error_message(const char* text);
+    //  The second, slower pass that finds where the errors are
+    void locate_errors();
 
+    //  Replace the invalid characters error with a better explanation
+    void explain_invalid();
+
+    //  Room in m_output for at least the size, from the pool
+    void take_output(size_t size);
+
+    //  The new contents go to the writer, or to m_out_fd when filtering
+    bool open_output();
+    bool write_output(const char* data, size_t size);
+
+    //  Fill the buffer from the descriptor until the input ends, or until
+    //  there's more than the limit, unless it's zero. The buffer has just
+    //  the contents in the end. Returns false if reading failed.
+    bool read_input(int fd, std::vector<char>& buffer, size_t limit);
+
+    //  The rest of a filter input too big to keep, after the beginning
+    //  that is in the buffer
+    bool filter_stream(int in_fd, std::vector<char>& buffer, int tab_width);
+
+    //  Fix the file in memory only, and make the diff of the changes
+    void make_diff(int tab_width);
+
+    //  The fixed contents in m_output. Returns the size.
+    size_t fix_contents(int tab_width);
+
+    //  A big file is fixed in pieces, and they are written one by one
     bool fix_the_file(int tab_width);
+    bool fix_the_pieces(int tab_width);
+    bool fix_the_stream(int tab_width);
+
+    //  Convert from UTF-16, fixing at the same time
+    bool convert_the_file(int tab_width);
 
-    unsigned m_errors;
+    unsigned m_errors = 0;
+    long m_invalid_count = 0;  // Bytes counted as invalid characters
+    long m_non_ascii_count = 0;  // Characters outside ASCII in UTF-16
+    Fixer::NonAscii m_non_ascii = Fixer::eREJECT;
+    size_t m_max_locations = 0;
+    std::vector<Locator::Location> m_locations;
+    long m_omitted_locations = 0;
+    uint64_t m_content_hash = 0;
+    bool m_hashing = false;
+    bool m_loaded = false;
+    bool m_fixed = false;
+    bool m_sniffed = false;  // Rejected as binary without loading
+    bool m_check_only = false;
+    bool m_diff = false;
+    std::string m_diff_text;
+    std::vector<Locator::Location> m_changes;  // For the diff, all of them
+    std::vector<long> m_changed_lines;
+    unsigned m_allowed = 0;
+    bool m_partial = false;  // Stopped at the first error
+    bool m_truncated = false;  // The mapped file was cut short while read
+    SeenFiles* m_seen = nullptr;
+    SeenFiles::Findings m_found;
+    bool m_seen_file = false;     // The same file through another link, not loaded
+    bool m_seen_content = false;  // Loaded, but the same contents were seen
     std::string m_full_name;
-    std::string m_temp_name;
-    std::string m_error_message;
-    Buffer m_data;
+    FileWriter m_writer;
+    int m_out_fd = -1;  // Writing here instead, when filtering
+    bool m_output_failed = false;
+    size_t m_stream_threshold = 0;
+    size_t m_split_above = 0;
+    WorkerPool* m_split_workers = nullptr;
+    std::vector<Splitter::Piece> m_pieces;  // Only the vector is kept, not the buffers
+    std::string m_report;
+    BufferPool m_pool;  // For loading and fixing
+    FileLoader m_file;
+    std::vector<char> m_preloaded;
+    bool m_has_preloaded = false;
+    bool m_has_preloaded_info = false;
+    struct stat m_preloaded_info;
+    std::vector<char> m_output;
 };
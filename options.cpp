@@ -16,50 +16,179 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "options.h"
+#include "classifier.h"
+#include "hash.h"
 
 #include <getopt.h>
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <thread>
 
 namespace {
 
+//  Codes for the long options that have no short equivalent
+enum {
+    opt_allow = 256,
+    opt_allow_for,
+    opt_archives,
+    opt_backup,
+    opt_by_extension,
+    opt_cache,
+    opt_check,
+    opt_dedup,
+    opt_diff,
+    opt_fail_fast,
+    opt_files_from,
+    opt_filter,
+    opt_format,
+    opt_gitignore,
+    opt_include,
+    opt_io_uring,
+    opt_locations,
+    opt_merge_reports,
+    opt_non_ascii,
+    opt_shard,
+    opt_split_above,
+    opt_stats,
+    opt_stream_above,
+    opt_sync,
+    opt_watch,
+};
+
 // clang-format off
 struct option long_options[] =
 {
+    {"allow", required_argument, 0, opt_allow},
+    {"allow-for", required_argument, 0, opt_allow_for},
+    {"archives", no_argument, 0, opt_archives},
+    {"backup", required_argument, 0, opt_backup},
+    {"by-extension", no_argument, 0, opt_by_extension},
+    {"cache", optional_argument, 0, opt_cache},
+    {"check", no_argument, 0, opt_check},
+    {"dedup", required_argument, 0, opt_dedup},
+    {"diff", no_argument, 0, opt_diff},
     {"extension", required_argument, 0, 'e'},
+    {"fail-fast", no_argument, 0, opt_fail_fast},
+    {"files-from", required_argument, 0, opt_files_from},
+    {"filter", no_argument, 0, opt_filter},
     {"fix", no_argument, 0, 'f'},
+    {"format", required_argument, 0, opt_format},
+    {"gitignore", no_argument, 0, opt_gitignore},
     {"help", no_argument, 0, 'h'},
+    {"include", required_argument, 0, opt_include},
+    {"io-uring", no_argument, 0, opt_io_uring},
+    {"jobs", required_argument, 0, 'j'},
+    {"locations", optional_argument, 0, opt_locations},
+    {"merge-reports", no_argument, 0, opt_merge_reports},
+    {"non-ascii", required_argument, 0, opt_non_ascii},
+    {"quiet", no_argument, 0, 'q'},
     {"recursive", no_argument, 0, 'r'},
+    {"shard", required_argument, 0, opt_shard},
     {"skip", required_argument, 0, 's'},
+    {"split-above", required_argument, 0, opt_split_above},
+    {"stats", no_argument, 0, opt_stats},
+    {"stream-above", required_argument, 0, opt_stream_above},
+    {"sync", required_argument, 0, opt_sync},
     {"tabsize", required_argument, 0, 't'},
     {"verbose", no_argument, 0, 'v'},
     {"version", no_argument, 0, 'V'},
+    {"watch", no_argument, 0, opt_watch},
     {0, 0, 0, 0}
 };
 // clang-format on
 
-const char short_options[] = "e:fhrs:t:vV";
+const char short_options[] = "e:fhj:qrs:t:vV";
+
+const char default_cache_file[] = ".source_normalizer.cache";
 
-const char usage_msg[] = "Usage: $(NAME) [option]... path [path]...\n";
+const char usage_msg[] =
+    "Usage: $(NAME) [option]... path [path]...\n"
+    "  or:  $(NAME) [option]... --files-from=file [path]...\n"
+    "  or:  $(NAME) [option]... --merge-reports report...\n"
+    "  or:  $(NAME) [option]... --filter [name]\n";
 
 const char help_msg[] =
     "Detect and optionally fix whitespace issues in source files.\n"
     "Example: $(NAME) -rv -s bin .\n\n"
     "Options:\n"
+    "      --allow=rule[,rule]...  Don't report these in any file: tabs,\n"
+    "                   crlf line endings, or valid utf8\n"
+    "      --allow-for=pattern[,pattern]...:rule[,rule]...  The same for the\n"
+    "                   files with names matching the patterns, like\n"
+    "                   'Makefile,*.mk:tabs' or '*.bat:crlf'\n"
+    "      --archives   Examine the source files in the tar, tar.gz, and zip\n"
+    "                   archives given, without extracting them. Other files\n"
+    "                   are examined as they are.\n"
+    "      --backup=bak|dir|none  What to keep of the fixed files: name.bak~\n"
+    "                   next to each, the same name in .source_normalizer.bak,\n"
+    "                   or nothing (default is bak)\n"
+    "      --by-extension  Examine only listed files with source extensions\n"
+    "      --cache[=file]  Remember the results, and skip unchanged files\n"
+    "                   next time (default is .source_normalizer.cache)\n"
+    "      --check      Report nothing, only exit with status 3 if any file\n"
+    "                   has errors\n"
+    "      --dedup=none|inode|content  Take the results for a file from another\n"
+    "                   hard link to it, or also from a copy with the same\n"
+    "                   contents (default is inode)\n"
+    "      --diff       Print what --fix would change as a unified diff on\n"
+    "                   the standard output, without changing anything\n"
     "  -e, --extension=ext[,ext]... Extensions to be treated as source files\n"
+    "      --fail-fast  The same as --check, but stop at the first file with\n"
+    "                   errors\n"
+    "      --files-from=file  Examine the files listed in the file, or in\n"
+    "                   the standard input if the file is '-'\n"
+    "      --filter     Fix the standard input to the standard output, like\n"
+    "                   a git clean filter. The name, if given, decides the\n"
+    "                   rules and is used in the messages.\n"
     "  -f, --fix        Fix detected easily fixable errors\n"
+    "      --format=text|jsonl|sarif  How to report the results: sentences on\n"
+    "                   the standard error, or JSON Lines or SARIF on the\n"
+    "                   standard output (default is text)\n"
+    "      --gitignore  Skip what the .gitignore files say, when recursing\n"
     "  -h, --help       Display this help text and exit\n"
+    "      --include=pattern[,pattern]...  Also examine the files matching\n"
+    "                   the patterns, whatever the extension\n"
+    "      --io-uring   Read small files ahead with io_uring, if available\n"
+    "  -j, --jobs=n     Number of files to process in parallel\n"
+    "                   (default is one per hardware thread)\n"
+    "      --locations[=n]  Tell the lines and columns of the errors, at most\n"
+    "                   n of each kind per file (default is 10)\n"
+    "      --merge-reports  Merge the JSON Lines reports given as arguments,\n"
+    "                   such as from the shards, into one in the chosen format\n"
+    "      --non-ascii=reject|utf8|escape  How to convert non-ASCII characters\n"
+    "                   in UTF-16 files (default is reject)\n"
+    "  -q, --quiet      The same as --check\n"
     "  -r, --recursive  Recurse to subdirectories\n"
-    "  -s, --skip=name[,name]... Subdirectories to skip when recursing\n"
+    "      --shard=i/n  Examine only the i:th of n shards of the files, to split\n"
+    "                   the work between machines. The shards are decided by\n"
+    "                   the paths relative to the arguments.\n"
+    "  -s, --skip=pattern[,pattern]... Subdirectories and files to skip\n"
+    "      --split-above=size  Classify and fix a loaded file bigger than this\n"
+    "                   in pieces, on as many threads as there are jobs (default\n"
+    "                   is 0, never)\n"
+    "      --stats      Print statistics about the run at exit\n"
+    "      --stream-above=size  Process bigger files a chunk at a time,\n"
+    "                   size may end with K, M, or G (default is 64M, 0 is never)\n"
+    "      --sync=none|file|batch  Make sure the fixed files are on the disk:\n"
+    "                   not at all, each before replacing the original, or all\n"
+    "                   at once at the end (default is none)\n"
     "  -t, --tabsize=n  Set the tab size (default is 4)\n"
     "  -v, --verbose    Display lots of messages\n"
-    "  -V, --version    Display program version and exit\n\n"
+    "  -V, --version    Display program version and exit\n"
+    "      --watch      After the first scan, stay and check the files again\n"
+    "                   as they change, until interrupted\n\n"
     "If no extensions were given, the following are assumed: c,cc,cpp,h,hpp\n"
     "When path is a directory, and also in recursive mode, only files with\n"
     "the chosen extensions are examined.\n"
     "If the path is a normal file, it'll be processed regardless of the extension.\n"
+    "The same goes for files in a list, unless the '--by-extension' option is given.\n"
+    "Names in the list are separated by NUL characters or line feeds.\n"
     "Without the '--fix' option, detected problems are reported but not fixed.\n"
-    "Recursion always skips subdirectories with names having a leading period.\n";
+    "Recursion always skips subdirectories with names having a leading period.\n"
+    "Patterns are globs like in .gitignore files, relative to the directory\n"
+    "being scanned: 'build', '*.pb.h', 'third_party/**', or 'src/**/gen/'.\n";
 
 const char copyright_msg[] =
     "$(COPYRIGHT)\n"
@@ -164,6 +293,42 @@ private:
 };
 
 
+//  The allow_ bits for a list of rule names
+bool parse_rules(const char* arg, unsigned& allowed)
+{
+    allowed = 0;
+    SuboptionTokenizer tokenizer(arg);
+    for (std::string& rule = tokenizer.next(); !rule.empty(); rule = tokenizer.next())
+    {
+        if (rule == "tabs")
+        {
+            allowed |= allow_tabs;
+        }
+        else if (rule == "crlf")
+        {
+            allowed |= allow_cr_lf;
+        }
+        else if (rule == "utf8")
+        {
+            allowed |= allow_utf8;
+        }
+        else
+        {
+            std::cerr << "Error: Strange rule \"" << rule << "\"\n";
+            return false;
+        }
+    }
+
+    if (allowed == 0)
+    {
+        std::cerr << "Error: No rules in \"" << arg << "\"\n";
+        return false;
+    }
+
+    return true;
+}
+
+
 Options* the_options;
 
 }  // namespace
@@ -178,9 +343,19 @@ const Options* Options::get()
 void Options::add_skip(const char* arg)
 {
     SuboptionTokenizer tokenizer(arg);
-    for (std::string& name = tokenizer.next(); !name.empty(); name = tokenizer.next())
+    for (std::string& pattern = tokenizer.next(); !pattern.empty(); pattern = tokenizer.next())
+    {
+        m_skip.add(pattern);
+    }
+}
+
+
+void Options::add_include(const char* arg)
+{
+    SuboptionTokenizer tokenizer(arg);
+    for (std::string& pattern = tokenizer.next(); !pattern.empty(); pattern = tokenizer.next())
     {
-        m_skip.insert(name);
+        m_include.add(pattern);
     }
 }
 
@@ -214,26 +389,164 @@ int Options::parse(int argc, char** argv, const char* info)
 
         switch (ch)
         {
+        case opt_allow:  // allow
+            if (!add_allowed(optarg))
+            {
+                ++err;
+            }
+            break;
+
+        case opt_allow_for:  // allow-for
+            if (!add_allowed_for(optarg))
+            {
+                ++err;
+            }
+            break;
+
+        case opt_archives:  // archives
+            m_archives = true;
+            break;
+
+        case opt_backup:  // backup
+            if (!set_backup(optarg))
+            {
+                ++err;
+            }
+            break;
+
+        case opt_by_extension:  // by-extension
+            m_by_extension = true;
+            break;
+
+        case opt_cache:  // cache
+            m_cache_file = optarg ? optarg : default_cache_file;
+            break;
+
+        case opt_check:  // check
+        case 'q':        // quiet
+            m_check = true;
+            break;
+
         case 'e':  // extension
             add_extension(optarg);
             break;
 
+        case opt_dedup:  // dedup
+            if (!set_dedup(optarg))
+            {
+                ++err;
+            }
+            break;
+
+        case opt_diff:  // diff
+            m_diff = true;
+            break;
+
+        case opt_fail_fast:  // fail-fast
+            m_check = true;
+            m_fail_fast = true;
+            break;
+
+        case opt_files_from:  // files-from
+            m_files_from = optarg;
+            break;
+
+        case opt_filter:  // filter
+            m_filter = true;
+            break;
+
         case 'f':  // fix
             m_fix = true;
             break;
 
+        case opt_gitignore:  // gitignore
+            m_gitignore = true;
+            break;
+
+        case opt_format:  // format
+            if (!set_format(optarg))
+            {
+                ++err;
+            }
+            break;
+
         case 'h':  // help
             emit_help(std::cout, info);
             return eDONE;
 
+        case opt_include:  // include
+            add_include(optarg);
+            break;
+
+        case opt_io_uring:  // io-uring
+            m_io_uring = true;
+            break;
+
+        case 'j':  // jobs
+            if (!set_jobs(optarg))
+            {
+                ++err;
+            }
+            break;
+
+        case opt_locations:  // locations
+            if (!set_locations(optarg ? optarg : "10"))
+            {
+                ++err;
+            }
+            break;
+
+        case opt_merge_reports:  // merge-reports
+            m_merge_reports = true;
+            break;
+
+        case opt_non_ascii:  // non-ascii
+            if (!set_non_ascii(optarg))
+            {
+                ++err;
+            }
+            break;
+
         case 'r':  // recursive
             m_recursive = true;
             break;
 
+        case opt_shard:  // shard
+            if (!set_shard(optarg))
+            {
+                ++err;
+            }
+            break;
+
         case 's':  // skip
             add_skip(optarg);
             break;
 
+        case opt_stats:  // stats
+            m_stats = true;
+            break;
+
+        case opt_split_above:  // split-above
+            if (!set_size(optarg, m_split_above))
+            {
+                ++err;
+            }
+            break;
+
+        case opt_stream_above:  // stream-above
+            if (!set_size(optarg, m_stream_above))
+            {
+                ++err;
+            }
+            break;
+
+        case opt_sync:  // sync
+            if (!set_sync(optarg))
+            {
+                ++err;
+            }
+            break;
+
         case 't':  // tabsize
             if (!set_tabsize(optarg))
             {
@@ -249,6 +562,10 @@ int Options::parse(int argc, char** argv, const char* info)
             emit_version(std::cout, info);
             return eDONE;
 
+        case opt_watch:  // watch
+            m_watch = true;
+            break;
+
         case '?':
             ++err;
             break;
@@ -257,6 +574,64 @@ int Options::parse(int argc, char** argv, const char* info)
 
     m_first_argument = optind;
 
+    //  A SARIF log is complete only at the end, and watching never ends
+    if (m_watch && m_format == Reporter::eSARIF)
+    {
+        std::cerr << "Error: --watch can't be used with --format=sarif\n";
+        ++err;
+    }
+
+    //  Nothing is reported in the check mode, so anything that changes
+    //  files or adds to the reports makes no sense with it
+    if (m_check &&
+        (m_fix || m_verbose || m_watch || m_locations > 0 || m_format != Reporter::eTEXT))
+    {
+        std::cerr << "Error: --check can't be used with --fix, --verbose, --watch, --locations,"
+                     " or --format\n";
+        ++err;
+    }
+
+    //  Merging only reads the reports, there's nothing to examine
+    if (m_merge_reports &&
+        (m_fix || m_watch || m_check || m_shard_count > 0 || !m_files_from.empty()))
+    {
+        std::cerr << "Error: --merge-reports can't be used with --fix, --watch, --check,"
+                     " --shard, or --files-from\n";
+        ++err;
+    }
+
+    //  The members are read from the archives, never written back
+    if (m_archives && (m_fix || m_watch || m_filter || m_merge_reports || !m_files_from.empty()))
+    {
+        std::cerr << "Error: --archives can't be used with --fix, --watch, --filter,"
+                     " --merge-reports, or --files-from\n";
+        ++err;
+    }
+
+    //  The diff is on the standard output, and it's instead of fixing
+    if (m_diff && (m_fix || m_check || m_filter || m_merge_reports || m_format != Reporter::eTEXT))
+    {
+        std::cerr << "Error: --diff can't be used with --fix, --check, --filter, --merge-reports,"
+                     " or --format\n";
+        ++err;
+    }
+
+    //  The standard output is for the contents, and there are no files
+    if (m_filter &&
+        (m_watch || m_check || m_merge_reports || m_locations > 0 || m_shard_count > 0 ||
+         m_format != Reporter::eTEXT || !m_files_from.empty() || !m_cache_file.empty()))
+    {
+        std::cerr << "Error: --filter can't be used with --watch, --check, --merge-reports,"
+                     " --locations, --shard, --format, --files-from, or --cache\n";
+        ++err;
+    }
+
+    if (m_filter && argc - m_first_argument > 1)
+    {
+        std::cerr << "Error: --filter takes at most one name\n";
+        ++err;
+    }
+
     //  Emit a short usage message if there were errors, or
     //  if the program was called without any options or arguments.
     if (err || argc < 2)
@@ -271,6 +646,16 @@ int Options::parse(int argc, char** argv, const char* info)
         add_extension("c,cc,cpp,h,hpp");
     }
 
+    //  All the patterns are known now
+    m_skip.compile();
+    m_include.compile();
+
+    //  By default use all the available hardware threads
+    if (m_jobs == 0)
+    {
+        m_jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+
     return eOK;
 }
 
@@ -291,25 +676,350 @@ bool Options::set_tabsize(const char* arg)
 }
 
 
-bool Options::should_be_skipped(const std::string& name) const
+bool Options::set_jobs(const char* arg)
+{
+    int jobs = std::atoi(arg);
+
+    //  Small sanity check
+    if (jobs < 1 || jobs > 1024)
+    {
+        std::cerr << "Error: Strange jobs argument \"" << arg << "\"\n";
+        return false;
+    }
+
+    m_jobs = jobs;
+    return true;
+}
+
+
+bool Options::set_locations(const char* arg)
+{
+    int locations = std::atoi(arg);
+
+    //  Small sanity check
+    if (locations < 1 || locations > 1000000)
+    {
+        std::cerr << "Error: Strange locations argument \"" << arg << "\"\n";
+        return false;
+    }
+
+    m_locations = size_t(locations);
+    return true;
+}
+
+
+bool Options::set_size(const char* arg, size_t& size_option)
+{
+    char* end = nullptr;
+    unsigned long long size = std::strtoull(arg, &end, 10);
+    switch (*end)
+    {
+    case 'G':
+        size *= 1024;
+        // fall through
+    case 'M':
+        size *= 1024;
+        // fall through
+    case 'K':
+        size *= 1024;
+        ++end;
+        break;
+
+    default:
+        break;
+    }
+
+    if (end == arg || *end != '\0' || arg[0] == '-')
+    {
+        std::cerr << "Error: Strange size argument \"" << arg << "\"\n";
+        return false;
+    }
+
+    size_option = size_t(size);
+    return true;
+}
+
+
+bool Options::set_non_ascii(const char* arg)
+{
+    if (std::strcmp(arg, "reject") == 0)
+    {
+        m_non_ascii = Fixer::eREJECT;
+    }
+    else if (std::strcmp(arg, "utf8") == 0)
+    {
+        m_non_ascii = Fixer::eUTF8;
+    }
+    else if (std::strcmp(arg, "escape") == 0)
+    {
+        m_non_ascii = Fixer::eESCAPE;
+    }
+    else
+    {
+        std::cerr << "Error: Strange non-ascii argument \"" << arg << "\"\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Options::set_format(const char* arg)
+{
+    if (std::strcmp(arg, "text") == 0)
+    {
+        m_format = Reporter::eTEXT;
+    }
+    else if (std::strcmp(arg, "jsonl") == 0)
+    {
+        m_format = Reporter::eJSONL;
+    }
+    else if (std::strcmp(arg, "sarif") == 0)
+    {
+        m_format = Reporter::eSARIF;
+    }
+    else
+    {
+        std::cerr << "Error: Strange format argument \"" << arg << "\"\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Options::set_shard(const char* arg)
 {
-    //  Skip if the name begins with a '.'
-    if (name[0] == '.')
+    char* end = nullptr;
+    unsigned long shard = std::strtoul(arg, &end, 10);
+    unsigned long count = 0;
+    if (end != arg && *end == '/')
+    {
+        const char* rest = end + 1;
+        count = std::strtoul(rest, &end, 10);
+        end = (end == rest) ? nullptr : end;
+    }
+
+    //  Small sanity check
+    if (!end || *end != '\0' || arg[0] == '-' || shard < 1 || shard > count || count > 100000)
+    {
+        std::cerr << "Error: Strange shard argument \"" << arg << "\"\n";
+        return false;
+    }
+
+    m_shard = unsigned(shard - 1);
+    m_shard_count = unsigned(count);
+    return true;
+}
+
+
+bool Options::add_allowed(const char* arg)
+{
+    unsigned allowed;
+    if (!parse_rules(arg, allowed))
+    {
+        return false;
+    }
+
+    m_allowed |= allowed;
+    m_allow_settings += "all:";
+    m_allow_settings += arg;
+    m_allow_settings += ';';
+    return true;
+}
+
+
+bool Options::add_allowed_for(const char* arg)
+{
+    //  The rule names have no colons, the patterns might
+    const char* colon = std::strrchr(arg, ':');
+    unsigned allowed;
+    if (!colon || colon == arg)
+    {
+        std::cerr << "Error: Strange allow-for argument \"" << arg << "\"\n";
+        return false;
+    }
+
+    if (!parse_rules(colon + 1, allowed))
+    {
+        return false;
+    }
+
+    AllowedFor entry;
+    entry.names = std::make_unique<PathMatcher>();
+    entry.allowed = allowed;
+    std::string patterns(arg, colon);
+    SuboptionTokenizer tokenizer(patterns.c_str());
+    for (std::string& pattern = tokenizer.next(); !pattern.empty(); pattern = tokenizer.next())
+    {
+        entry.names->add(pattern);
+    }
+
+    entry.names->compile();
+    m_allowed_for.push_back(std::move(entry));
+    m_allow_settings += arg;
+    m_allow_settings += ';';
+    return true;
+}
+
+
+bool Options::in_shard(std::string_view path) const
+{
+    if (m_shard_count <= 1)
     {
         return true;
     }
 
-    //  Skip if it's one of the names given in skip options
-    if (m_skip.count(name))
+    //  The same file by the same name, however it was given
+    while (path.substr(0, 2) == "./")
+    {
+        path.remove_prefix(2);
+    }
+
+    //  FNV-1a gives the same result everywhere, and doesn't depend
+    //  on the order the files are found
+    return Hash::fnv1a(path.data(), path.size()) % m_shard_count == m_shard;
+}
+
+
+unsigned Options::allowed_for(std::string_view path) const
+{
+    unsigned allowed = m_allowed;
+    if (m_allowed_for.empty())
+    {
+        return allowed;
+    }
+
+    size_t slash = path.rfind('/');
+    std::string_view name = path.substr(slash == std::string_view::npos ? 0 : slash + 1);
+    for (const auto& entry : m_allowed_for)
+    {
+        if (entry.names->match(name, false) == PathMatcher::eMATCH)
+        {
+            allowed |= entry.allowed;
+        }
+    }
+
+    return allowed;
+}
+
+
+bool Options::set_dedup(const char* arg)
+{
+    if (std::strcmp(arg, "none") == 0)
+    {
+        m_dedup = SeenFiles::eNONE;
+    }
+    else if (std::strcmp(arg, "inode") == 0)
+    {
+        m_dedup = SeenFiles::eINODE;
+    }
+    else if (std::strcmp(arg, "content") == 0)
+    {
+        m_dedup = SeenFiles::eCONTENT;
+    }
+    else
+    {
+        std::cerr << "Error: Strange dedup argument \"" << arg << "\"\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Options::set_backup(const char* arg)
+{
+    if (std::strcmp(arg, "bak") == 0)
+    {
+        m_backup = FileWriter::eBAK;
+    }
+    else if (std::strcmp(arg, "dir") == 0)
+    {
+        m_backup = FileWriter::eDIR;
+    }
+    else if (std::strcmp(arg, "none") == 0)
+    {
+        m_backup = FileWriter::eNO_BACKUP;
+    }
+    else
+    {
+        std::cerr << "Error: Strange backup argument \"" << arg << "\"\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Options::set_sync(const char* arg)
+{
+    if (std::strcmp(arg, "none") == 0)
+    {
+        m_sync = FileWriter::eNO_SYNC;
+    }
+    else if (std::strcmp(arg, "file") == 0)
+    {
+        m_sync = FileWriter::eSYNC_FILE;
+    }
+    else if (std::strcmp(arg, "batch") == 0)
+    {
+        m_sync = FileWriter::eSYNC_BATCH;
+    }
+    else
+    {
+        std::cerr << "Error: Strange sync argument \"" << arg << "\"\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+std::string Options::result_settings() const
+{
+    std::string text = "tabsize=" + std::to_string(m_tabsize);
+    text += ";extensions=";
+    for (const auto& ext : m_extensions)
+    {
+        text += ext;
+        text += ',';
+    }
+
+    text += ";non_ascii=" + std::to_string(m_non_ascii);
+
+    //  Left out if not used, so that older caches stay valid
+    if (!m_allow_settings.empty())
+    {
+        text += ";allow=" + m_allow_settings;
+    }
+
+    return text;
+}
+
+
+bool Options::should_be_skipped(std::string_view path, bool is_directory) const
+{
+    //  Skip a directory if the name begins with a '.'
+    size_t slash = path.rfind('/');
+    std::string_view name = path.substr(slash == std::string_view::npos ? 0 : slash + 1);
+    if (is_directory && !name.empty() && name[0] == '.')
     {
         return true;
     }
 
-    return false;
+    //  Skip if it matches the skip options
+    return m_skip.match(path, is_directory) == PathMatcher::eMATCH;
+}
+
+
+bool Options::is_included(std::string_view path) const
+{
+    return m_include.match(path, false) == PathMatcher::eMATCH;
 }
 
 
-bool Options::is_source_extension(const std::string& extension) const
+bool Options::is_source_extension(std::string_view extension) const
 {
     return m_extensions.count(extension);
 }
@@ -19,8 +19,18 @@
 
 #pragma once
 
+#include "file_writer.h"
+#include "fixer.h"
+#include "path_matcher.h"
+#include "reporter.h"
+#include "seen_files.h"
+
+#include <cstddef>
+#include <memory>
 #include <set>
 #include <string>
+#include <string_view>
+#include <vector>
 
 //  Command line options
 class Options
@@ -30,12 +40,87 @@ public:
     bool verbose() const { return m_verbose; }
     bool recursive() const { return m_recursive; }
     int tabsize() const { return m_tabsize; }
+    int jobs() const { return m_jobs; }
+    bool stats() const { return m_stats; }
 
-    //  true if the directory should be skipped when recursing
-    bool should_be_skipped(const std::string& name) const;
+    //  Read small files ahead with io_uring, if the kernel has it
+    bool io_uring() const { return m_io_uring; }
+
+    //  Most locations to find of each kind of error per file, zero if none
+    size_t locations() const { return m_locations; }
+
+    //  Only tell whether all the files are clean, by the exit status
+    bool check() const { return m_check; }
+
+    //  Stop at the first file with errors, in the check mode
+    bool fail_fast() const { return m_fail_fast; }
+
+    //  Show what fixing would change as a unified diff, without fixing
+    bool diff() const { return m_diff; }
+
+    //  Stay and check the files again when they change
+    bool watch() const { return m_watch; }
+
+    //  Files bigger than this are processed a chunk at a time
+    size_t stream_above() const { return m_stream_above; }
+
+    //  Files bigger than this are classified and fixed in parallel pieces
+    size_t split_above() const { return m_split_above; }
+
+    //  How to convert non-ASCII characters in UTF-16 files
+    Fixer::NonAscii non_ascii() const { return m_non_ascii; }
+
+    //  How the results are reported
+    Reporter::Format format() const { return m_format; }
+
+    //  The rules relaxed for the file, as the allow_ bits of the
+    //  classifier. Only the name of the file matters, not the directory.
+    unsigned allowed_for(std::string_view path) const;
+
+    //  Which files count as already seen
+    SeenFiles::Mode dedup() const { return m_dedup; }
+
+    //  What to keep of the fixed files, and how to sync the new ones
+    FileWriter::Backup backup() const { return m_backup; }
+    FileWriter::Sync sync() const { return m_sync; }
+
+    //  true if the file is in the shard to examine here, or if the work
+    //  isn't split. The path is relative to the directory being scanned.
+    bool in_shard(std::string_view path) const;
+
+    //  Fix the standard input to the standard output, instead of files
+    bool filter() const { return m_filter; }
+
+    //  The files given are archives, examined member by member
+    bool archives() const { return m_archives; }
+
+    //  The arguments are JSON Lines reports to merge into one
+    bool merge_reports() const { return m_merge_reports; }
+
+    //  File with a list of files to examine, or "-" for standard input
+    const std::string& files_from() const { return m_files_from; }
+
+    //  Examine only the listed files with source extensions
+    bool by_extension() const { return m_by_extension; }
+
+    //  File name for the scan cache, empty if not caching
+    const std::string& cache_file() const { return m_cache_file; }
+
+    //  Describes all options that may change the results for a file
+    std::string result_settings() const;
+
+    //  true if the directory or file should be skipped when scanning.
+    //  The path is relative to the directory being scanned.
+    bool should_be_skipped(std::string_view path, bool is_directory) const;
+
+    //  true if the file should be examined whatever the extension
+    bool is_included(std::string_view path) const;
+
+    //  Leave out what the .gitignore files say
+    bool gitignore() const { return m_gitignore; }
 
     //  true if the extension suggests a source file
-    bool is_source_extension(const std::string& extension) const;
+    bool is_source_extension(std::string_view extension) const;
 
     //  Index of the first argument after all options were parsed
     int first_argument() const { return m_first_argument; }
@@ -52,29 +137,90 @@ private:
     };
     int parse(int argc, char** argv, const char* info);
 
-    //  Add a directory name to the list of names to be skipped
+    //  Add patterns for the directories and files to be skipped
     void add_skip(const char* arg);
 
+    //  Add patterns for the files to examine regardless of extension
+    void add_include(const char* arg);
+
     //  Add an extension to the accepted set
     void add_extension(const char* arg);
 
     bool set_tabsize(const char* arg);
+    bool set_jobs(const char* arg);
+    bool set_locations(const char* arg);
+    bool set_size(const char* arg, size_t& size_option);
+    bool set_non_ascii(const char* arg);
+    bool set_format(const char* arg);
+    bool set_dedup(const char* arg);
+    bool set_backup(const char* arg);
+    bool set_sync(const char* arg);
+    bool set_shard(const char* arg);
+    bool add_allowed(const char* arg);
+    bool add_allowed_for(const char* arg);
 
     //  Only main can set the options
     friend int main(int argc, char** argv);
 
     bool m_fix = false;  // Try to fix errors
+    bool m_diff = false;
     bool m_verbose = false;
     bool m_recursive = false;
+    bool m_stats = false;  // Print statistics at exit
+    bool m_io_uring = false;
+    bool m_watch = false;
+    bool m_check = false;
+    bool m_fail_fast = false;
+    bool m_merge_reports = false;
+    bool m_filter = false;
+    bool m_archives = false;
 
     int m_tabsize = 4;
 
-    //  Directory names to be skipped when recursing
-    //  For example: "bin", "build", etc...
-    std::set<std::string> m_skip;
+    //  Number of worker threads, zero means one per hardware thread
+    int m_jobs = 0;
+
+    size_t m_locations = 0;
+
+    //  Size limit for loading whole files
+    size_t m_stream_above = 64 * 1024 * 1024;
+    size_t m_split_above = 0;
+
+    Fixer::NonAscii m_non_ascii = Fixer::eREJECT;
+    Reporter::Format m_format = Reporter::eTEXT;
+    SeenFiles::Mode m_dedup = SeenFiles::eINODE;
+    FileWriter::Backup m_backup = FileWriter::eBAK;
+    FileWriter::Sync m_sync = FileWriter::eNO_SYNC;
+
+    //  This one of the shards, counting from zero, or no shards at all
+    unsigned m_shard = 0;
+    unsigned m_shard_count = 0;
+
+    //  Relaxed for all files, and for the files with matching names
+    struct AllowedFor
+    {
+        std::unique_ptr<PathMatcher> names;
+        unsigned allowed;
+    };
+
+    unsigned m_allowed = 0;
+    std::vector<AllowedFor> m_allowed_for;
+    std::string m_allow_settings;  // As given, for result_settings
+
+    std::string m_cache_file;
+    std::string m_files_from;
+    bool m_by_extension = false;
+
+    //  Patterns for the directories and files to be skipped
+    //  For example: "bin", "build", "third_party/**", "*.pb.h", etc...
+    PathMatcher m_skip;
+
+    //  Patterns for more files to examine, like "CMakeLists.txt"
+    PathMatcher m_include;
+    bool m_gitignore = false;
 
     //  Extensions accepted in source file names
-    std::set<std::string> m_extensions;
+    std::set<std::string, std::less<>> m_extensions;
 
     //  Index of the first argument after all options were parsed
     int m_first_argument = 0;
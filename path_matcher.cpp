@@ -0,0 +1,445 @@
+//  Glob patterns for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "path_matcher.h"
+
+#include <algorithm>
+
+namespace {
+
+//  Past this, paths are matched without remembering the new states,
+//  so that odd rules can't eat up all the memory.
+constexpr size_t max_states = 16 * 1024;
+
+}  // namespace
+
+
+struct PathMatcher::State
+{
+    const Set* set;  // The key in m_states
+    int file_rule;   // The last rule accepting a file here, -1 if none
+    int dir_rule;    // The same for a directory
+    std::atomic<const State*> next[256];
+};
+
+
+PathMatcher::PathMatcher() = default;
+PathMatcher::~PathMatcher() = default;
+
+
+void PathMatcher::add(std::string_view rule)
+{
+    if (!rule.empty() && rule.back() == '\r')
+    {
+        rule.remove_suffix(1);
+    }
+
+    //  Trailing spaces don't count, unless escaped
+    while (!rule.empty() && rule.back() == ' ' &&
+           !(rule.size() >= 2 && rule[rule.size() - 2] == '\\'))
+    {
+        rule.remove_suffix(1);
+    }
+
+    if (rule.empty() || rule[0] == '#')
+    {
+        return;
+    }
+
+    bool negated = rule[0] == '!';
+    if (negated)
+    {
+        rule.remove_prefix(1);
+    }
+
+    bool directory_only = !rule.empty() && rule.back() == '/';
+    if (directory_only)
+    {
+        rule.remove_suffix(1);
+    }
+
+    if (!rule.empty() && parse(rule))
+    {
+        m_rules.push_back({negated, directory_only});
+    }
+}
+
+
+void PathMatcher::add_lines(std::string_view text)
+{
+    while (!text.empty())
+    {
+        size_t end = text.find('\n');
+        if (end == std::string_view::npos)
+        {
+            end = text.size();
+        }
+
+        add(text.substr(0, end));
+        text.remove_prefix(std::min(end + 1, text.size()));
+    }
+}
+
+
+//  Turn the rule into positions, ending with an accept
+bool PathMatcher::parse(std::string_view text)
+{
+    //  A slash anywhere but at the end ties the rule to the whole path,
+    //  otherwise it may match the name in any directory.
+    bool anchored = text.find('/') != std::string_view::npos;
+    if (text[0] == '/')
+    {
+        text.remove_prefix(1);
+        if (text.empty())
+        {
+            return false;
+        }
+    }
+
+    size_t first = m_positions.size();
+    m_starts.push_back(int(first));
+    if (!anchored)
+    {
+        m_positions.push_back({eDIRS, 0});
+        m_positions.push_back({eDIRS_NAME, 0});
+    }
+
+    size_t size = text.size();
+    for (size_t ix = 0; ix < size; ++ix)
+    {
+        char ch = text[ix];
+        switch (ch)
+        {
+        case '\\':
+            if (ix + 1 < size)
+            {
+                ++ix;
+            }
+            m_positions.push_back({eCHAR, static_cast<unsigned char>(text[ix])});
+            break;
+
+        case '?':
+            m_positions.push_back({eANY, 0});
+            break;
+
+        case '*':
+        {
+            size_t stars = 1;
+            while (ix + stars < size && text[ix + stars] == '*')
+            {
+                ++stars;
+            }
+
+            //  Only a "**" that is a whole path component is special
+            bool starts_component = ix == 0 || text[ix - 1] == '/';
+            bool at_end = ix + stars == size;
+            bool ends_component = at_end || text[ix + stars] == '/';
+            if (stars == 2 && starts_component && ends_component)
+            {
+                if (at_end)
+                {
+                    m_positions.push_back({eEVERYTHING, 0});
+                }
+                else
+                {
+                    m_positions.push_back({eDIRS, 0});
+                    m_positions.push_back({eDIRS_NAME, 0});
+                    ++ix;  // The slash is part of it
+                }
+            }
+            else
+            {
+                m_positions.push_back({eSTAR, 0});
+            }
+
+            ix += stars - 1;
+            break;
+        }
+
+        case '[':
+        {
+            //  Find the end first, without one it's just a character
+            size_t pos = ix + 1;
+            if (pos < size && (text[pos] == '!' || text[pos] == '^'))
+                ++pos;
+            if (pos < size && text[pos] == ']')
+                ++pos;
+            while (pos < size && text[pos] != ']')
+            {
+                pos += (text[pos] == '\\' && pos + 1 < size) ? 2 : 1;
+            }
+
+            if (pos >= size)
+            {
+                m_positions.push_back({eCHAR, '['});
+                break;
+            }
+
+            std::bitset<256> members;
+            size_t cursor = ix + 1;
+            bool invert = text[cursor] == '!' || text[cursor] == '^';
+            if (invert)
+                ++cursor;
+
+            bool first_member = true;
+            while (cursor < pos && (first_member || text[cursor] != ']'))
+            {
+                first_member = false;
+                if (text[cursor] == '\\' && cursor + 1 < pos)
+                    ++cursor;
+
+                unsigned char low = static_cast<unsigned char>(text[cursor++]);
+                unsigned char high = low;
+                if (cursor + 1 < pos && text[cursor] == '-')
+                {
+                    ++cursor;
+                    if (text[cursor] == '\\' && cursor + 1 < pos)
+                        ++cursor;
+                    high = static_cast<unsigned char>(text[cursor++]);
+                }
+
+                for (unsigned value = low; value <= high; ++value)
+                {
+                    members.set(value);
+                }
+            }
+
+            if (invert)
+            {
+                members.flip();
+            }
+
+            members.reset('/');
+            m_positions.push_back({eCLASS, int(m_classes.size())});
+            m_classes.push_back(members);
+            ix = pos;
+            break;
+        }
+
+        default:
+            m_positions.push_back({eCHAR, static_cast<unsigned char>(ch)});
+            break;
+        }
+    }
+
+    m_positions.push_back({eACCEPT, int(m_rules.size())});
+    return true;
+}
+
+
+//  Add the positions that can be reached without consuming anything
+void PathMatcher::close_over(Set& set) const
+{
+    for (size_t ix = 0; ix < set.size(); ++ix)
+    {
+        int pos = set[ix];
+        switch (m_positions[pos].kind)
+        {
+        case eSTAR:
+        case eEVERYTHING:
+            set.push_back(pos + 1);
+            break;
+
+        case eDIRS:
+            set.push_back(pos + 2);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    std::sort(set.begin(), set.end());
+    set.erase(std::unique(set.begin(), set.end()), set.end());
+}
+
+
+PathMatcher::Set PathMatcher::step(const Set& set, unsigned char ch) const
+{
+    Set next;
+    for (int pos : set)
+    {
+        const Position& position = m_positions[pos];
+        switch (position.kind)
+        {
+        case eCHAR:
+            if (ch == position.value)
+                next.push_back(pos + 1);
+            break;
+
+        case eANY:
+            if (ch != '/')
+                next.push_back(pos + 1);
+            break;
+
+        case eCLASS:
+            if (m_classes[position.value][ch])
+                next.push_back(pos + 1);
+            break;
+
+        case eSTAR:
+            if (ch != '/')
+                next.push_back(pos);
+            break;
+
+        case eEVERYTHING:
+            next.push_back(pos);
+            break;
+
+        case eDIRS:
+            if (ch != '/')
+                next.push_back(pos + 1);
+            break;
+
+        case eDIRS_NAME:
+            next.push_back(ch == '/' ? pos - 1 : pos);
+            break;
+
+        case eACCEPT:
+            break;
+        }
+    }
+
+    close_over(next);
+    return next;
+}
+
+
+int PathMatcher::decide(const Set& set, bool is_directory) const
+{
+    int rule = -1;
+    for (int pos : set)
+    {
+        const Position& position = m_positions[pos];
+        if (position.kind == eACCEPT && (is_directory || !m_rules[position.value].directory_only))
+        {
+            rule = std::max(rule, position.value);
+        }
+    }
+
+    return rule;
+}
+
+
+//  Find or make the state, with the lock held. Returns nullptr
+//  if there would be too many.
+const PathMatcher::State* PathMatcher::state_for(const Set& set) const
+{
+    auto found = m_states.find(set);
+    if (found != m_states.end())
+    {
+        return found->second.get();
+    }
+
+    if (m_states.size() >= max_states)
+    {
+        return nullptr;
+    }
+
+    auto state = std::make_unique<State>();
+    state->file_rule = decide(set, false);
+    state->dir_rule = decide(set, true);
+    for (auto& next : state->next)
+    {
+        next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    auto inserted = m_states.emplace(set, std::move(state)).first;
+    inserted->second->set = &inserted->first;
+    return inserted->second.get();
+}
+
+
+const PathMatcher::State* PathMatcher::next_state(const State* state, unsigned char ch) const
+{
+    const State* next = state->next[ch].load(std::memory_order_acquire);
+    if (next)
+    {
+        return next;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    next = state->next[ch].load(std::memory_order_relaxed);
+    if (!next)
+    {
+        next = state_for(step(*state->set, ch));
+        if (next)
+        {
+            const_cast<State*>(state)->next[ch].store(next, std::memory_order_release);
+        }
+    }
+
+    return next;
+}
+
+
+void PathMatcher::compile()
+{
+    Set start(m_starts.begin(), m_starts.end());
+    close_over(start);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_states.clear();
+    m_start = state_for(start);
+}
+
+
+int PathMatcher::match(std::string_view path, bool is_directory) const
+{
+    if (m_rules.empty())
+    {
+        return eNO_MATCH;
+    }
+
+    int rule = -1;
+    const State* state = m_start;
+    size_t size = path.size();
+    size_t ix = 0;
+    for (; ix < size && !state->set->empty(); ++ix)
+    {
+        const State* next = next_state(state, static_cast<unsigned char>(path[ix]));
+        if (!next)
+        {
+            break;
+        }
+
+        state = next;
+    }
+
+    if (ix == size || state->set->empty())
+    {
+        rule = is_directory ? state->dir_rule : state->file_rule;
+    }
+    else
+    {
+        //  Out of states, so go on the slow way
+        Set set = *state->set;
+        for (; ix < size && !set.empty(); ++ix)
+        {
+            set = step(set, static_cast<unsigned char>(path[ix]));
+        }
+
+        rule = decide(set, is_directory);
+    }
+
+    if (rule < 0)
+    {
+        return eNO_MATCH;
+    }
+
+    return m_rules[rule].negated ? eNEGATED : eMATCH;
+}
@@ -0,0 +1,119 @@
+/*
+    Glob patterns for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <bitset>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//  A set of rules in the .gitignore syntax, matched against relative
+//  paths all at once.
+//
+//  A rule without a slash matches the name at any depth, and one with
+//  a slash matches the whole path. A trailing slash matches directories
+//  only, and a leading '!' negates the rule. '*', '?', and '[...]' never
+//  match a slash, but "**" between slashes matches any number of
+//  directories. The last rule that matches decides.
+//
+//  All the rules are compiled into one automaton, and its deterministic
+//  states are built as the paths need them. Once built, a state is never
+//  changed again, so matching takes no locks, and costs the same for any
+//  number of rules: one step per character of the path.
+//
+class PathMatcher
+{
+public:
+    PathMatcher();
+    ~PathMatcher();
+
+    PathMatcher(const PathMatcher&) = delete;
+    PathMatcher& operator=(const PathMatcher&) = delete;
+
+    //  Add one rule. Blank lines and comments are ignored.
+    void add(std::string_view rule);
+
+    //  Add the rules from the text of a .gitignore file
+    void add_lines(std::string_view text);
+
+    bool empty() const { return m_rules.empty(); }
+
+    //  Must be called once all the rules are added, before matching
+    void compile();
+
+    //  What the last matching rule said
+    enum {
+        eNO_MATCH,
+        eMATCH,
+        eNEGATED,  // Matched a rule beginning with '!'
+    };
+
+    //  The path is relative, with '/' as the separator
+    int match(std::string_view path, bool is_directory) const;
+
+private:
+    //  Positions within the rules, in one numbering for all of them
+    enum Kind {
+        eCHAR,       // The character
+        eANY,        // '?', any character but '/'
+        eCLASS,      // [...]
+        eSTAR,       // '*', any number of characters but '/'
+        eEVERYTHING, // Anything at all, slashes included
+        eDIRS,       // "**/", the start of a directory name, or skip them all
+        eDIRS_NAME,  // Within a directory name of "**/"
+        eACCEPT,     // End of a rule
+    };
+
+    struct Position
+    {
+        Kind kind;
+        int value;  // The character, class, or rule index
+    };
+
+    struct Rule
+    {
+        bool negated;
+        bool directory_only;
+    };
+
+    struct State;
+    using Set = std::vector<int>;
+
+    bool parse(std::string_view text);
+    void close_over(Set& set) const;
+    Set step(const Set& set, unsigned char ch) const;
+    int decide(const Set& set, bool is_directory) const;
+    const State* state_for(const Set& set) const;
+    const State* next_state(const State* state, unsigned char ch) const;
+
+    std::vector<Rule> m_rules;
+    std::vector<Position> m_positions;
+    std::vector<int> m_starts;  // First position of each rule
+    std::vector<std::bitset<256>> m_classes;
+
+    //  The deterministic states built so far. Creating or adding a
+    //  transition takes the lock, following one doesn't.
+    mutable std::mutex m_mutex;
+    mutable std::map<Set, std::unique_ptr<State>> m_states;
+    const State* m_start = nullptr;
+};
@@ -0,0 +1,944 @@
+//  Reporting the results of source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "reporter.h"
+#include "classifier.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+//  Buffers are written out when they grow this big
+constexpr size_t flush_size = 64 * 1024;
+
+struct ErrorInfo
+{
+    unsigned bit;
+    const char* id;       // For JSON and SARIF
+    const char* message;  // For the text report
+};
+
+//  In the order the text report lists them
+const ErrorInfo error_infos[] = {
+    {err_not_a_text_file, "not-a-text-file", "binary data. Probably not a text file."},
+    {err_invalid_encoding, "invalid-encoding", "invalid encoding. Possibly UTF-16"},
+    {err_utf16_encoding, "utf16-encoding", "UTF-16 encoding"},
+    {err_invalid_characters, "invalid-characters", "invalid characters"},
+    {err_tabs, "tabs", "tabs"},
+    {err_unusual_whitespace, "unusual-whitespace", "unusual whitespace"},
+    {err_trailing_whitespace, "trailing-whitespace", "trailing whitespace"},
+    {err_cr_lf_line_endings, "cr-lf-line-endings", "CR-LF line endings"},
+    {err_no_lf_at_end, "no-lf-at-end", "no line feed at end"},
+};
+
+const ErrorInfo& info_of(unsigned bit)
+{
+    for (const auto& info : error_infos)
+    {
+        if (info.bit == bit)
+        {
+            return info;
+        }
+    }
+
+    return error_infos[0];
+}
+
+//  Order paths like a tree walk would, a directory right before
+//  its contents. A plain string compare would put "a-b" between
+//  "a" and "a/c", so treat the separator as the lowest character.
+bool path_less(const Reporter::Record& a, const Reporter::Record& b)
+{
+    const std::string& x = a.path;
+    const std::string& y = b.path;
+    size_t size = std::min(x.size(), y.size());
+    for (size_t ix = 0; ix < size; ++ix)
+    {
+        unsigned char cx = x[ix];
+        unsigned char cy = y[ix];
+        if (cx != cy)
+        {
+            cx = (cx == '/') ? 0 : cx;
+            cy = (cy == '/') ? 0 : cy;
+            return cx < cy;
+        }
+    }
+
+    return x.size() < y.size();
+}
+
+//  The size of the valid UTF-8 sequence at the position, or zero. The
+//  ranges of the second byte rule out overlong forms, surrogates, and
+//  code points above U+10FFFF.
+size_t utf8_size(const std::string& text, size_t pos)
+{
+    unsigned char lead = text[pos];
+    size_t size = 0;
+    unsigned char low = 0x80;
+    unsigned char high = 0xbf;
+    if (lead >= 0xc2 && lead <= 0xdf)
+    {
+        size = 2;
+    }
+    else if (lead >= 0xe0 && lead <= 0xef)
+    {
+        size = 3;
+        low = (lead == 0xe0) ? 0xa0 : 0x80;
+        high = (lead == 0xed) ? 0x9f : 0xbf;
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4)
+    {
+        size = 4;
+        low = (lead == 0xf0) ? 0x90 : 0x80;
+        high = (lead == 0xf4) ? 0x8f : 0xbf;
+    }
+
+    if (size == 0 || pos + size > text.size())
+    {
+        return 0;
+    }
+
+    for (size_t ix = 1; ix < size; ++ix)
+    {
+        unsigned char byte = text[pos + ix];
+        if (byte < low || byte > high)
+        {
+            return 0;
+        }
+
+        low = 0x80;
+        high = 0xbf;
+    }
+
+    return size;
+}
+
+//  A JSON string. Valid UTF-8 is passed as it is. A file name may have
+//  any other bytes too, and each of those is written as a lone surrogate
+//  from U+DC80 to U+DCFF, like Python's "surrogateescape" does, so that
+//  the output is still valid JSON and the name can be had back.
+void add_json_string(std::string& out, const std::string& text)
+{
+    out += '"';
+    for (size_t pos = 0; pos < text.size(); ++pos)
+    {
+        char ch = text[pos];
+        unsigned char byte = ch;
+        if (ch == '"' || ch == '\\')
+        {
+            out += '\\';
+            out += ch;
+        }
+        else if (byte < ' ' || (byte >= 0x80 && utf8_size(text, pos) == 0))
+        {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", byte < ' ' ? byte : 0xdc00 | byte);
+            out += escape;
+        }
+        else if (byte >= 0x80)
+        {
+            size_t size = utf8_size(text, pos);
+            out.append(text, pos, size);
+            pos += size - 1;
+        }
+        else
+        {
+            out += ch;
+        }
+    }
+
+    out += '"';
+}
+
+//  A "file://" URI for an absolute path
+std::string file_uri(const std::string& path)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string uri = "file://";
+    for (char ch : path)
+    {
+        unsigned char byte = ch;
+        bool plain = (byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z') ||
+                     (byte >= '0' && byte <= '9') || std::strchr("/-._~", ch);
+        if (plain && byte != 0)
+        {
+            uri += ch;
+        }
+        else
+        {
+            uri += '%';
+            uri += hex[byte >> 4];
+            uri += hex[byte & 0x0f];
+        }
+    }
+
+    return uri;
+}
+
+//  Just enough of JSON to read back the JSON Lines reports. Anything
+//  unknown is skipped, so reports from newer versions can be read too.
+class JsonInput
+{
+public:
+    explicit JsonInput(std::string_view text) : m_text(text) { }
+
+    //  Skips the spaces, and the character if it's the next one
+    bool take(char ch)
+    {
+        while (m_pos < m_text.size() && is_space(m_text[m_pos]))
+        {
+            ++m_pos;
+        }
+
+        if (m_pos < m_text.size() && m_text[m_pos] == ch)
+        {
+            ++m_pos;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool at_end()
+    {
+        take(' ');
+        return m_pos == m_text.size();
+    }
+
+    bool string(std::string& out);
+    bool number(long& value);
+    bool boolean(bool& value);
+    bool skip_value();
+
+private:
+    bool word(const char* text)
+    {
+        size_t size = std::strlen(text);
+        if (m_text.substr(m_pos, size) != text)
+        {
+            return false;
+        }
+
+        m_pos += size;
+        return true;
+    }
+
+    static bool is_space(char ch)
+    {
+        return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+    }
+
+    static bool is_number_part(char ch)
+    {
+        return (ch >= '0' && ch <= '9') || ch == '.' || ch == 'e' || ch == 'E' || ch == '+' ||
+               ch == '-';
+    }
+
+    //  The four hex digits of a \\u escape
+    bool hex_code(unsigned& code);
+    static void add_utf8(std::string& out, unsigned code);
+
+    std::string_view m_text;
+    size_t m_pos = 0;
+};
+
+bool JsonInput::string(std::string& out)
+{
+    out.clear();
+    if (!take('"'))
+    {
+        return false;
+    }
+
+    while (m_pos < m_text.size())
+    {
+        char ch = m_text[m_pos++];
+        if (ch == '"')
+        {
+            return true;
+        }
+
+        if (ch != '\\')
+        {
+            out += ch;
+            continue;
+        }
+
+        if (m_pos == m_text.size())
+        {
+            break;
+        }
+
+        ch = m_text[m_pos++];
+        switch (ch)
+        {
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u':
+        {
+            unsigned code = 0;
+            if (!hex_code(code))
+            {
+                return false;
+            }
+
+            //  A surrogate pair, from some other program
+            if (code >= 0xd800 && code < 0xdc00 && m_text.substr(m_pos, 2) == "\\u")
+            {
+                size_t after = m_pos;
+                unsigned low = 0;
+                m_pos += 2;
+                if (hex_code(low) && low >= 0xdc00 && low < 0xe000)
+                {
+                    add_utf8(out, 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00));
+                    break;
+                }
+
+                m_pos = after;
+            }
+
+            if (code >= 0xdc80 && code <= 0xdcff)
+            {
+                out += char(code & 0xff);  // A byte that wasn't UTF-8
+                break;
+            }
+
+            add_utf8(out, code);
+            break;
+        }
+
+        default:  // Quotes, backslashes and slashes
+            out += ch;
+            break;
+        }
+    }
+
+    return false;
+}
+
+bool JsonInput::hex_code(unsigned& code)
+{
+    code = 0;
+    for (int ix = 0; ix < 4; ++ix)
+    {
+        char digit = m_pos < m_text.size() ? m_text[m_pos++] : 0;
+        const char* hex = "0123456789abcdef";
+        const char* found = digit ? std::strchr(hex, digit | 0x20) : nullptr;
+        if (!found)
+        {
+            return false;
+        }
+
+        code = code * 16 + unsigned(found - hex);
+    }
+
+    return true;
+}
+
+void JsonInput::add_utf8(std::string& out, unsigned code)
+{
+    //  Any other lone surrogates are left as they are
+    if (code < 0x80)
+    {
+        out += char(code);
+    }
+    else if (code < 0x800)
+    {
+        out += char(0xc0 | (code >> 6));
+        out += char(0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000)
+    {
+        out += char(0xe0 | (code >> 12));
+        out += char(0x80 | ((code >> 6) & 0x3f));
+        out += char(0x80 | (code & 0x3f));
+    }
+    else
+    {
+        out += char(0xf0 | (code >> 18));
+        out += char(0x80 | ((code >> 12) & 0x3f));
+        out += char(0x80 | ((code >> 6) & 0x3f));
+        out += char(0x80 | (code & 0x3f));
+    }
+}
+
+bool JsonInput::number(long& value)
+{
+    take(' ');
+    const char* begin = m_text.data() + m_pos;
+    const char* end = m_text.data() + m_text.size();
+    auto result = std::from_chars(begin, end, value);
+    if (result.ec != std::errc() || result.ptr == begin)
+    {
+        return false;
+    }
+
+    m_pos += size_t(result.ptr - begin);
+    return true;
+}
+
+bool JsonInput::boolean(bool& value)
+{
+    take(' ');
+    value = word("true");
+    return value || word("false");
+}
+
+bool JsonInput::skip_value()
+{
+    std::string text;
+    long value = 0;
+    bool flag = false;
+    if (take('['))
+    {
+        if (take(']'))
+        {
+            return true;
+        }
+
+        do
+        {
+            if (!skip_value())
+            {
+                return false;
+            }
+        } while (take(','));
+
+        return take(']');
+    }
+
+    if (take('{'))
+    {
+        if (take('}'))
+        {
+            return true;
+        }
+
+        do
+        {
+            if (!string(text) || !take(':') || !skip_value())
+            {
+                return false;
+            }
+        } while (take(','));
+
+        return take('}');
+    }
+
+    if (m_pos < m_text.size() && m_text[m_pos] == '"')
+    {
+        return string(text);
+    }
+
+    if (boolean(flag) || word("null"))
+    {
+        return true;
+    }
+
+    //  Only the integer part of a number with a fraction, which is fine
+    //  for skipping, since what follows it isn't taken as anything else
+    if (!number(value))
+    {
+        return false;
+    }
+
+    while (m_pos < m_text.size() && is_number_part(m_text[m_pos]))
+    {
+        ++m_pos;
+    }
+
+    return true;
+}
+
+//  An error bit by the id in the reports, zero if unknown
+unsigned bit_of(const std::string& id)
+{
+    for (const auto& info : error_infos)
+    {
+        if (id == info.id)
+        {
+            return info.bit;
+        }
+    }
+
+    return 0;
+}
+
+bool parse_location(JsonInput& input, Locator::Location& location)
+{
+    location = Locator::Location{0, 0, 0, 0};
+    if (!input.take('{'))
+    {
+        return false;
+    }
+
+    if (input.take('}'))
+    {
+        return true;
+    }
+
+    std::string key;
+    std::string id;
+    do
+    {
+        if (!input.string(key) || !input.take(':'))
+        {
+            return false;
+        }
+
+        bool ok;
+        if (key == "error")
+        {
+            ok = input.string(id);
+            location.error = bit_of(id);
+        }
+        else if (key == "line")
+        {
+            ok = input.number(location.line);
+        }
+        else if (key == "column")
+        {
+            ok = input.number(location.column);
+        }
+        else if (key == "end_column")
+        {
+            ok = input.number(location.end_column);
+        }
+        else
+        {
+            ok = input.skip_value();
+        }
+
+        if (!ok)
+        {
+            return false;
+        }
+    } while (input.take(','));
+
+    return input.take('}');
+}
+
+}  // namespace
+
+
+void Reporter::write(std::vector<Records>& per_worker)
+{
+    Records all;
+    for (auto& records : per_worker)
+    {
+        std::move(records.begin(), records.end(), std::back_inserter(all));
+        records.clear();
+    }
+
+    std::stable_sort(all.begin(), all.end(), path_less);
+    for (const auto& record : all)
+    {
+        add(record);
+    }
+
+    flush(true);
+}
+
+
+void Reporter::write(Record& record)
+{
+    add(record);
+    flush(true);
+}
+
+
+void Reporter::finish()
+{
+    if (m_format == eSARIF)
+    {
+        m_out += "{\"$schema\":\"https://json.schemastore.org/sarif-2.1.0.json\","
+                 "\"version\":\"2.1.0\",\"runs\":[{\"tool\":{\"driver\":"
+                 "{\"name\":\"source_normalizer\",\"rules\":[";
+
+        const char* separator = "";
+        for (const auto& info : error_infos)
+        {
+            m_out += separator;
+            m_out += "{\"id\":\"";
+            m_out += info.id;
+            m_out += "\",\"shortDescription\":{\"text\":";
+            add_json_string(m_out, info.message);
+            m_out += "},\"defaultConfiguration\":{\"level\":\"";
+            m_out += is_fixable(info.bit) ? "warning" : "error";
+            m_out += "\"}}";
+            separator = ",";
+        }
+
+        m_out += "]}},\"results\":[";
+        m_out += m_sarif_results;
+        m_out += "]}]}\n";
+        m_sarif_results.clear();
+        m_has_sarif_results = false;
+    }
+
+    flush(true);
+}
+
+
+std::string Reporter::describe(unsigned errors)
+{
+    std::string text;
+    append_description(text, errors);
+    return text;
+}
+
+
+void Reporter::append_description(std::string& text, unsigned errors)
+{
+    size_t start = text.size();
+    for (const auto& info : error_infos)
+    {
+        if (errors & info.bit)
+        {
+            if (text.size() > start)
+            {
+                text += ", ";
+            }
+
+            text += info.message;
+        }
+    }
+
+    //  Add an "and" if needed to make the message nicer
+    auto pos = text.rfind(',');
+    if (pos != std::string::npos && pos >= start)
+    {
+        text.insert(pos + 1, " and");
+    }
+}
+
+
+bool Reporter::parse_json(std::string_view line, Record& record)
+{
+    record = Record();
+    record.examined = true;
+    JsonInput input(line);
+    if (!input.take('{'))
+    {
+        return false;
+    }
+
+    //  The mask says it all, the names are for when there's no mask
+    bool has_path = false;
+    bool has_mask = false;
+    unsigned named = 0;
+    std::string key;
+    std::string id;
+    long value = 0;
+    if (!input.take('}'))
+    {
+        do
+        {
+            if (!input.string(key) || !input.take(':'))
+            {
+                return false;
+            }
+
+            bool ok;
+            if (key == "path")
+            {
+                ok = has_path = input.string(record.path);
+            }
+            else if (key == "mask")
+            {
+                ok = has_mask = input.number(value);
+                record.errors = unsigned(value);
+            }
+            else if (key == "errors")
+            {
+                ok = input.take('[');
+                if (ok && !input.take(']'))
+                {
+                    do
+                    {
+                        ok = input.string(id);
+                        named |= bit_of(id);
+                    } while (ok && input.take(','));
+
+                    ok = ok && input.take(']');
+                }
+            }
+            else if (key == "fixed")
+            {
+                ok = input.boolean(record.fixed);
+            }
+            else if (key == "invalid_characters")
+            {
+                ok = input.number(record.invalid_count);
+            }
+            else if (key == "non_ascii")
+            {
+                ok = input.number(record.non_ascii_count);
+            }
+            else if (key == "locations")
+            {
+                ok = input.take('[');
+                if (ok && !input.take(']'))
+                {
+                    do
+                    {
+                        record.locations.emplace_back();
+                        ok = parse_location(input, record.locations.back());
+                    } while (ok && input.take(','));
+
+                    ok = ok && input.take(']');
+                }
+            }
+            else if (key == "omitted_locations")
+            {
+                ok = input.number(record.omitted_locations);
+            }
+            else
+            {
+                ok = input.skip_value();
+            }
+
+            if (!ok)
+            {
+                return false;
+            }
+        } while (input.take(','));
+
+        if (!input.take('}'))
+        {
+            return false;
+        }
+    }
+
+    if (!has_mask)
+    {
+        record.errors = named;
+    }
+
+    return has_path && input.at_end();
+}
+
+
+void Reporter::add(const Record& record)
+{
+    switch (m_format)
+    {
+    case eTEXT:
+        add_text(record);
+        return;
+
+    case eJSONL:
+        add_json(record);
+        break;
+
+    case eSARIF:
+        add_sarif(record);
+        break;
+    }
+
+    //  The standard output is kept for the machines
+    m_err += record.verbose;
+    m_err += record.problems;
+    flush(false);
+}
+
+
+void Reporter::add_text(const Record& record)
+{
+    m_out += record.verbose;
+    m_out += record.diff;
+    if (record.errors != 0)
+    {
+        m_err += "File: ";
+        m_err += record.path;
+        m_err += " has ";
+        append_description(m_err, record.errors);
+        m_err += '\n';
+    }
+
+    //  The same form as compiler messages, so editors can jump to them
+    char line[64];
+    for (const auto& location : record.locations)
+    {
+        std::snprintf(line, sizeof(line), ":%ld:%ld: ", location.line, location.column);
+        m_err += record.path;
+        m_err += line;
+        m_err += info_of(location.error).message;
+        m_err += '\n';
+    }
+
+    if (record.omitted_locations > 0)
+    {
+        m_err += record.path;
+        m_err += ": " + std::to_string(record.omitted_locations) + " more not shown\n";
+    }
+
+    m_err += record.problems;
+    flush(false);
+}
+
+
+void Reporter::add_json(const Record& record)
+{
+    if (!record.examined || (record.errors == 0 && !m_report_clean))
+    {
+        return;
+    }
+
+    m_out += "{\"path\":";
+    add_json_string(m_out, record.path);
+    m_out += ",\"errors\":[";
+    const char* separator = "";
+    for (const auto& info : error_infos)
+    {
+        if (record.errors & info.bit)
+        {
+            m_out += separator;
+            m_out += '"';
+            m_out += info.id;
+            m_out += '"';
+            separator = ",";
+        }
+    }
+
+    m_out += "],\"mask\":" + std::to_string(record.errors);
+    m_out += ",\"fixable\":";
+    m_out += is_fixable(record.errors) ? "true" : "false";
+    m_out += ",\"fixed\":";
+    m_out += record.fixed ? "true" : "false";
+    m_out += ",\"invalid_characters\":" + std::to_string(record.invalid_count);
+    m_out += ",\"non_ascii\":" + std::to_string(record.non_ascii_count);
+    if (!record.locations.empty())
+    {
+        m_out += ",\"locations\":[";
+        separator = "";
+        for (const auto& location : record.locations)
+        {
+            m_out += separator;
+            m_out += "{\"error\":\"";
+            m_out += info_of(location.error).id;
+            m_out += "\",\"line\":" + std::to_string(location.line);
+            m_out += ",\"column\":" + std::to_string(location.column);
+            m_out += ",\"end_column\":" + std::to_string(location.end_column);
+            m_out += '}';
+            separator = ",";
+        }
+
+        m_out += "],\"omitted_locations\":" + std::to_string(record.omitted_locations);
+    }
+
+    m_out += "}\n";
+}
+
+
+void Reporter::add_sarif(const Record& record)
+{
+    //  A result for each error, or for each location of it if known,
+    //  the way the checkers usually do it
+    std::string uri;
+    for (size_t ix = 0; ix < std::size(error_infos); ++ix)
+    {
+        const auto& info = error_infos[ix];
+        if (!(record.errors & info.bit))
+        {
+            continue;
+        }
+
+        if (uri.empty())
+        {
+            uri = file_uri(record.path);
+        }
+
+        bool located = false;
+        for (const auto& location : record.locations)
+        {
+            if (location.error == info.bit)
+            {
+                add_sarif_result(record, ix, uri, &location);
+                located = true;
+            }
+        }
+
+        if (!located)
+        {
+            add_sarif_result(record, ix, uri, nullptr);
+        }
+    }
+}
+
+
+void Reporter::add_sarif_result(const Record& record, size_t rule, const std::string& uri,
+                                const Locator::Location* location)
+{
+    const auto& info = error_infos[rule];
+    std::string& out = m_sarif_results;
+    if (m_has_sarif_results)
+    {
+        out += ',';
+    }
+
+    m_has_sarif_results = true;
+    out += "\n{\"ruleId\":\"";
+    out += info.id;
+    out += "\",\"ruleIndex\":" + std::to_string(rule);
+    out += ",\"level\":\"";
+    out += is_fixable(record.errors) ? "warning" : "error";
+    out += "\",\"message\":{\"text\":";
+    add_json_string(out, info.message);
+    out += "},\"locations\":[{\"physicalLocation\":{\"artifactLocation\":{\"uri\":";
+    add_json_string(out, uri);
+    out += '}';
+    if (location)
+    {
+        out += ",\"region\":{\"startLine\":" + std::to_string(location->line);
+        out += ",\"startColumn\":" + std::to_string(location->column);
+        out += ",\"endColumn\":" + std::to_string(location->end_column);
+        out += '}';
+    }
+
+    out += "}}],\"properties\":{\"fixed\":";
+    out += record.fixed ? "true" : "false";
+    out += "}}";
+}
+
+
+void Reporter::flush(bool all)
+{
+    if (all || m_out.size() >= flush_size)
+    {
+        std::cout.write(m_out.data(), m_out.size());
+        m_out.clear();
+        if (all)
+        {
+            std::cout.flush();
+        }
+    }
+
+    if (all || m_err.size() >= flush_size)
+    {
+        std::cerr.write(m_err.data(), m_err.size());
+        m_err.clear();
+    }
+}
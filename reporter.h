@@ -0,0 +1,108 @@
+/*
+    Reporting the results of source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "locator.h"
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//  Turns the results into text for people, or into JSON Lines or SARIF
+//  for other programs.
+//
+//  The workers only collect the plain facts about each file, in buffers
+//  of their own. Nothing is formatted until the results are written out,
+//  and then everything goes into one big buffer that is written with a
+//  few large writes, instead of a small write for every line.
+//
+class Reporter
+{
+public:
+    enum Format {
+        eTEXT,   // Sentences on the standard error, like always
+        eJSONL,  // One JSON object per line on the standard output
+        eSARIF,  // One SARIF 2.1.0 log on the standard output
+    };
+
+    //  Everything found out about one file or directory
+    struct Record
+    {
+        std::string path;
+        unsigned errors = 0;        // The error bits from the classifier
+        long invalid_count = 0;     // Bytes counted as invalid characters
+        long non_ascii_count = 0;   // Characters outside ASCII, if it was UTF-16
+        bool fixed = false;
+        bool examined = false;      // There are results, not just messages
+        std::vector<Locator::Location> locations;
+        long omitted_locations = 0;  // Found, but too many to keep
+        std::string diff;           // What fixing it would change, for --diff
+        std::string verbose;        // What the verbose mode says about it
+        std::string problems;       // Messages about things that went wrong
+    };
+
+    using Records = std::vector<Record>;
+
+    void set_format(Format format) { m_format = format; }
+    Format format() const { return m_format; }
+
+    //  Report also the files that had no errors, so that a program
+    //  following the reports knows when a problem went away
+    void set_report_clean(bool report_clean) { m_report_clean = report_clean; }
+
+    //  Report the records in path order, and empty the per-worker lists
+    void write(std::vector<Records>& per_worker);
+
+    //  Report a single record
+    void write(Record& record);
+
+    //  Anything still held back. SARIF is written only here, since
+    //  the log is one document for the whole run.
+    void finish();
+
+    //  The errors in the words of the text report, such as
+    //  "tabs, trailing whitespace, and no line feed at end"
+    static std::string describe(unsigned errors);
+
+    //  Read back a line of the JSON Lines report, as this program writes
+    //  them, for merging reports. Returns false if it isn't one.
+    static bool parse_json(std::string_view line, Record& record);
+
+private:
+    //  The same at the end of the text, without a string of its own
+    static void append_description(std::string& text, unsigned errors);
+
+    void add(const Record& record);
+    void add_text(const Record& record);
+    void add_json(const Record& record);
+    void add_sarif(const Record& record);
+    void add_sarif_result(const Record& record, size_t rule, const std::string& uri,
+                          const Locator::Location* location);
+
+    //  Write the buffers if they are big enough, or all of it
+    void flush(bool all);
+
+    Format m_format = eTEXT;
+    bool m_report_clean = false;
+    std::string m_out;  // For the standard output
+    std::string m_err;  // For the standard error
+    std::string m_sarif_results;
+    bool m_has_sarif_results = false;
+};
@@ -0,0 +1,188 @@
+//  Persistent cache of scan results for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "scan_cache.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t fingerprint;
+    uint64_t count;
+};
+
+const char cache_magic[8] = {'S', 'N', 'C', 'A', 'C', 'H', 'E', '\0'};
+
+//  Change this whenever the classification rules change,
+//  so that results from older versions won't be used.
+constexpr uint32_t cache_version = 1;
+
+bool entry_less(const ScanCache::Entry& a, const ScanCache::Entry& b)
+{
+    if (a.device != b.device)
+        return a.device < b.device;
+
+    return a.inode < b.inode;
+}
+
+bool same_file(const ScanCache::Entry& a, const ScanCache::Entry& b)
+{
+    return a.device == b.device && a.inode == b.inode;
+}
+
+}  // namespace
+
+
+bool ScanCache::open(const std::string& path, const std::string& settings)
+{
+    m_path = path;
+    m_fingerprint = Hash::fnv1a(settings.data(), settings.size());
+
+    if (!m_file.load(path.c_str()))
+    {
+        return true;  // No cache yet
+    }
+
+    if (m_file.size() == 0)
+    {
+        return true;  // Empty is as good as none
+    }
+
+    size_t magic_size = std::min(m_file.size(), sizeof(cache_magic));
+    if (std::memcmp(m_file.data(), cache_magic, magic_size) != 0)
+    {
+        //  Don't overwrite something that isn't ours
+        std::cerr << "Error: " << path << " is not a cache file\n";
+        m_file.release();
+        m_path.clear();
+        return false;
+    }
+
+    if (m_file.size() < sizeof(Header))
+    {
+        //  Cut short while it was written, start from scratch
+        m_file.release();
+        return true;
+    }
+
+    //  The count may be anything, so it's checked without multiplying
+    Header header;
+    std::memcpy(&header, m_file.data(), sizeof(header));
+    size_t room = m_file.size() - sizeof(header);
+    if (header.version != cache_version || header.entry_size != sizeof(Entry) ||
+        header.fingerprint != m_fingerprint || header.count != room / sizeof(Entry) ||
+        room % sizeof(Entry) != 0)
+    {
+        //  Out of date, start from scratch
+        m_file.release();
+        return true;
+    }
+
+    m_entries = reinterpret_cast<const Entry*>(m_file.data() + sizeof(header));
+    m_count = header.count;
+    return true;
+}
+
+
+const ScanCache::Entry* ScanCache::find(uint64_t device, uint64_t inode) const
+{
+    Entry key = {};
+    key.device = device;
+    key.inode = inode;
+
+    const Entry* end = m_entries + m_count;
+    const Entry* found = std::lower_bound(m_entries, end, key, entry_less);
+    if (found != end && same_file(*found, key))
+    {
+        return found;
+    }
+
+    return nullptr;
+}
+
+
+void ScanCache::add(std::vector<Entry>& entries)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_added.insert(m_added.end(), entries.begin(), entries.end());
+    entries.clear();
+}
+
+
+bool ScanCache::save()
+{
+    if (!is_open())
+    {
+        return true;
+    }
+
+    //  New entries win over the old ones, and a stable merge
+    //  keeps the old ones first for each file.
+    std::stable_sort(m_added.begin(), m_added.end(), entry_less);
+    std::vector<Entry> all;
+    all.reserve(m_count + m_added.size());
+    std::merge(m_entries, m_entries + m_count, m_added.begin(), m_added.end(),
+               std::back_inserter(all), entry_less);
+
+    auto last = std::unique(all.rbegin(), all.rend(), same_file);
+    all.erase(all.begin(), last.base());
+
+    Header header = {};
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.entry_size = sizeof(Entry);
+    header.fingerprint = m_fingerprint;
+    header.count = all.size();
+
+    //  The old file may still be mapped, so write a new one and rename
+    m_file.release();
+    m_entries = nullptr;
+    m_count = 0;
+
+    std::string temp_name = m_path + ".tmp~";
+    {
+        std::ofstream output(temp_name, std::ofstream::binary | std::ofstream::trunc);
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        output.write(reinterpret_cast<const char*>(all.data()), all.size() * sizeof(Entry));
+        output.flush();
+        if (!output.good())
+        {
+            std::cerr << "Error: Could not write " << temp_name << '\n';
+            std::remove(temp_name.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(temp_name.c_str(), m_path.c_str()) != 0)
+    {
+        std::string msg = "Could not rename " + temp_name + " to " + m_path;
+        std::perror(msg.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+    Persistent cache of scan results for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "file_loader.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//  Remembers what was found in each file the last time, so that files
+//  not changed since then don't need to be read at all.
+//
+//  The cache file is a fixed size header followed by a table of entries
+//  sorted by device and inode. It's used straight from the mapped file,
+//  and rewritten as a whole when the scan is done.
+//
+class ScanCache
+{
+public:
+    //  The layout is the same as in the file
+    struct Entry
+    {
+        uint64_t device;
+        uint64_t inode;
+        uint64_t size;
+        int64_t mtime_ns;
+        uint64_t content_hash;
+        uint32_t errors;
+        uint32_t allowed;  // The rules relaxed for the file
+    };
+
+    //  The settings string describes all options that affect the results.
+    //  If it doesn't match what the cache was made with, the old entries
+    //  are ignored. Returns false if an existing file isn't a cache file.
+    bool open(const std::string& path, const std::string& settings);
+
+    bool is_open() const { return !m_path.empty(); }
+
+    //  The previous entry for the file, or nullptr
+    const Entry* find(uint64_t device, uint64_t inode) const;
+
+    //  New and updated entries. Safe to call from several threads.
+    void add(std::vector<Entry>& entries);
+
+    //  Write the old and new entries back to the file
+    bool save();
+
+private:
+    std::string m_path;
+    uint64_t m_fingerprint = 0;
+
+    FileLoader m_file;
+    const Entry* m_entries = nullptr;
+    size_t m_count = 0;
+
+    std::mutex m_mutex;
+    std::vector<Entry> m_added;
+};
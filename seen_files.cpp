@@ -0,0 +1,91 @@
+//  Files already examined in this run, for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "seen_files.h"
+
+namespace {
+
+int64_t mtime_ns(const struct stat& info)
+{
+    return int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+}
+
+}  // namespace
+
+
+bool SeenFiles::find(const struct stat& info, Findings& findings) const
+{
+    if (!remembers(info))
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_files.find({uint64_t(info.st_dev), uint64_t(info.st_ino)});
+    if (found == m_files.end() || found->second.size != uint64_t(info.st_size) ||
+        found->second.mtime_ns != mtime_ns(info))
+    {
+        return false;
+    }
+
+    findings = found->second.findings;
+    return true;
+}
+
+
+void SeenFiles::add(const struct stat& info, const Findings& findings)
+{
+    if (!remembers(info))
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_files[{uint64_t(info.st_dev), uint64_t(info.st_ino)}] =
+        File{uint64_t(info.st_size), mtime_ns(info), findings};
+}
+
+
+bool SeenFiles::find(uint64_t content_hash, uint64_t size, Findings& findings) const
+{
+    if (!by_content())
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_contents.find({content_hash, size});
+    if (found == m_contents.end())
+    {
+        return false;
+    }
+
+    findings = found->second;
+    return true;
+}
+
+
+void SeenFiles::add(uint64_t content_hash, uint64_t size, const Findings& findings)
+{
+    if (!by_content())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_contents.emplace(Key{content_hash, size}, findings);
+}
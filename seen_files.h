@@ -0,0 +1,109 @@
+/*
+    Files already examined in this run, for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "locator.h"
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+//  Remembers what was found in the files examined so far, so that a
+//  file met again through another hard link isn't read again, and a
+//  copy of a file already seen isn't classified again.
+//
+//  Only files with several links are remembered by the inode, since
+//  no other path can lead to the rest. By the contents, every file is
+//  remembered under its hash and size.
+//
+//  Safe to use from several threads. If two workers happen to examine
+//  the same file at once, both do the work, and that's all.
+//
+class SeenFiles
+{
+public:
+    enum Mode {
+        eNONE,     // Examine every path
+        eINODE,    // The same file through another hard link
+        eCONTENT,  // Also files with the same contents
+    };
+
+    //  Everything about a file that doesn't depend on the path
+    struct Findings
+    {
+        unsigned allowed = 0;  // The rules they were found with
+        unsigned errors = 0;
+        long invalid_count = 0;
+        long non_ascii_count = 0;
+        std::vector<Locator::Location> locations;
+        long omitted_locations = 0;
+    };
+
+    //  Set before any workers start
+    void set_mode(Mode mode) { m_mode = mode; }
+    bool by_inode() const { return m_mode != eNONE; }
+    bool by_content() const { return m_mode == eCONTENT; }
+
+    //  Whether the file is worth remembering by the inode
+    bool remembers(const struct stat& info) const { return by_inode() && info.st_nlink > 1; }
+
+    //  The findings for the same file, if it's been examined and
+    //  hasn't changed since
+    bool find(const struct stat& info, Findings& findings) const;
+    void add(const struct stat& info, const Findings& findings);
+
+    //  The findings for a file with the same contents
+    bool find(uint64_t content_hash, uint64_t size, Findings& findings) const;
+    void add(uint64_t content_hash, uint64_t size, const Findings& findings);
+
+private:
+    struct Key
+    {
+        uint64_t first;
+        uint64_t second;
+
+        bool operator==(const Key& other) const
+        {
+            return first == other.first && second == other.second;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            return size_t(key.first * 0x9e3779b97f4a7c15ull ^ key.second);
+        }
+    };
+
+    struct File
+    {
+        uint64_t size;
+        int64_t mtime_ns;
+        Findings findings;
+    };
+
+    Mode m_mode = eINODE;
+    mutable std::mutex m_mutex;
+    std::unordered_map<Key, File, KeyHash> m_files;         // By device and inode
+    std::unordered_map<Key, Findings, KeyHash> m_contents;  // By hash and size
+};
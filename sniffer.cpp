@@ -0,0 +1,255 @@
+//  Quick look at the beginning of a file for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sniffer.h"
+#include "classifier.h"
+#include "utf16checker.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+struct Magic
+{
+    const char* bytes;
+    size_t size;
+};
+
+// clang-format off
+#define MAGIC(text) {text, sizeof(text) - 1}
+
+//  File signatures of binary formats. The ones of text characters
+//  alone need more proof.
+const Magic magic_numbers[] = {
+    MAGIC("\x7f" "ELF"),                // ELF executables and libraries
+    MAGIC("MZ"),                        // Windows executables (PE)
+    MAGIC("\xca\xfe\xba\xbe"),          // Java classes, Mach-O fat binaries
+    MAGIC("\xfe\xed\xfa\xce"),          // Mach-O 32-bit
+    MAGIC("\xfe\xed\xfa\xcf"),          // Mach-O 64-bit
+    MAGIC("\xce\xfa\xed\xfe"),          // Mach-O 32-bit, little endian
+    MAGIC("\xcf\xfa\xed\xfe"),          // Mach-O 64-bit, little endian
+    MAGIC("\0asm"),                     // WebAssembly
+    MAGIC("!<arch>\n"),                 // Static libraries
+    MAGIC("PK\x03\x04"),                // Zip, jar, docx, ...
+    MAGIC("\x1f\x8b"),                  // gzip
+    MAGIC("BZh"),                       // bzip2
+    MAGIC("\xfd" "7zXZ\0"),             // xz
+    MAGIC("7z\xbc\xaf\x27\x1c"),        // 7-Zip
+    MAGIC("\x28\xb5\x2f\xfd"),          // zstd
+    MAGIC("\x89PNG\r\n\x1a\n"),         // PNG
+    MAGIC("\xff\xd8\xff"),              // JPEG
+    MAGIC("GIF87a"),                    // GIF
+    MAGIC("GIF89a"),                    // GIF
+    MAGIC("%PDF-"),                     // PDF
+    MAGIC("SQLite format 3\0"),         // SQLite databases
+};
+
+#undef MAGIC
+// clang-format on
+
+//  The "MZ" of a Windows executable is too short to trust on its own,
+//  so check that the header points to a "PE\0\0" signature, too.
+bool is_pe_header(const unsigned char* data, size_t size)
+{
+    if (size < 0x40)
+    {
+        return false;
+    }
+
+    size_t offset = data[0x3c] | (data[0x3d] << 8) | (data[0x3e] << 16) | (size_t(data[0x3f]) << 24);
+    return offset + 4 <= size && std::memcmp(data + offset, "PE\0\0", 4) == 0;
+}
+
+//  Same as "isprint || isspace" in the "C" locale
+bool is_normal(unsigned char ch)
+{
+    return (ch >= ' ' && ch <= '~') || (ch >= '\t' && ch <= '\r');
+}
+
+//  Never in text, not even in UTF-8 or other 8-bit encodings
+bool is_control(unsigned char ch)
+{
+    return ch < 0x80 && !is_normal(ch);
+}
+
+//  A signature of plain text characters could just as well begin a text
+//  file, like "BZh = 1;" does. It's only trusted if some other bytes in
+//  the sample couldn't be text.
+bool is_trusted(const Magic& magic, const unsigned char* data, size_t size)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(magic.bytes);
+    if (!std::all_of(bytes, bytes + magic.size, is_normal))
+    {
+        return true;
+    }
+
+    return std::any_of(data + magic.size, data + size, is_control);
+}
+
+}  // namespace
+
+
+namespace Sniffer {
+
+int sniff(const char* sample, size_t size, size_t file_size)
+{
+    if (size > file_size)
+    {
+        size = file_size;
+    }
+
+    if (has_binary_magic(sample, size))
+    {
+        return eBINARY;
+    }
+
+    if (maybe_utf16(sample, size, file_size))
+    {
+        return eMAYBE_UTF16;
+    }
+
+    //  Text has only a few odd bytes here and there, if any.
+    //  Random bytes are more than half odd.
+    size_t weird = 0;
+    for (size_t ix = 0; ix < size; ++ix)
+    {
+        weird += !is_normal(static_cast<unsigned char>(sample[ix]));
+    }
+
+    if (2 * weird > size)
+    {
+        return eBINARY;
+    }
+
+    return eUNSURE;
+}
+
+
+bool has_binary_magic(const char* sample, size_t size)
+{
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(sample);
+    for (const auto& magic : magic_numbers)
+    {
+        if (size >= magic.size && std::memcmp(data, magic.bytes, magic.size) == 0)
+        {
+            if (magic.bytes[0] == 'M')
+            {
+                return is_pe_header(data, size);
+            }
+
+            return is_trusted(magic, data, size);
+        }
+    }
+
+    return false;
+}
+
+
+bool maybe_utf16(const char* sample, size_t size, size_t file_size)
+{
+    //  The file as a whole must have an even size
+    if (file_size < 2 || (file_size & 0x0001))
+    {
+        return false;
+    }
+
+    //  The endianness is decided from the first units, which are all
+    //  in the sample, so the checker sees them just like the full check.
+    //  Any weird character or broken surrogate pair already here is
+    //  enough to reject the whole file.
+    Utf16Checker utf16;
+    utf16.start();
+    utf16.feed(sample, size);
+    return !utf16.failed() && utf16.counts().weird_ascii == 0;
+}
+
+
+bool is_elf(const char* sample, size_t size, size_t file_size)
+{
+    // clang-format off
+    return file_size > 50 && size >= 4 && std::memcmp(sample, "\x7f" "ELF", 4) == 0;
+    // clang-format on
+}
+
+
+bool is_mostly_invalid(long invalid_count, size_t file_size)
+{
+    long normal = long(file_size) - invalid_count;
+    return 5*invalid_count > normal;
+}
+
+
+bool is_utf16_text(const Utf16Checker& checker, long& non_ascii)
+{
+    auto& counts = checker.counts();
+    non_ascii = counts.total_characters - counts.normal_ascii;
+    return counts.weird_ascii == 0 && 20*non_ascii < counts.total_characters;
+}
+
+
+bool is_little_endian(const char* sample, size_t size)
+{
+    Utf16Checker utf16;
+    utf16.feed(sample, size);
+    return utf16.little_endian();
+}
+
+
+int explain_invalid(const char* sample, size_t size, size_t file_size, long invalid_count,
+                    const std::function<bool()>& is_utf16)
+{
+    if (is_elf(sample, size, file_size))
+    {
+        return eBINARY;
+    }
+
+    //  Files coming from Windows may have UTF-16 encoding.
+    //  Usually the beginning is enough to rule that out.
+    size = std::min(size, sample_size);
+    if (maybe_utf16(sample, size, file_size) && is_utf16())
+    {
+        return eUTF16;
+    }
+
+    return is_mostly_invalid(invalid_count, file_size) ? eBINARY : eUNSURE;
+}
+
+
+unsigned explained_errors(unsigned errors, int explanation, Fixer::NonAscii non_ascii,
+                          long non_ascii_count)
+{
+    switch (explanation)
+    {
+    case eBINARY:
+        return err_not_a_text_file;
+
+    case eUTF16:
+        //  Plain ASCII converts the same way whatever the policy
+        if (non_ascii == Fixer::eREJECT && non_ascii_count > 0)
+        {
+            return err_invalid_encoding;
+        }
+
+        return err_utf16_encoding;
+
+    default:
+        return errors;
+    }
+}
+
+}  // namespace Sniffer
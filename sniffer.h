@@ -0,0 +1,93 @@
+/*
+    Quick look at the beginning of a file for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "fixer.h"
+
+#include <cstddef>
+#include <functional>
+
+class Utf16Checker;
+
+//  Tells from the first few kilobytes of a file whether it's one of the
+//  well known binary formats, or obviously binary data, so that a big
+//  file can be rejected before it's loaded at all.
+//
+//  Also tells what the invalid characters found in a file mean, once
+//  it's been classified. The program and the library both decide that
+//  here, so that they give the same results.
+//
+namespace Sniffer {
+
+//  How much of the beginning is needed
+constexpr size_t sample_size = 4096;
+
+//  Smaller files are loaded right away, it's cheap enough
+constexpr size_t min_file_size = 64 * 1024;
+
+enum {
+    eUNSURE,       // Needs the full classification, or not known why invalid
+    eBINARY,       // Known binary format, or mostly binary data
+    eMAYBE_UTF16,  // Not ruled out as UTF-16 text
+    eUTF16,        // UTF-16 text, after the full check
+};
+
+//  The sample is the beginning of a file with the given total size
+int sniff(const char* sample, size_t size, size_t file_size);
+
+//  True if the beginning of the file has a binary file signature. One
+//  made of text characters, like "%PDF-", also needs control characters
+//  in the sample, or it could be the beginning of any text.
+bool has_binary_magic(const char* sample, size_t size);
+
+//  False if the sample already rules out the file being accepted
+//  as UTF-16 text. The full check is needed to be sure of a yes.
+bool maybe_utf16(const char* sample, size_t size, size_t file_size);
+
+//  ELF binaries begin with "\x7fELF" and the ELF header is at least 52
+//  bytes long
+bool is_elf(const char* sample, size_t size, size_t file_size);
+
+//  Plenty of bytes that are neither printable nor whitespace, as the
+//  classifier counts them, suggest a binary file
+bool is_mostly_invalid(long invalid_count, size_t file_size);
+
+//  True if a file that passed the full UTF-16 check is also text: no
+//  weird characters in the ASCII range, and only about 5% outside of
+//  ASCII. Those are counted in non_ascii.
+bool is_utf16_text(const Utf16Checker& checker, long& non_ascii);
+
+//  The byte order of UTF-16 text, decided from the beginning
+bool is_little_endian(const char* sample, size_t size);
+
+//  Why a file has invalid characters: eBINARY, eUTF16, or eUNSURE.
+//  The sample is the beginning of the file, and the invalid count is
+//  from the classifier. The full UTF-16 check is made by the function
+//  given, as the file may not all be in memory, and only if the sample
+//  doesn't already rule it out.
+int explain_invalid(const char* sample, size_t size, size_t file_size, long invalid_count,
+                    const std::function<bool()>& is_utf16);
+
+//  The errors for a file with invalid characters, once explained.
+//  Whether UTF-16 can be converted depends on the policy for the
+//  characters outside ASCII.
+unsigned explained_errors(unsigned errors, int explanation, Fixer::NonAscii non_ascii,
+                          long non_ascii_count);
+
+}  // namespace Sniffer
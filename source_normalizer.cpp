@@ -0,0 +1,125 @@
+//  Library interface of source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "source_normalizer.h"
+#include "sniffer.h"
+#include "utf16checker.h"
+
+#include <algorithm>
+
+namespace {
+
+using SourceNormalizer::Result;
+using SourceNormalizer::Settings;
+
+//  Replace the invalid characters error with a better explanation,
+//  the same way the normalizer does for files
+void explain_invalid(const char* data, size_t size, const Settings& settings, Result& result)
+{
+    auto is_utf16 = [&]() {
+        Utf16Checker utf16;
+        utf16.start();
+        utf16.feed(data, size);
+        return utf16.finish() == Utf16Checker::eOK &&
+               Sniffer::is_utf16_text(utf16, result.non_ascii_count);
+    };
+
+    int type = Sniffer::explain_invalid(data, size, size, result.invalid_count, is_utf16);
+    result.errors =
+        Sniffer::explained_errors(result.errors, type, settings.non_ascii, result.non_ascii_count);
+    if (type != Sniffer::eUTF16)
+    {
+        result.non_ascii_count = 0;
+    }
+}
+
+//  Convert from UTF-16 while fixing, false if it can't be done
+bool convert(const char* data, size_t size, const Settings& settings, std::vector<char>& output,
+             size_t& output_size)
+{
+    bool little_endian = Sniffer::is_little_endian(data, size);
+    Fixer::Utf16Stream converter(settings.tab_width, little_endian, settings.non_ascii);
+
+    output_size = converter.feed(data, size, output);
+    std::vector<char> rest;
+    size_t rest_size = converter.finish(rest);
+    if (converter.failed())
+    {
+        return false;
+    }
+
+    if (output.size() < output_size + rest_size)
+    {
+        output.resize(output_size + rest_size);
+    }
+
+    std::copy(rest.begin(), rest.begin() + rest_size, output.begin() + output_size);
+    output_size += rest_size;
+    return true;
+}
+
+}  // namespace
+
+
+namespace SourceNormalizer {
+
+Result normalize(const char* data, size_t size, const Settings& settings,
+                 std::vector<char>* output)
+{
+    Result result;
+
+    //  Big binary files are recognized by the beginning alone
+    size_t sample = std::min(size, Sniffer::sample_size);
+    if (size >= Sniffer::min_file_size && Sniffer::sniff(data, sample, size) == Sniffer::eBINARY)
+    {
+        result.errors = err_not_a_text_file;
+        return result;
+    }
+
+    Classifier::State state;
+    state.allowed = settings.allowed;
+    Classifier::feed(state, data, size);
+    result.errors = Classifier::errors(state);
+    result.invalid_count = state.invalid_count;
+    if (result.errors & err_invalid_characters)
+    {
+        explain_invalid(data, size, settings, result);
+    }
+
+    if (!output || !is_fixable(result.errors))
+    {
+        return result;
+    }
+
+    if (result.errors & err_utf16_encoding)
+    {
+        result.fixed = convert(data, size, settings, *output, result.size);
+        if (!result.fixed)
+        {
+            result.size = 0;
+        }
+    }
+    else
+    {
+        result.size = Fixer::fix(data, size, settings.tab_width, *output, settings.allowed);
+        result.fixed = true;
+    }
+
+    return result;
+}
+
+}  // namespace SourceNormalizer
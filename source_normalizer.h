@@ -0,0 +1,60 @@
+/*
+    Library interface of source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "classifier.h"
+#include "fixer.h"
+
+#include <cstddef>
+#include <vector>
+
+//  Checking and fixing text that is already in memory, for programs
+//  that want to do it without files or a separate process. Built as
+//  libsource_normalizer.a with "make lib".
+//
+//  The results are the same the program gives for a file with the same
+//  contents. Nothing here touches the filesystem, prints anything, or
+//  keeps any state between the calls, so any number of threads may use
+//  it at the same time.
+//
+namespace SourceNormalizer {
+
+struct Settings
+{
+    int tab_width = 4;
+    Fixer::NonAscii non_ascii = Fixer::eREJECT;
+    unsigned allowed = 0;  // The rules relaxed, the allow_ bits
+};
+
+struct Result
+{
+    unsigned errors = 0;       // The error bits, see classifier.h
+    long invalid_count = 0;    // Bytes counted as invalid characters
+    long non_ascii_count = 0;  // Characters outside ASCII, if it was UTF-16
+    bool fixed = false;        // The output has the fixed text
+    size_t size = 0;           // Size of the fixed text
+};
+
+//  Examine the text. If there's an output, and the errors are fixable,
+//  the fixed text also replaces the contents of the output. Like with
+//  Fixer::fix, the vector is only grown, so it can be reused.
+Result normalize(const char* data, size_t size, const Settings& settings,
+                 std::vector<char>* output = nullptr);
+
+}  // namespace SourceNormalizer
@@ -0,0 +1,141 @@
+//  Classifying and fixing one big text in parallel for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "splitter.h"
+#include "buffer_pool.h"
+#include "fixer.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+namespace {
+
+//  Run the work for each piece, the first one on the calling thread and
+//  the others on the workers. Only waits for its own pieces, not for
+//  whatever else the workers were given.
+template <typename Work>
+void run_pieces(WorkerPool& workers, size_t pieces, Work work)
+{
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t left = pieces - 1;
+    for (size_t ix = 1; ix < pieces; ++ix)
+    {
+        workers.submit([&, ix](int) {
+            work(ix);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--left == 0)
+            {
+                done.notify_one();
+            }
+        });
+    }
+
+    work(size_t(0));
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]() { return left == 0; });
+}
+
+//  The workers, and the caller too
+int piece_count(const WorkerPool& workers)
+{
+    return workers.size() + 1;
+}
+
+}  // namespace
+
+
+namespace Splitter {
+
+
+std::vector<size_t> split(const char* data, size_t size, int pieces)
+{
+    std::vector<size_t> starts = {0};
+    size_t count = std::min<size_t>(std::max(pieces, 1), size / min_piece_size);
+    for (size_t ix = 1; ix < count; ++ix)
+    {
+        //  Just after the first line feed from the even split on
+        size_t from = std::max(size / count * ix, starts.back());
+        auto found = static_cast<const char*>(std::memchr(data + from, '\n', size - from));
+        if (!found || size_t(found + 1 - data) == size)
+        {
+            break;
+        }
+
+        size_t start = found + 1 - data;
+        if (start > starts.back())
+        {
+            starts.push_back(start);
+        }
+    }
+
+    return starts;
+}
+
+
+Classifier::State classify(const char* data, size_t size, unsigned allowed,
+                           WorkerPool& workers)
+{
+    std::vector<size_t> starts = split(data, size, piece_count(workers));
+    starts.push_back(size);
+
+    size_t pieces = starts.size() - 1;
+    std::vector<Classifier::State> states(pieces);
+    run_pieces(workers, pieces, [&](size_t ix) {
+        states[ix].allowed = allowed;
+        Classifier::feed(states[ix], data + starts[ix], starts[ix + 1] - starts[ix]);
+    });
+
+    Classifier::State state = states[0];
+    for (size_t ix = 1; ix < pieces; ++ix)
+    {
+        Classifier::join(state, states[ix]);
+    }
+
+    return state;
+}
+
+
+void fix(const char* data, size_t size, int tab_width, unsigned allowed, WorkerPool& workers,
+         BufferPool& buffers, std::vector<Piece>& pieces)
+{
+    std::vector<size_t> starts = split(data, size, piece_count(workers));
+    starts.push_back(size);
+
+    //  The buffer pool is for this thread only, so the buffers are taken
+    //  here. The fixer grows one if tabs make the piece longer.
+    pieces.resize(starts.size() - 1);
+    for (size_t ix = 0; ix < pieces.size(); ++ix)
+    {
+        pieces[ix].buffer = buffers.take(starts[ix + 1] - starts[ix] + 3);
+    }
+
+    run_pieces(workers, pieces.size(), [&](size_t ix) {
+        //  Only the last line can depend on how the one before it ended
+        size_t start = starts[ix];
+        bool after_cr_lf = (allowed & allow_cr_lf) && ix > 0 && start >= 2 &&
+                           data[start - 2] == '\r';
+        pieces[ix].size = Fixer::fix_lines(data + start, starts[ix + 1] - start, tab_width,
+                                           pieces[ix].buffer, allowed, after_cr_lf);
+    });
+}
+
+
+}  // namespace Splitter
@@ -0,0 +1,68 @@
+/*
+    Classifying and fixing one big text in parallel for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "classifier.h"
+
+#include <cstddef>
+#include <vector>
+
+class BufferPool;
+class WorkerPool;
+
+//  Working on the files in parallel doesn't help when one file is most
+//  of the work. Nothing carries over a line feed but the line ending
+//  itself, so a big text split just after line feeds can be classified,
+//  and fixed, a piece on each thread. The classifier states are then
+//  joined in order, and the fixed pieces are written out one after
+//  another, each from a buffer of its own.
+//
+//  The pieces run on a pool of workers shared by everyone splitting, the
+//  first one on the calling thread, so that splitting many files at once
+//  doesn't multiply the threads.
+//
+namespace Splitter {
+
+//  No piece is made smaller than this, the threads would cost more
+constexpr size_t min_piece_size = 1024 * 1024;
+
+//  Where to split the text into at most this many pieces of about the
+//  same size. The pieces begin at the offsets, the first one at zero,
+//  and each one but the last ends with a line feed. A text with few
+//  line feeds may get fewer pieces.
+std::vector<size_t> split(const char* data, size_t size, int pieces);
+
+//  The same results as feeding all of the data to a new state with
+//  the rules
+Classifier::State classify(const char* data, size_t size, unsigned allowed,
+                           WorkerPool& workers);
+
+//  A piece of the fixed text
+struct Piece
+{
+    std::vector<char> buffer;
+    size_t size = 0;
+};
+
+//  The same output as Fixer::fix, as the pieces in order. The buffers
+//  come from the pool, and the caller gives them back when done.
+void fix(const char* data, size_t size, int tab_width, unsigned allowed, WorkerPool& workers,
+         BufferPool& buffers, std::vector<Piece>& pieces);
+
+}  // namespace Splitter
@@ -0,0 +1,302 @@
+//  Run time statistics for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stats.h"
+#include "classifier.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+//  How many of the biggest and slowest files to list
+constexpr size_t top_count = 5;
+
+struct FileNote
+{
+    std::string path;
+    uint64_t size;
+    Clock::duration time;
+};
+
+//  Everything collected by one thread
+struct Block
+{
+    uint64_t counters[Stats::counter_count] = {};
+    Clock::duration times[Stats::phase_count] = {};
+    uint64_t errors[16] = {};  // Files by error bit
+    std::vector<FileNote> biggest;
+    std::vector<FileNote> slowest;
+};
+
+bool is_enabled = false;
+Clock::time_point start_time;
+
+//  The blocks outlive their threads, so that they
+//  can still be summed up at the end.
+std::mutex blocks_mutex;
+std::vector<std::unique_ptr<Block>> blocks;
+
+thread_local Block* local_block = nullptr;
+
+Block& local()
+{
+    if (!local_block)
+    {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        blocks.push_back(std::make_unique<Block>());
+        local_block = blocks.back().get();
+    }
+
+    return *local_block;
+}
+
+//  Keep the notes sorted with the top one first, and only the first few
+template <typename Less>
+void keep_top(std::vector<FileNote>& notes, const FileNote& note, Less less)
+{
+    if (notes.size() == top_count && !less(notes.back(), note))
+    {
+        return;
+    }
+
+    auto pos = std::upper_bound(notes.begin(), notes.end(), note,
+                                [&](const FileNote& a, const FileNote& b) { return less(b, a); });
+    notes.insert(pos, note);
+    if (notes.size() > top_count)
+    {
+        notes.pop_back();
+    }
+}
+
+bool smaller(const FileNote& a, const FileNote& b)
+{
+    return a.size < b.size;
+}
+
+bool faster(const FileNote& a, const FileNote& b)
+{
+    return a.time < b.time;
+}
+
+double seconds(Clock::duration time)
+{
+    return std::chrono::duration<double>(time).count();
+}
+
+struct ErrorName
+{
+    unsigned bit;
+    const char* name;
+};
+
+const ErrorName error_names[] = {
+    {err_tabs, "tabs"},
+    {err_unusual_whitespace, "unusual whitespace"},
+    {err_trailing_whitespace, "trailing whitespace"},
+    {err_cr_lf_line_endings, "CR-LF line endings"},
+    {err_no_lf_at_end, "no line feed at end"},
+    {err_utf16_encoding, "UTF-16 encoding"},
+    {err_invalid_encoding, "invalid encoding"},
+    {err_invalid_characters, "invalid characters"},
+    {err_not_a_text_file, "not a text file"},
+};
+
+//  Index of the bit in Block::errors
+int bit_index(unsigned bit)
+{
+    return __builtin_ctz(bit);
+}
+
+}  // namespace
+
+
+namespace Stats {
+
+void enable()
+{
+    is_enabled = true;
+    start_time = Clock::now();
+}
+
+
+bool enabled()
+{
+    return is_enabled;
+}
+
+
+void add(Counter counter, uint64_t amount)
+{
+    if (is_enabled)
+    {
+        local().counters[counter] += amount;
+    }
+}
+
+
+void add_time(Phase phase, Clock::duration time)
+{
+    if (is_enabled)
+    {
+        local().times[phase] += time;
+    }
+}
+
+
+void count_errors(unsigned errors)
+{
+    if (!is_enabled)
+    {
+        return;
+    }
+
+    Block& block = local();
+    for (const auto& error : error_names)
+    {
+        if (errors & error.bit)
+        {
+            ++block.errors[bit_index(error.bit)];
+        }
+    }
+}
+
+
+void note_file(const std::string& path, uint64_t size, Clock::duration time)
+{
+    if (!is_enabled)
+    {
+        return;
+    }
+
+    Block& block = local();
+    FileNote note{path, size, time};
+    keep_top(block.biggest, note, smaller);
+    keep_top(block.slowest, note, faster);
+}
+
+
+void print(std::ostream& os)
+{
+    if (!is_enabled)
+    {
+        return;
+    }
+
+    double elapsed = seconds(Clock::now() - start_time);
+
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    Block total;
+    for (const auto& block : blocks)
+    {
+        for (int ix = 0; ix < counter_count; ++ix)
+        {
+            total.counters[ix] += block->counters[ix];
+        }
+
+        for (int ix = 0; ix < phase_count; ++ix)
+        {
+            total.times[ix] += block->times[ix];
+        }
+
+        for (int ix = 0; ix < 16; ++ix)
+        {
+            total.errors[ix] += block->errors[ix];
+        }
+
+        for (const auto& note : block->biggest)
+        {
+            keep_top(total.biggest, note, smaller);
+        }
+
+        for (const auto& note : block->slowest)
+        {
+            keep_top(total.slowest, note, faster);
+        }
+    }
+
+    char line[200];
+    auto counter = [&](const char* name, Counter counter) {
+        std::snprintf(line, sizeof(line), "  %-22s %12llu\n", name,
+                      static_cast<unsigned long long>(total.counters[counter]));
+        os << line;
+    };
+
+    auto phase = [&](const char* name, Phase phase) {
+        std::snprintf(line, sizeof(line), "  %-22s %12.3f s\n", name, seconds(total.times[phase]));
+        os << line;
+    };
+
+    os << "Statistics:\n";
+    counter("files examined", files_examined);
+    counter("files from cache", files_known);
+    counter("files seen already", files_seen);
+    counter("files skipped", files_skipped);
+    counter("files sniffed binary", files_sniffed);
+    counter("files read ahead", files_prefetched);
+    counter("files fixed", files_fixed);
+    counter("directories", directories);
+    counter("bytes read", bytes_read);
+    counter("bytes written", bytes_written);
+
+    os << "Files with errors:\n";
+    for (const auto& error : error_names)
+    {
+        std::snprintf(line, sizeof(line), "  %-22s %12llu\n", error.name,
+                      static_cast<unsigned long long>(total.errors[bit_index(error.bit)]));
+        os << line;
+    }
+
+    //  The phases run in parallel, so these are the sums over all threads
+    os << "Time spent, summed over all threads:\n";
+    phase("reading directories", phase_walk);
+    phase("loading files", phase_load);
+    phase("classifying", phase_classify);
+    phase("invalid characters", phase_classify_invalid);
+    phase("locating", phase_locate);
+    phase("fixing", phase_fix);
+    phase("renaming", phase_rename);
+
+    double files = double(total.counters[files_examined] + total.counters[files_known] +
+                          total.counters[files_seen]);
+    double megabytes = total.counters[bytes_read] / 1e6;
+    std::snprintf(line, sizeof(line),
+                  "Elapsed %.3f s, %.1f files/s, %.1f MB/s\n", elapsed,
+                  elapsed > 0 ? files / elapsed : 0.0, elapsed > 0 ? megabytes / elapsed : 0.0);
+    os << line;
+
+    os << "Biggest files:\n";
+    for (const auto& note : total.biggest)
+    {
+        std::snprintf(line, sizeof(line), "  %12llu  ", static_cast<unsigned long long>(note.size));
+        os << line << note.path << '\n';
+    }
+
+    os << "Slowest files:\n";
+    for (const auto& note : total.slowest)
+    {
+        std::snprintf(line, sizeof(line), "  %10.6f s  ", seconds(note.time));
+        os << line << note.path << '\n';
+    }
+}
+
+}  // namespace Stats
@@ -0,0 +1,104 @@
+/*
+    Run time statistics for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+//  Timers and counters for finding out where the time goes.
+//
+//  Every thread updates a block of its own, so the workers never
+//  compete for the same cache lines. The blocks are added together
+//  only when the summary is printed, after all the workers are done.
+//  When not enabled, all of this costs just a test of a flag.
+//
+namespace Stats {
+
+enum Phase {
+    phase_walk,              // Reading directories
+    phase_load,              // Opening and reading files
+    phase_classify,          // Looking for errors
+    phase_classify_invalid,  // Figuring out the invalid characters
+    phase_locate,            // Finding the lines and columns
+    phase_fix,               // Writing the fixed files
+    phase_rename,            // Renaming to backups and back
+    phase_count,
+};
+
+enum Counter {
+    files_examined,    // Loaded and classified
+    files_known,       // Results taken from the cache
+    files_seen,        // Results taken from another link or a copy
+    files_skipped,     // Not a source file, or in a skipped directory
+    files_sniffed,     // Rejected as binary without loading
+    files_prefetched,  // Read ahead with io_uring
+    files_fixed,
+    directories,
+    bytes_read,
+    bytes_written,
+    counter_count,
+};
+
+//  Off by default. Must be enabled before any worker threads start.
+void enable();
+bool enabled();
+
+void add(Counter counter, uint64_t amount = 1);
+void add_time(Phase phase, std::chrono::steady_clock::duration time);
+
+//  Count the file under each of its error bits
+void count_errors(unsigned errors);
+
+//  Remember the biggest and slowest files
+void note_file(const std::string& path, uint64_t size, std::chrono::steady_clock::duration time);
+
+//  A summary of everything collected
+void print(std::ostream& os);
+
+//  Adds the time from construction to destruction to the phase
+class Timer
+{
+public:
+    explicit Timer(Phase phase) : m_phase(phase)
+    {
+        if (enabled())
+        {
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~Timer()
+    {
+        if (enabled())
+        {
+            add_time(m_phase, std::chrono::steady_clock::now() - m_start);
+        }
+    }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+private:
+    Phase m_phase;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+}  // namespace Stats
@@ -0,0 +1,495 @@
+//  Reading small files ahead with io_uring for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "uring_loader.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+namespace {
+
+int io_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+    return int(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int ring, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return int(::syscall(__NR_io_uring_enter, ring, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int ring, unsigned opcode, void* arg, unsigned count)
+{
+    return int(::syscall(__NR_io_uring_register, ring, opcode, arg, count));
+}
+
+//  The kind of operation is kept in the low bits of the user data,
+//  and the slot address in the rest.
+enum {
+    op_open,
+    op_statx,
+    op_read,
+    op_close,  // Nobody waits for these
+    op_mask = 3,
+};
+
+//  All of these came with kernel 5.6
+bool has_operations(int ring)
+{
+    constexpr unsigned count = 256;
+    size_t size = sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op);
+    std::unique_ptr<char[]> buffer(new char[size]());
+    auto probe = reinterpret_cast<io_uring_probe*>(buffer.get());
+    if (io_uring_register(ring, IORING_REGISTER_PROBE, probe, count) < 0)
+    {
+        return false;
+    }
+
+    for (int op : {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE})
+    {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+unsigned load_acquire(const unsigned* ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+void store_release(unsigned* ptr, unsigned value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+}  // namespace
+
+
+//  One file in flight. The open and the statx go together, and the
+//  read follows once both are done.
+struct UringLoader::Slot
+{
+    File file;
+    struct statx statx;
+    int pending = 0;  // Operations in flight
+    int fd = -1;
+    int open_result = 0;
+    int statx_result = 0;
+    bool reading = false;
+};
+
+
+UringLoader::UringLoader() = default;
+
+
+UringLoader::~UringLoader()
+{
+    if (m_sqes)
+    {
+        ::munmap(m_sqes, m_sq_entries * sizeof(io_uring_sqe));
+    }
+
+    if (m_cq_map && m_cq_map != m_sq_map)
+    {
+        ::munmap(m_cq_map, m_cq_map_size);
+    }
+
+    if (m_sq_map)
+    {
+        ::munmap(m_sq_map, m_sq_map_size);
+    }
+
+    if (m_ring >= 0)
+    {
+        ::close(m_ring);
+    }
+}
+
+
+bool UringLoader::init()
+{
+    //  Room for the open and statx of every slot, and the closes
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    m_ring = io_uring_setup(4 * depth, &params);
+    if (m_ring < 0)
+    {
+        return false;
+    }
+
+    if (!has_operations(m_ring))
+    {
+        return false;
+    }
+
+    m_sq_entries = params.sq_entries;
+    m_sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_map)
+    {
+        m_sq_map_size = m_cq_map_size = std::max(m_sq_map_size, m_cq_map_size);
+    }
+
+    m_sq_map = ::mmap(nullptr, m_sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_ring, IORING_OFF_SQ_RING);
+    if (m_sq_map == MAP_FAILED)
+    {
+        m_sq_map = nullptr;
+        return false;
+    }
+
+    m_cq_map = m_sq_map;
+    if (!single_map)
+    {
+        m_cq_map = ::mmap(nullptr, m_cq_map_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+        if (m_cq_map == MAP_FAILED)
+        {
+            m_cq_map = nullptr;
+            return false;
+        }
+    }
+
+    void* sqes = ::mmap(nullptr, m_sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(m_sq_map);
+    m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    char* cq = static_cast<char*>(m_cq_map);
+    m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    m_slots.reset(new Slot[depth]);
+    for (unsigned ix = 0; ix < depth; ++ix)
+    {
+        m_free.push_back(&m_slots[ix]);
+    }
+
+    return true;
+}
+
+
+io_uring_sqe* UringLoader::next_sqe()
+{
+    //  Only this thread writes the tail, the kernel moves the head
+    unsigned tail = *m_sq_tail;
+    if (tail - load_acquire(m_sq_head) >= m_sq_entries)
+    {
+        //  Full, so let the kernel take what's there
+        if (!enter(0))
+        {
+            return nullptr;
+        }
+    }
+
+    unsigned index = tail & *m_sq_mask;
+    io_uring_sqe* sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[index] = index;
+    store_release(m_sq_tail, tail + 1);
+    ++m_to_submit;
+    return sqe;
+}
+
+
+bool UringLoader::enter(unsigned min_complete)
+{
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    for (;;)
+    {
+        int count = io_uring_enter(m_ring, m_to_submit, min_complete, flags);
+        if (count >= 0)
+        {
+            m_to_submit -= std::min(m_to_submit, unsigned(count));
+            return true;
+        }
+
+        //  Busy means the completions must be taken out first
+        if (errno == EBUSY || errno == EAGAIN)
+        {
+            return false;
+        }
+
+        if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+}
+
+
+void UringLoader::start(Slot& slot)
+{
+    slot.file.data.clear();
+    slot.file.loaded = false;
+    slot.file.has_info = false;
+    slot.fd = -1;
+    slot.reading = false;
+    slot.pending = 0;
+
+    uint64_t tag = reinterpret_cast<uintptr_t>(&slot);
+    io_uring_sqe* sqe = next_sqe();
+    if (sqe)
+    {
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uintptr_t>(slot.file.path.c_str());
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = tag | op_open;
+        ++slot.pending;
+    }
+    else
+    {
+        slot.open_result = -EAGAIN;
+    }
+
+    sqe = next_sqe();
+    if (sqe)
+    {
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uintptr_t>(slot.file.path.c_str());
+        sqe->len = STATX_BASIC_STATS;
+        sqe->off = reinterpret_cast<uintptr_t>(&slot.statx);
+        sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+        sqe->user_data = tag | op_statx;
+        ++slot.pending;
+    }
+    else
+    {
+        slot.statx_result = -EAGAIN;
+    }
+
+    if (slot.pending == 0)
+    {
+        m_done.push_back(&slot);
+    }
+}
+
+
+void UringLoader::close_file(int fd)
+{
+    io_uring_sqe* sqe = next_sqe();
+    if (!sqe)
+    {
+        ::close(fd);
+        return;
+    }
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = op_close;
+}
+
+
+//  Both the open and the statx are done, see if it's worth reading
+void UringLoader::opened(Slot& slot, const Filter& filter)
+{
+    slot.fd = slot.open_result;
+    if (slot.statx_result == 0)
+    {
+        //  The same fields the cache and the seen files take from stat
+        struct stat& info = slot.file.info;
+        std::memset(&info, 0, sizeof(info));
+        info.st_dev = makedev(slot.statx.stx_dev_major, slot.statx.stx_dev_minor);
+        info.st_ino = slot.statx.stx_ino;
+        info.st_mode = slot.statx.stx_mode;
+        info.st_nlink = slot.statx.stx_nlink;
+        info.st_size = off_t(slot.statx.stx_size);
+        info.st_mtim.tv_sec = slot.statx.stx_mtime.tv_sec;
+        info.st_mtim.tv_nsec = slot.statx.stx_mtime.tv_nsec;
+        slot.file.has_info = true;
+    }
+
+    bool wanted = slot.fd >= 0 && slot.file.has_info && S_ISREG(slot.file.info.st_mode) &&
+                  size_t(slot.file.info.st_size) < max_size && filter(slot.file.info);
+    io_uring_sqe* sqe = wanted ? next_sqe() : nullptr;
+    if (!sqe)
+    {
+        if (slot.fd >= 0)
+        {
+            close_file(slot.fd);
+        }
+
+        m_done.push_back(&slot);
+        return;
+    }
+
+    //  One byte extra, to notice if the file has grown since
+    size_t size = size_t(slot.file.info.st_size);
+    slot.file.data.resize(size + 1);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot.fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(slot.file.data.data());
+    sqe->len = unsigned(size + 1);
+    sqe->off = 0;
+    sqe->user_data = reinterpret_cast<uintptr_t>(&slot) | op_read;
+    slot.reading = true;
+    slot.pending = 1;
+}
+
+
+void UringLoader::completed(Slot& slot, int operation, int result)
+{
+    --slot.pending;
+    switch (operation)
+    {
+    case op_open:
+        slot.open_result = result;
+        break;
+
+    case op_statx:
+        slot.statx_result = result;
+        break;
+
+    case op_read:
+        //  Anything unexpected is left for the normal loading
+        if (result >= 0 && size_t(result) + 1 == slot.file.data.size())
+        {
+            slot.file.data.resize(size_t(result));
+            slot.file.loaded = true;
+        }
+        else
+        {
+            slot.file.data.clear();
+        }
+
+        close_file(slot.fd);
+        slot.reading = false;
+        m_done.push_back(&slot);
+        break;
+    }
+}
+
+
+void UringLoader::run(BoundedQueue<std::string>& input, BoundedQueue<File>& output,
+                      const Filter& filter)
+{
+    bool more_input = true;
+    for (;;)
+    {
+        //  Keep all the slots busy
+        while (more_input && !m_free.empty())
+        {
+            bool closed = input.is_closed();
+            Slot& slot = *m_free.back();
+            if (!input.try_pop(slot.file.path))
+            {
+                if (closed)
+                {
+                    more_input = false;
+                }
+                else if (m_free.size() == depth)
+                {
+                    //  Nothing in flight, so wait for names
+                    more_input = input.pop(slot.file.path);
+                    if (more_input)
+                    {
+                        m_free.pop_back();
+                        start(slot);
+                    }
+                }
+
+                break;
+            }
+
+            m_free.pop_back();
+            start(slot);
+        }
+
+        bool in_flight = m_free.size() + m_done.size() < depth;
+        if (!in_flight && m_done.empty())
+        {
+            if (!more_input)
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        if (m_done.empty() && !enter(1))
+        {
+            //  Not much to do but wait a little
+            std::this_thread::yield();
+        }
+
+        //  Take out all the completions there are
+        unsigned head = *m_cq_head;
+        unsigned tail = load_acquire(m_cq_tail);
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe& cqe = m_cqes[head & *m_cq_mask];
+            int operation = int(cqe.user_data & op_mask);
+            if (operation != op_close)
+            {
+                auto slot = reinterpret_cast<Slot*>(uintptr_t(cqe.user_data & ~uint64_t(op_mask)));
+                completed(*slot, operation, cqe.res);
+                if (slot->pending == 0 && !slot->reading && operation != op_read)
+                {
+                    opened(*slot, filter);
+                }
+            }
+        }
+
+        store_release(m_cq_head, head);
+
+        //  Hand over the finished ones
+        for (Slot* slot : m_done)
+        {
+            Stats::add(Stats::files_prefetched, slot->file.loaded);
+            output.push(std::move(slot->file));
+            slot->file = File();
+            m_free.push_back(slot);
+        }
+
+        m_done.clear();
+    }
+
+    //  Let the closes go through
+    enter(0);
+    output.close();
+}
@@ -0,0 +1,109 @@
+/*
+    Reading small files ahead with io_uring for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "bounded_queue.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+//  Opens, stats, and reads small files with io_uring, keeping hundreds
+//  of them in flight at once, and hands the contents over to the
+//  checkers. Per file latency hardly matters then, which is what makes
+//  network filesystems slow with the plain system calls.
+//
+//  Everything is done with the raw system calls, there's no need for
+//  liburing. If the kernel doesn't have io_uring, or lacks some of the
+//  operations, init fails and the files must be loaded the normal way.
+//
+class UringLoader
+{
+public:
+    //  Files at least this big are left for the normal loading,
+    //  which may sniff, map, or stream them.
+    static constexpr size_t max_size = 64 * 1024;
+
+    //  Number of files in flight
+    static constexpr unsigned depth = 256;
+
+    //  A file on its way to the checkers
+    struct File
+    {
+        std::string path;
+        std::vector<char> data;
+        bool loaded = false;     // The data is the whole file
+        bool has_info = false;   // The info is valid, even if not loaded
+        struct stat info;
+    };
+
+    //  Tells from the info whether the file needs to be read at all
+    using Filter = std::function<bool(const struct stat& info)>;
+
+    UringLoader();
+    ~UringLoader();
+
+    UringLoader(const UringLoader&) = delete;
+    UringLoader& operator=(const UringLoader&) = delete;
+
+    //  Returns false if io_uring can't be used
+    bool init();
+
+    //  Take names from the input until it's closed and empty, and push
+    //  every one of them to the output, loaded or not.
+    void run(BoundedQueue<std::string>& input, BoundedQueue<File>& output, const Filter& filter);
+
+private:
+    struct Slot;
+
+    struct io_uring_sqe* next_sqe();
+    bool enter(unsigned min_complete);
+
+    void start(Slot& slot);
+    void completed(Slot& slot, int operation, int result);
+    void opened(Slot& slot, const Filter& filter);
+    void close_file(int fd);
+
+    int m_ring = -1;
+    unsigned m_sq_entries = 0;
+    unsigned m_to_submit = 0;
+
+    void* m_sq_map = nullptr;
+    size_t m_sq_map_size = 0;
+    void* m_cq_map = nullptr;
+    size_t m_cq_map_size = 0;
+    struct io_uring_sqe* m_sqes = nullptr;
+
+    unsigned* m_sq_head = nullptr;
+    unsigned* m_sq_tail = nullptr;
+    unsigned* m_sq_mask = nullptr;
+    unsigned* m_sq_array = nullptr;
+    unsigned* m_cq_head = nullptr;
+    unsigned* m_cq_tail = nullptr;
+    unsigned* m_cq_mask = nullptr;
+    struct io_uring_cqe* m_cqes = nullptr;
+
+    std::unique_ptr<Slot[]> m_slots;
+    std::vector<Slot*> m_free;
+    std::vector<Slot*> m_done;
+};
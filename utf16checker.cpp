@@ -17,6 +17,14 @@
 
 #include "utf16checker.h"
 
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
 namespace {
 
 constexpr int ascii_del_character = 0x7f;
@@ -24,8 +32,6 @@ constexpr int min_high_surrogate = 0xD800;
 constexpr int min_low_surrogate = 0xDC00;
 constexpr int max_low_surrogate = 0xDFFF;
 
-static const int END_SENTINEL = -1;
-
 //  Code unit types
 enum {
     UNICODE_CHARACTER,
@@ -97,153 +103,474 @@ int get_be_unit(const unsigned char* ptr)
     return (ptr[0] << 8) | ptr[1];
 }
 
-}  // namespace
 
+using Lane = Utf16Checker::Lane;
 
-int Utf16Checker::check(const char* data, int size)
+//  The reference version, one code unit at a time.
+//  Once invalid, the counts no longer matter.
+inline void step(Lane& lane, int unit)
 {
-    //  Error if size is too small or not even
-    if (size < 2 || (size & 0x0001))
+    int type = unit_type(unit);
+    switch (type)
     {
-        return eSIZE;
+    case UNICODE_CHARACTER:
+        //  A lonely surrogate isn't allowed, so check
+        //  if there was one just before.
+        if (lane.after_high)
+        {
+            lane.invalid = true;
+        }
+
+        if (unit <= ascii_del_character)
+        {
+            //  If ASCII, count it as either normal or weird
+            if (is_normal_ascii(unit))
+                ++lane.counts.normal_ascii;
+            else
+                ++lane.counts.weird_ascii;
+        }
+
+        ++lane.counts.total_characters;
+        break;
+
+    case HIGH_SURROGATE:
+        //  Can't have two high surrogates in a row
+        if (lane.after_high)
+        {
+            lane.invalid = true;
+        }
+        break;
+
+    case LOW_SURROGATE:
+        //  A low surrogate is valid only after a high surrogate
+        if (!lane.after_high)
+        {
+            lane.invalid = true;
+        }
+
+        //  Count the surrogate pair as one character.
+        //  All possible encoded values are technically valid, so there's
+        //  no need to decode or examine the actual code point.
+        ++lane.counts.total_characters;
+        break;
     }
 
-    m_data = reinterpret_cast<const unsigned char*>(data);
-    m_end = m_data + size;
+    lane.after_high = (type == HIGH_SURROGATE);
+}
 
-    m_counts.normal_ascii = 0;
-    m_counts.weird_ascii = 0;
-    m_counts.total_characters = 0;
+size_t single_scalar(Lane& lane, const unsigned char* data, size_t units, bool big_endian)
+{
+    size_t done = 0;
+    for (; done < units && !lane.invalid; ++done)
+    {
+        const unsigned char* ptr = data + 2 * done;
+        step(lane, big_endian ? get_be_unit(ptr) : get_le_unit(ptr));
+    }
 
-    determine_endiannes();
+    return done;
+}
 
-    int previous_type = UNICODE_CHARACTER;
-    for (int unit = next_unit(); unit != END_SENTINEL; unit = next_unit())
+size_t both_scalar(Lane& little, Lane& big, const unsigned char* data, size_t units)
+{
+    for (size_t ix = 0; ix < units; ++ix)
     {
-        int type = unit_type(unit);
-        switch (type)
-        {
-        case UNICODE_CHARACTER:
-            //  A lonely surrogate isn't allowed, so check
-            //  if there was one just before.
-            if (previous_type != UNICODE_CHARACTER)
-            {
-                return eINVALID;
-            }
+        step(little, get_le_unit(data + 2 * ix));
+        step(big, get_be_unit(data + 2 * ix));
+    }
 
-            if (unit <= ascii_del_character)
-            {
-                //  If ASCII, count it as either normal or weird
-                if (is_normal_ascii(unit))
-                    ++m_counts.normal_ascii;
-                else
-                    ++m_counts.weird_ascii;
-            }
+    return units;
+}
 
-            ++m_counts.total_characters;
-            break;
 
-        case HIGH_SURROGATE:
-            //  Can't have two high surrogates in a row
-            if (previous_type == HIGH_SURROGATE)
-            {
-                return eINVALID;
-            }
-            break;
+//  The vector kernels classify 32 units at a time into bit masks, one
+//  bit per unit, the lowest bit for the first unit.
+//
+//  Pairing is valid when every unit is a low surrogate exactly when
+//  the one before it is a high surrogate. Characters are all the units
+//  except the high surrogates, as a pair is counted just once.
+//
+struct Masks
+{
+    uint32_t normal;  // Printable ASCII or whitespace
+    uint32_t weird;   // Other ASCII
+    uint32_t high;    // High surrogates
+    uint32_t low;     // Low surrogates
+};
 
-        case LOW_SURROGATE:
-            //  A low surrogate is valid only after a high surrogate
-            if (previous_type != HIGH_SURROGATE)
-            {
-                return eINVALID;
-            }
+inline void add_block(Lane& lane, const Masks& masks)
+{
+    uint32_t expected_low = (masks.high << 1) | uint32_t(lane.after_high);
+    if (masks.low != expected_low)
+    {
+        lane.invalid = true;
+    }
 
-            //  Count the surrogate pair as one character, and accordingly
-            //  change the current type to UNICODE_CHARACTER.
-            //  All possible encoded values are technically valid, so there's
-            //  no need to decode or examine the actual code point.
-            ++m_counts.total_characters;
-            type = UNICODE_CHARACTER;
-            break;
-        }
+    lane.after_high = (masks.high >> 31) != 0;
+    lane.counts.normal_ascii += __builtin_popcount(masks.normal);
+    lane.counts.weird_ascii += __builtin_popcount(masks.weird);
+    lane.counts.total_characters += 32 - __builtin_popcount(masks.high);
+}
 
-        previous_type = type;
+template <typename Isa>
+inline size_t single_blocks(Lane& lane, const unsigned char* data, size_t units, bool big_endian)
+{
+    size_t done = 0;
+    while (done + 32 <= units && !lane.invalid)
+    {
+        Masks masks;
+        Isa::classify(data + 2 * done, big_endian, masks);
+        add_block(lane, masks);
+        done += 32;
     }
 
-    //  Error if the last code unit was a lonely surrogate
-    if (previous_type != UNICODE_CHARACTER)
+    return done;
+}
+
+template <typename Isa>
+inline size_t both_blocks(Lane& little, Lane& big, const unsigned char* data, size_t units)
+{
+    size_t done = 0;
+    for (; done + 32 <= units; done += 32)
     {
-        return eINVALID;
+        Masks le_masks;
+        Masks be_masks;
+        Isa::classify_both(data + 2 * done, le_masks, be_masks);
+        add_block(little, le_masks);
+        add_block(big, be_masks);
     }
 
-    return eOK;
+    return done;
 }
 
 
-void Utf16Checker::determine_endiannes()
+#if HAVE_X86_KERNELS
+
+//  The comparisons are all unsigned, done with saturating subtraction:
+//  a <= b exactly when a - b saturates to zero.
+//
+struct Sse2
 {
-    //  UTF-16 encoded texts tend to come from Windows,
-    //  so usually they are little endian.
-    m_little_endian = true;
+    struct Units
+    {
+        __m128i normal, weird, high, low;
+    };
 
-    //  Might begin with a Byte Order Mark (BOM)
-    if (m_data[0] == 0xff && m_data[1] == 0xfe)
+    __attribute__((target("sse2"))) static inline __m128i at_most(__m128i value, int limit)
     {
-        //  Data is little endian.
-        m_data += 2;  // Skip the BOM
-        return;
+        return _mm_cmpeq_epi16(_mm_subs_epu16(value, _mm_set1_epi16(short(limit))),
+                               _mm_setzero_si128());
     }
 
-    if (m_data[0] == 0xfe && m_data[1] == 0xff)
+    __attribute__((target("sse2"))) static inline Units units(__m128i unit)
     {
-        //  Data is big endian.
-        m_little_endian = false;
-        m_data += 2;  // Skip the BOM
-        return;
+        Units result;
+        __m128i top = _mm_and_si128(unit, _mm_set1_epi16(short(0xfc00)));
+        result.high = _mm_cmpeq_epi16(top, _mm_set1_epi16(short(0xd800)));
+        result.low = _mm_cmpeq_epi16(top, _mm_set1_epi16(short(0xdc00)));
+
+        __m128i ascii = at_most(unit, ascii_del_character);
+        __m128i printable = at_most(_mm_sub_epi16(unit, _mm_set1_epi16(' ')), '~' - ' ');
+        __m128i space = at_most(_mm_sub_epi16(unit, _mm_set1_epi16('\t')), '\r' - '\t');
+        result.normal = _mm_or_si128(printable, space);
+        result.weird = _mm_andnot_si128(result.normal, ascii);
+        return result;
+    }
+
+    __attribute__((target("sse2"))) static inline __m128i swap_bytes(__m128i data)
+    {
+        return _mm_or_si128(_mm_slli_epi16(data, 8), _mm_srli_epi16(data, 8));
+    }
+
+    //  Pack the 16-bit masks of 16 units to bytes, and then to bits
+    __attribute__((target("sse2"))) static inline uint32_t bits(__m128i first, __m128i second)
+    {
+        return uint16_t(_mm_movemask_epi8(_mm_packs_epi16(first, second)));
+    }
+
+    __attribute__((target("sse2"))) static inline void to_masks(const Units* u, Masks& masks)
+    {
+        masks.normal = bits(u[0].normal, u[1].normal) | (bits(u[2].normal, u[3].normal) << 16);
+        masks.weird = bits(u[0].weird, u[1].weird) | (bits(u[2].weird, u[3].weird) << 16);
+        masks.high = bits(u[0].high, u[1].high) | (bits(u[2].high, u[3].high) << 16);
+        masks.low = bits(u[0].low, u[1].low) | (bits(u[2].low, u[3].low) << 16);
+    }
+
+    __attribute__((target("sse2"))) static inline void classify(const unsigned char* ptr,
+                                                                 bool big_endian, Masks& masks)
+    {
+        Units u[4];
+        for (int ix = 0; ix < 4; ++ix)
+        {
+            __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + 16 * ix));
+            u[ix] = units(big_endian ? swap_bytes(data) : data);
+        }
+
+        to_masks(u, masks);
+    }
+
+    __attribute__((target("sse2"))) static inline void classify_both(const unsigned char* ptr,
+                                                                      Masks& little, Masks& big)
+    {
+        Units le[4];
+        Units be[4];
+        for (int ix = 0; ix < 4; ++ix)
+        {
+            __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + 16 * ix));
+            le[ix] = units(data);
+            be[ix] = units(swap_bytes(data));
+        }
+
+        to_masks(le, little);
+        to_masks(be, big);
+    }
+};
+
+struct Avx2
+{
+    struct Units
+    {
+        __m256i normal, weird, high, low;
+    };
+
+    __attribute__((target("avx2"))) static inline __m256i at_most(__m256i value, int limit)
+    {
+        return _mm256_cmpeq_epi16(_mm256_subs_epu16(value, _mm256_set1_epi16(short(limit))),
+                                  _mm256_setzero_si256());
+    }
+
+    __attribute__((target("avx2"))) static inline Units units(__m256i unit)
+    {
+        Units result;
+        __m256i top = _mm256_and_si256(unit, _mm256_set1_epi16(short(0xfc00)));
+        result.high = _mm256_cmpeq_epi16(top, _mm256_set1_epi16(short(0xd800)));
+        result.low = _mm256_cmpeq_epi16(top, _mm256_set1_epi16(short(0xdc00)));
+
+        __m256i ascii = at_most(unit, ascii_del_character);
+        __m256i printable = at_most(_mm256_sub_epi16(unit, _mm256_set1_epi16(' ')), '~' - ' ');
+        __m256i space = at_most(_mm256_sub_epi16(unit, _mm256_set1_epi16('\t')), '\r' - '\t');
+        result.normal = _mm256_or_si256(printable, space);
+        result.weird = _mm256_andnot_si256(result.normal, ascii);
+        return result;
+    }
+
+    __attribute__((target("avx2"))) static inline __m256i swap_bytes(__m256i data)
+    {
+        return _mm256_or_si256(_mm256_slli_epi16(data, 8), _mm256_srli_epi16(data, 8));
     }
 
-    //  Examine some text and choose the endianness
-    //  that produces more ASCII characters.
-    constexpr int MAX_UNITS_TO_EXAMINE = 1000;
+    //  The pack works within the 128-bit halves,
+    //  so the quarters need to be put back in order.
+    __attribute__((target("avx2"))) static inline uint32_t bits(__m256i first, __m256i second)
+    {
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(first, second), 0xd8);
+        return uint32_t(_mm256_movemask_epi8(packed));
+    }
 
-    int le = 0;
-    int be = 0;
-    const unsigned char* ptr = m_data;
-    const unsigned char* end = ptr + 2 * MAX_UNITS_TO_EXAMINE;
-    if (end > m_end)
+    __attribute__((target("avx2"))) static inline void to_masks(const Units* u, Masks& masks)
     {
-        end = m_end;
+        masks.normal = bits(u[0].normal, u[1].normal);
+        masks.weird = bits(u[0].weird, u[1].weird);
+        masks.high = bits(u[0].high, u[1].high);
+        masks.low = bits(u[0].low, u[1].low);
     }
 
-    while (ptr != end)
+    __attribute__((target("avx2"))) static inline void classify(const unsigned char* ptr,
+                                                                 bool big_endian, Masks& masks)
     {
-        le += is_normal_ascii(get_le_unit(ptr));
-        be += is_normal_ascii(get_be_unit(ptr));
-        ptr += 2;
+        Units u[2];
+        for (int ix = 0; ix < 2; ++ix)
+        {
+            __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + 32 * ix));
+            u[ix] = units(big_endian ? swap_bytes(data) : data);
+        }
+
+        to_masks(u, masks);
     }
 
-    //  Change the endianness if big endian looks better
-    if (be > le)
+    __attribute__((target("avx2"))) static inline void classify_both(const unsigned char* ptr,
+                                                                      Masks& little, Masks& big)
     {
-        m_little_endian = false;
+        Units le[2];
+        Units be[2];
+        for (int ix = 0; ix < 2; ++ix)
+        {
+            __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + 32 * ix));
+            le[ix] = units(data);
+            be[ix] = units(swap_bytes(data));
+        }
+
+        to_masks(le, little);
+        to_masks(be, big);
     }
+};
+
+__attribute__((target("sse2"), flatten)) size_t single_sse2(Lane& lane, const unsigned char* data,
+                                                            size_t units, bool big_endian)
+{
+    return single_blocks<Sse2>(lane, data, units, big_endian);
 }
 
+__attribute__((target("sse2"), flatten)) size_t both_sse2(Lane& little, Lane& big,
+                                                          const unsigned char* data, size_t units)
+{
+    return both_blocks<Sse2>(little, big, data, units);
+}
 
-//  Returns END_SENTINEL if no input available.
-//
-int Utf16Checker::next_unit()
+__attribute__((target("avx2"), flatten)) size_t single_avx2(Lane& lane, const unsigned char* data,
+                                                            size_t units, bool big_endian)
+{
+    return single_blocks<Avx2>(lane, data, units, big_endian);
+}
+
+__attribute__((target("avx2"), flatten)) size_t both_avx2(Lane& little, Lane& big,
+                                                          const unsigned char* data, size_t units)
+{
+    return both_blocks<Avx2>(little, big, data, units);
+}
+
+#endif  // HAVE_X86_KERNELS
+
+
+std::vector<Utf16Checker::Kernel> supported_kernels()
+{
+    std::vector<Utf16Checker::Kernel> list;
+
+#if HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        list.push_back({"avx2", single_avx2, both_avx2});
+    }
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        list.push_back({"sse2", single_sse2, both_sse2});
+    }
+#endif
+
+    list.push_back({"scalar", single_scalar, both_scalar});
+    return list;
+}
+
+//  Chosen once at startup
+const std::vector<Utf16Checker::Kernel> the_kernels = supported_kernels();
+
+//  The endianness is chosen by looking at this many units
+constexpr size_t max_units_to_examine = 1000;
+
+}  // namespace
+
+
+Utf16Checker::Utf16Checker() : m_kernel(&the_kernels.front())
+{
+    start();
+}
+
+
+const std::vector<Utf16Checker::Kernel>& Utf16Checker::kernels()
+{
+    return the_kernels;
+}
+
+
+int Utf16Checker::check(const char* data, int size)
 {
-    int unit = END_SENTINEL;
-    if (m_data != m_end)
+    //  Error if size is too small or not even
+    if (size < 2 || (size & 0x0001))
+    {
+        return eSIZE;
+    }
+
+    start();
+    feed(data, size_t(size));
+    return finish();
+}
+
+
+void Utf16Checker::start()
+{
+    m_started = false;
+    m_little_endian = true;
+    m_window = 0;
+    m_lane = Lane();
+    m_other = Lane();
+}
+
+
+void Utf16Checker::feed(const char* data, size_t size)
+{
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data);
+    size_t units = size / 2;
+    if (units == 0 || (m_window == 0 && m_lane.invalid))
+    {
+        return;
+    }
+
+    if (!m_started)
     {
-        if (m_little_endian)
-            unit = get_le_unit(m_data);
+        m_started = true;
+
+        //  UTF-16 encoded texts tend to come from Windows,
+        //  so usually they are little endian.
+        m_little_endian = true;
+
+        //  Might begin with a Byte Order Mark (BOM)
+        if (ptr[0] == 0xff && ptr[1] == 0xfe)
+        {
+            ptr += 2;
+            --units;
+        }
+        else if (ptr[0] == 0xfe && ptr[1] == 0xff)
+        {
+            m_little_endian = false;
+            ptr += 2;
+            --units;
+        }
         else
-            unit = get_be_unit(m_data);
+        {
+            //  Check some text both ways, and later choose
+            //  the endianness that produces more ASCII characters.
+            m_window = std::min(units, max_units_to_examine);
+        }
+    }
 
-        m_data += 2;
+    if (m_window > 0)
+    {
+        size_t count = std::min(units, m_window);
+        size_t done = m_kernel->both(m_lane, m_other, ptr, count);
+        both_scalar(m_lane, m_other, ptr + 2 * done, count - done);
+
+        ptr += 2 * count;
+        units -= count;
+        m_window -= count;
+        if (m_window == 0)
+        {
+            //  Change the endianness if big endian looks better
+            if (m_other.counts.normal_ascii > m_lane.counts.normal_ascii)
+            {
+                m_little_endian = false;
+                m_lane = m_other;
+            }
+        }
     }
 
-    return unit;
+    if (m_lane.invalid)
+    {
+        return;
+    }
+
+    size_t done = m_kernel->single(m_lane, ptr, units, !m_little_endian);
+    single_scalar(m_lane, ptr + 2 * done, units - done, !m_little_endian);
+}
+
+
+int Utf16Checker::finish() const
+{
+    //  Error if the last code unit was a lonely surrogate
+    if (m_lane.invalid || m_lane.after_high)
+    {
+        return eINVALID;
+    }
+
+    return eOK;
 }
@@ -18,10 +18,21 @@
 */
 #pragma once
 
+#include <cstddef>
+#include <vector>
 
+
+//  Checks whether the data could be UTF-16 encoded text, and counts
+//  the kinds of characters found.
+//
+//  The units are examined a vector at a time where the CPU allows,
+//  and both byte orders are tried on the first units in the same pass
+//  to choose the more likely one.
+//
 class Utf16Checker
 {
 public:
+    Utf16Checker();
 
     //  Possible return values
     enum {
@@ -33,28 +44,65 @@ public:
     //  Size means number of bytes in the data buffer
     int check(const char* data, int size);
 
+    //  The same check for data that comes in pieces. The total size must
+    //  be checked separately, and every piece except the last must have
+    //  an even size. The endianness is decided from the first piece.
+    void start();
+    void feed(const char* data, size_t size);
+    int finish() const;
+
+    //  True if the data fed so far can't be valid UTF-16
+    bool failed() const { return m_lane.invalid; }
+
     class Counts
     {
     public:
-        int normal_ascii;
-        int weird_ascii;
-        int total_characters;
+        long normal_ascii;
+        long weird_ascii;
+        long total_characters;
     };
 
-    const Counts& counts() const { return m_counts; }
+    const Counts& counts() const { return m_lane.counts; }
 
-private:
-    //  Try to find out endianness of the data
-    void determine_endiannes();
+    //  The byte order, once decided from the first piece
+    bool little_endian() const { return m_little_endian; }
 
-    //  Get the next 16-bit code unit.
-    int next_unit();
+    //  The state of the check in one byte order
+    struct Lane
+    {
+        Counts counts = {0, 0, 0};
+        bool after_high = false;  // The last unit was a high surrogate
+        bool invalid = false;
+    };
 
-    const unsigned char* m_data;
-    const unsigned char* m_end;
+    //  One implementation of the loops over whole blocks of units.
+    //  Both return the number of units done, and may leave a few at
+    //  the end for the caller. The single byte order version stops
+    //  as soon as the data turns out invalid.
+    struct Kernel
+    {
+        const char* name;
+        size_t (*single)(Lane& lane, const unsigned char* data, size_t units, bool big_endian);
+        size_t (*both)(Lane& little, Lane& big, const unsigned char* data, size_t units);
+    };
+
+    //  All the implementations this CPU can run, the fastest first.
+    //  The last one is always the plain scalar reference version.
+    static const std::vector<Kernel>& kernels();
+
+    void set_kernel(const Kernel& kernel) { m_kernel = &kernel; }
+
+private:
+    const Kernel* m_kernel;
+
+    bool m_started;
     bool m_little_endian;
 
-    //  Character classification results
-    Counts m_counts;
-};
+    //  Number of units still to be checked in both byte orders
+    size_t m_window;
 
+    //  Results in the chosen byte order, and while the
+    //  choice is still open, in the other one too.
+    Lane m_lane;
+    Lane m_other;
+};
@@ -0,0 +1,168 @@
+//  Change notifications for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "watcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+namespace {
+
+//  The interesting changes. A file saved in place gets closed after
+//  writing, one saved the safe way gets renamed over the old one.
+//  New and renamed directories need watches of their own.
+constexpr uint32_t watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE |
+                                IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+}  // namespace
+
+
+Watcher::~Watcher()
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+
+    if (m_signal_fd >= 0)
+    {
+        ::close(m_signal_fd);
+    }
+}
+
+
+bool Watcher::init()
+{
+    m_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    //  The signals are taken in as events. Threads started after this
+    //  inherit the mask, so the signals always end up here.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (::pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0)
+    {
+        return false;
+    }
+
+    m_signal_fd = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    return m_signal_fd >= 0;
+}
+
+
+int Watcher::add(const char* dir)
+{
+    return ::inotify_add_watch(m_fd, dir, watch_mask);
+}
+
+
+void Watcher::remove(int wd)
+{
+    ::inotify_rm_watch(m_fd, wd);
+}
+
+
+int Watcher::wait(std::vector<Event>& events, int quiet_ms, int batch_ms)
+{
+    using Clock = std::chrono::steady_clock;
+
+    events.clear();
+    Clock::time_point deadline;
+    for (;;)
+    {
+        //  Block until the first event, then only for the quiet time
+        int timeout = -1;
+        if (!events.empty())
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+            if (left.count() <= 0)
+            {
+                return eEVENTS;  // Out of time, even if it's still busy
+            }
+
+            timeout = std::min(quiet_ms, int(left.count()));
+        }
+
+        struct pollfd fds[2] = {{m_fd, POLLIN, 0}, {m_signal_fd, POLLIN, 0}};
+        int ready = ::poll(fds, 2, timeout);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return eERROR;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            return eSTOPPED;
+        }
+
+        if (ready == 0)
+        {
+            return eEVENTS;  // Quiet for long enough
+        }
+
+        bool first = events.empty();
+        if (!read_events(events))
+        {
+            return eERROR;
+        }
+
+        if (first && !events.empty())
+        {
+            deadline = Clock::now() + std::chrono::milliseconds(batch_ms);
+        }
+    }
+}
+
+
+bool Watcher::read_events(std::vector<Event>& events)
+{
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    for (;;)
+    {
+        ssize_t count = ::read(m_fd, buffer, sizeof(buffer));
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return errno == EAGAIN;
+        }
+
+        for (char* ptr = buffer; ptr < buffer + count;)
+        {
+            auto* event = reinterpret_cast<struct inotify_event*>(ptr);
+            events.push_back({event->wd, event->mask, event->len ? event->name : ""});
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+/*
+    Change notifications for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//  Waits for changes in a set of directories with inotify.
+//
+//  Every directory has a watch of its own, since inotify doesn't do
+//  whole trees. The events come in bursts when files are saved, so
+//  they are collected until things have been quiet for a while, and
+//  then handed over all at once. SIGINT and SIGTERM end the waiting,
+//  so that the caller can finish up cleanly.
+//
+class Watcher
+{
+public:
+    Watcher() = default;
+    ~Watcher();
+
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+
+    //  Returns false, with errno set, if there's no inotify
+    bool init();
+
+    //  Watch a directory. Returns the watch descriptor, or -1 with
+    //  errno set. May be called from any thread.
+    int add(const char* dir);
+
+    void remove(int wd);
+
+    struct Event
+    {
+        int wd;
+        uint32_t mask;     // IN_CLOSE_WRITE, IN_ISDIR, etc...
+        std::string name;  // Name in the directory, may be empty
+    };
+
+    //  Possible return values from wait
+    enum {
+        eEVENTS,     // Got some events
+        eSTOPPED,    // Got a signal to stop
+        eERROR,      // Reading failed, errno is set
+    };
+
+    //  Wait for the next events, and then keep collecting until there
+    //  have been none for the quiet time, or the batch time is up. Both
+    //  are in milliseconds. Events for the same file are not merged.
+    int wait(std::vector<Event>& events, int quiet_ms, int batch_ms);
+
+private:
+    //  Read whatever events there are, without blocking
+    bool read_events(std::vector<Event>& events);
+
+    int m_fd = -1;
+    int m_signal_fd = -1;
+};
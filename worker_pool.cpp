@@ -0,0 +1,171 @@
+//  Work stealing thread pool for source_normalizer
+//
+//  Copyright (C) 2020  Martti Ylioja
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "worker_pool.h"
+
+namespace {
+
+//  Lets submit() recognize calls coming from one of the workers
+thread_local const WorkerPool* current_pool = nullptr;
+thread_local int current_index = -1;
+
+}  // namespace
+
+
+WorkerPool::WorkerPool(int workers)
+{
+    if (workers < 1)
+    {
+        workers = 1;
+    }
+
+    for (int ix = 0; ix < workers; ++ix)
+    {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+
+    for (int ix = 0; ix < workers; ++ix)
+    {
+        m_threads.emplace_back(&WorkerPool::run, this, ix);
+    }
+}
+
+
+WorkerPool::~WorkerPool()
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_work_available.notify_all();
+
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+
+void WorkerPool::submit(Task task)
+{
+    int index = current_index;
+    if (current_pool != this)
+    {
+        index = int(m_next_queue++ % m_queues.size());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_pending;
+    }
+
+    Queue& queue = *m_queues[index];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_queued;
+    }
+    m_work_available.notify_one();
+}
+
+
+void WorkerPool::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_all_done.wait(lock, [this] { return m_pending == 0; });
+}
+
+
+bool WorkerPool::take(int index, Task& task)
+{
+    //  The own queue is used like a stack to keep the caches warm
+    {
+        Queue& own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    //  Steal the oldest task from somebody else
+    int count = int(m_queues.size());
+    for (int offset = 1; offset < count; ++offset)
+    {
+        Queue& other = *m_queues[(index + offset) % count];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty())
+        {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void WorkerPool::run(int index)
+{
+    current_pool = this;
+    current_index = index;
+
+    Task task;
+    for (;;)
+    {
+        if (take(index, task))
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_queued;
+            }
+
+            task(index);
+            task = nullptr;
+
+            bool done = false;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                done = (--m_pending == 0);
+            }
+
+            if (done)
+            {
+                m_all_done.notify_all();
+            }
+
+            continue;
+        }
+
+        //  Nothing to do, so sleep until more work arrives.
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_work_available.wait(lock, [this] { return m_stop || m_queued > 0; });
+        if (m_stop)
+        {
+            return;
+        }
+    }
+}
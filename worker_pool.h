@@ -0,0 +1,82 @@
+/*
+    Work stealing thread pool for source_normalizer
+
+    Copyright (C) 2020  Martti Ylioja
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//  A fixed set of worker threads, each with its own task queue.
+//
+//  A worker takes tasks from the back of its own queue, and when
+//  that runs dry, steals from the front of the other queues.
+//  Every task gets the index of the worker running it, so the
+//  caller can keep per-worker state without any locking.
+//
+class WorkerPool
+{
+public:
+    using Task = std::function<void(int worker)>;
+
+    explicit WorkerPool(int workers);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    int size() const { return int(m_threads.size()); }
+
+    //  Queue a task. Tasks submitted from within a worker go to
+    //  that worker's own queue, others are spread round robin.
+    void submit(Task task);
+
+    //  Wait until all submitted tasks, including the ones they
+    //  submitted in turn, have been run.
+    void wait();
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void run(int index);
+
+    //  Take a task from the own queue, or steal one from the others
+    bool take(int index, Task& task);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_work_available;
+    std::condition_variable m_all_done;
+
+    int m_queued = 0;    // Tasks waiting in the queues (guarded by m_mutex)
+    int m_pending = 0;   // Tasks queued or running (guarded by m_mutex)
+    bool m_stop = false;
+
+    std::atomic<unsigned> m_next_queue{0};
+};